@@ -0,0 +1,38 @@
+#!/usr/bin/env perl
+use strict;
+use warnings;
+
+# Compare the XS backend with the syscall() fallback by moving a small buffer
+# through a pipe: vmsplice it in and splice it out to /dev/null.
+
+use Benchmark qw(cmpthese);
+
+use Sys::Splice;
+use Sys::Splice::XS;
+
+my $count = shift || -3;
+my $size = shift || 4096;
+
+my $buf = "x" x $size;
+my $vecs = Sys::Splice::pack_iovec($buf);
+
+pipe my $pipe_out, my $pipe_in or die ("Could not make pipe: $!");
+open my $null, ">", "/dev/null" or die ("Could not open /dev/null: $!");
+
+my ($fd_out, $fd_in, $fd_null) = (fileno($pipe_out), fileno($pipe_in),
+    fileno($null));
+
+cmpthese($count, {
+    syscall => sub {
+        Sys::Splice::_syscall_vmsplice($fd_in, $vecs, 1, 0) == $size
+            or die "vmsplice: $!";
+        Sys::Splice::_syscall_splice($fd_out, undef, $fd_null, undef, $size, 0)
+            == $size or die "splice: $!";
+    },
+    xs => sub {
+        Sys::Splice::XS::sys_vmsplice($fd_in, $vecs, 1, 0) == $size
+            or die "vmsplice: $!";
+        Sys::Splice::XS::sys_splice($fd_out, undef, $fd_null, undef, $size, 0)
+            == $size or die "splice: $!";
+    },
+});
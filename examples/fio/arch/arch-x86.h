@@ -41,4 +41,40 @@ static inline unsigned long arch_ffz(unsigned long bitmask)
 #define ARCH_HAVE_FFZ
 #define ARCH_HAVE_SSE
 
+static inline void do_cpuid(unsigned int *eax, unsigned int *ebx,
+			    unsigned int *ecx, unsigned int *edx)
+{
+	asm volatile("cpuid"
+		: "=a" (*eax), "=b" (*ebx), "=c" (*ecx), "=d" (*edx)
+		: "0" (*eax), "2" (*ecx));
+}
+
+static inline unsigned long long get_cpu_clock(void)
+{
+	unsigned int lo, hi;
+
+	__asm__ __volatile__("rdtsc" : "=a" (lo), "=d" (hi));
+	return ((unsigned long long) hi << 32ULL) | lo;
+}
+
+/*
+ * The TSC only makes a clock if it ticks at a constant rate through
+ * frequency changes and deep C-states
+ */
+static inline int arch_cpu_clock_invariant(void)
+{
+	unsigned int eax, ebx, ecx = 0, edx;
+
+	eax = 0x80000000;
+	do_cpuid(&eax, &ebx, &ecx, &edx);
+	if (eax < 0x80000007)
+		return 0;
+
+	eax = 0x80000007;
+	ecx = 0;
+	do_cpuid(&eax, &ebx, &ecx, &edx);
+	return (edx & (1 << 8)) != 0;
+}
+#define ARCH_HAVE_CPU_CLOCK
+
 #endif
@@ -0,0 +1,245 @@
+/*
+ * Streaming binary bw/lat logs, see binlog.h for the format. This file
+ * doesn't depend on the rest of fio, so the decoder tool can link it
+ * on its own.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#include "binlog.h"
+
+static int write_all(int fd, unsigned char *buf, unsigned int len)
+{
+	while (len) {
+		ssize_t ret = write(fd, buf, len);
+
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			return -errno;
+		}
+
+		buf += ret;
+		len -= ret;
+	}
+
+	return 0;
+}
+
+/*
+ * Write one buffer as a block, in a single write so that an O_APPEND file
+ * shared with other jobs doesn't get blocks cut in two
+ */
+static int flush_buf(struct binlog *bl, int idx)
+{
+	unsigned char *buf = bl->bufs[idx];
+	unsigned int payload = bl->len[idx] - BINLOG_HDR_LEN;
+	int i;
+
+	for (i = 0; i < 4; i++) {
+		buf[i] = (BINLOG_MAGIC >> (i * 8)) & 0xff;
+		buf[4 + i] = (payload >> (i * 8)) & 0xff;
+	}
+
+	return write_all(bl->fd, buf, bl->len[idx]);
+}
+
+static void *flush_thread_main(void *data)
+{
+	struct binlog *bl = data;
+	int idx, ret;
+
+	pthread_mutex_lock(&bl->lock);
+	while (1) {
+		while (bl->pending == -1 && !bl->exit)
+			pthread_cond_wait(&bl->cond, &bl->lock);
+		if (bl->pending == -1)
+			break;
+
+		idx = bl->pending;
+		pthread_mutex_unlock(&bl->lock);
+
+		ret = flush_buf(bl, idx);
+
+		pthread_mutex_lock(&bl->lock);
+		if (ret && !bl->error)
+			bl->error = ret;
+		bl->flushes++;
+		bl->pending = -1;
+		pthread_cond_broadcast(&bl->cond);
+	}
+	pthread_mutex_unlock(&bl->lock);
+
+	return NULL;
+}
+
+static void start_buf(struct binlog *bl, int idx)
+{
+	bl->len[idx] = BINLOG_HDR_LEN;
+	bl->prev_time = 0;
+	bl->prev_val = 0;
+}
+
+struct binlog *binlog_open(const char *name)
+{
+	struct binlog *bl;
+
+	bl = calloc(1, sizeof(*bl));
+	if (!bl)
+		return NULL;
+
+	bl->bufs[0] = malloc(BINLOG_BUF_LEN);
+	bl->bufs[1] = malloc(BINLOG_BUF_LEN);
+	if (!bl->bufs[0] || !bl->bufs[1])
+		goto err;
+
+	bl->fd = open(name, O_WRONLY | O_CREAT | O_APPEND, 0644);
+	if (bl->fd < 0)
+		goto err;
+
+	bl->pending = -1;
+	start_buf(bl, 0);
+	pthread_mutex_init(&bl->lock, NULL);
+	pthread_cond_init(&bl->cond, NULL);
+
+	if (pthread_create(&bl->thread, NULL, flush_thread_main, bl)) {
+		close(bl->fd);
+		goto err;
+	}
+
+	return bl;
+err:
+	free(bl->bufs[0]);
+	free(bl->bufs[1]);
+	free(bl);
+	return NULL;
+}
+
+/*
+ * The current buffer is full, queue it for writing and switch to the
+ * other one once the flush thread is done with it
+ */
+void __binlog_switch(struct binlog *bl)
+{
+	pthread_mutex_lock(&bl->lock);
+	while (bl->pending != -1) {
+		bl->waits++;
+		pthread_cond_wait(&bl->cond, &bl->lock);
+	}
+
+	bl->pending = bl->cur;
+	pthread_cond_broadcast(&bl->cond);
+	pthread_mutex_unlock(&bl->lock);
+
+	bl->cur ^= 1;
+	start_buf(bl, bl->cur);
+}
+
+/*
+ * Write out what is left and stop the flush thread. Returns 0 or a
+ * negative errno from writing the file.
+ */
+int binlog_close(struct binlog *bl)
+{
+	int ret;
+
+	if (bl->len[bl->cur] > BINLOG_HDR_LEN)
+		__binlog_switch(bl);
+
+	pthread_mutex_lock(&bl->lock);
+	bl->exit = 1;
+	pthread_cond_broadcast(&bl->cond);
+	pthread_mutex_unlock(&bl->lock);
+	pthread_join(bl->thread, NULL);
+
+	ret = bl->error;
+	if (close(bl->fd) < 0 && !ret)
+		ret = -errno;
+
+	pthread_mutex_destroy(&bl->lock);
+	pthread_cond_destroy(&bl->cond);
+	free(bl->bufs[0]);
+	free(bl->bufs[1]);
+	free(bl);
+	return ret;
+}
+
+static int get_varint(unsigned char **p, unsigned char *end,
+		      unsigned long long *v)
+{
+	unsigned int shift = 0;
+
+	*v = 0;
+	while (*p < end && shift < 64) {
+		unsigned char c = *(*p)++;
+
+		*v |= (unsigned long long) (c & 0x7f) << shift;
+		if (!(c & 0x80))
+			return 0;
+		shift += 7;
+	}
+
+	return 1;
+}
+
+static long long unzigzag(unsigned long long v)
+{
+	return (v >> 1) ^ -(long long) (v & 1);
+}
+
+/*
+ * Turn a binary log into the text format, one "time, value, ddir" line
+ * per sample. Returns 0, or 1 if the input is not a valid log.
+ */
+int binlog_decode(FILE *in, FILE *out)
+{
+	unsigned char hdr[BINLOG_HDR_LEN], *buf;
+	int i, ret = 0;
+
+	buf = malloc(BINLOG_BUF_LEN);
+	if (!buf)
+		return 1;
+
+	while (fread(hdr, 1, sizeof(hdr), in) == sizeof(hdr)) {
+		unsigned int magic = 0, len = 0;
+		unsigned long time = 0, val = 0;
+		unsigned char *p, *end;
+
+		for (i = 0; i < 4; i++) {
+			magic |= hdr[i] << (i * 8);
+			len |= hdr[4 + i] << (i * 8);
+		}
+
+		if (magic != BINLOG_MAGIC || len > BINLOG_BUF_LEN ||
+		    fread(buf, 1, len, in) != len) {
+			ret = 1;
+			break;
+		}
+
+		p = buf;
+		end = buf + len;
+		while (p < end) {
+			unsigned long long t, v;
+
+			if (get_varint(&p, end, &t) || get_varint(&p, end, &v)) {
+				ret = 1;
+				goto out;
+			}
+
+			time += unzigzag(t >> 1);
+			val += unzigzag(v);
+			fprintf(out, "%lu, %lu, %u\n", time, val,
+					(unsigned int) (t & 1));
+		}
+	}
+
+	if (!ret && ferror(in))
+		ret = 1;
+out:
+	free(buf);
+	return ret;
+}
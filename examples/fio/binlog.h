@@ -0,0 +1,93 @@
+#ifndef FIO_BINLOG_H
+#define FIO_BINLOG_H
+
+#include <stdio.h>
+#include <pthread.h>
+
+/*
+ * Binary bw/lat logs, streamed to the file while the job runs instead of
+ * kept in memory until the end.
+ *
+ * The file is a series of blocks, each a 4 byte magic, a 4 byte little
+ * endian payload length and the payload. A payload is a list of samples,
+ * each two varints: the zigzag encoded time delta shifted up by one with
+ * the data direction in the low bit, then the zigzag encoded value delta.
+ * Deltas start from zero in every block, so blocks stand alone and jobs
+ * that share a log file can append to it at the same time.
+ */
+#define BINLOG_MAGIC		0x314c4246	/* "FBL1" */
+#define BINLOG_HDR_LEN		8
+#define BINLOG_BUF_LEN		(64 * 1024)
+
+/*
+ * Worst case size of one encoded sample, two 64-bit varints
+ */
+#define BINLOG_MAX_SAMPLE	20
+
+struct binlog {
+	int fd;
+
+	/*
+	 * Samples are encoded into bufs[cur]. A full buffer is handed to
+	 * the flush thread as pending and filling moves on to the other.
+	 */
+	unsigned char *bufs[2];
+	unsigned int len[2];
+	int cur;
+	int pending;
+	int exit;
+	int error;
+
+	unsigned long prev_time;
+	unsigned long prev_val;
+
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+
+	unsigned long flushes;
+	unsigned long waits;
+};
+
+extern struct binlog *binlog_open(const char *);
+extern void __binlog_switch(struct binlog *);
+extern int binlog_close(struct binlog *);
+extern int binlog_decode(FILE *, FILE *);
+
+static inline unsigned char *binlog_put_varint(unsigned char *p,
+					       unsigned long long v)
+{
+	while (v >= 0x80) {
+		*p++ = v | 0x80;
+		v >>= 7;
+	}
+	*p++ = v;
+	return p;
+}
+
+static inline unsigned long long binlog_zigzag(long long v)
+{
+	return ((unsigned long long) v << 1) ^ (v >> 63);
+}
+
+static inline void binlog_add(struct binlog *bl, unsigned long time,
+			      unsigned long val, unsigned int ddir)
+{
+	unsigned char *start, *p;
+	unsigned long long t;
+
+	if (bl->len[bl->cur] + BINLOG_MAX_SAMPLE > BINLOG_BUF_LEN)
+		__binlog_switch(bl);
+
+	start = bl->bufs[bl->cur] + bl->len[bl->cur];
+
+	t = binlog_zigzag((long long) (time - bl->prev_time));
+	p = binlog_put_varint(start, (t << 1) | (ddir & 1));
+	p = binlog_put_varint(p, binlog_zigzag((long long) (val - bl->prev_val)));
+
+	bl->prev_time = time;
+	bl->prev_val = val;
+	bl->len[bl->cur] += p - start;
+}
+
+#endif
@@ -15,6 +15,7 @@ enum {
 	FD_PARSE,
 	FD_DISKUTIL,
 	FD_JOB,
+	FD_TIME,
 	FD_DEBUG_MAX,
 };
 
@@ -9,6 +9,7 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <assert.h>
 #include <sys/poll.h>
 #include <sys/mman.h>
@@ -19,10 +20,40 @@
 
 struct spliceio_data {
 	int pipe[2];
+	int pipe_size;
 	int vmsplice_to_user;
 	int vmsplice_to_user_map;
 };
 
+/*
+ * Grow the pipe to the wanted size, but no larger than what an unprivileged
+ * process may ask for. Returns the pipe size the kernel ended up with, which
+ * is what we splice in chunks of.
+ */
+static int fio_splice_pipe_size(int fd, unsigned int size)
+{
+	unsigned int max_size;
+	FILE *f;
+	int ret;
+
+	if (size) {
+		f = fopen("/proc/sys/fs/pipe-max-size", "r");
+		if (f) {
+			if (fscanf(f, "%u", &max_size) == 1 && size > max_size)
+				size = max_size;
+			fclose(f);
+		}
+
+		fcntl(fd, F_SETPIPE_SZ, size);
+	}
+
+	ret = fcntl(fd, F_GETPIPE_SZ);
+	if (ret <= 0)
+		return SPLICE_DEF_SIZE;
+
+	return ret;
+}
+
 /*
  * vmsplice didn't use to support splicing to user space, this is the old
  * variant of getting that job done. Doesn't make a lot of sense, but it
@@ -42,8 +73,8 @@ static int fio_splice_read_old(struct thread_data *td, struct io_u *io_u)
 	while (buflen) {
 		int this_len = buflen;
 
-		if (this_len > SPLICE_DEF_SIZE)
-			this_len = SPLICE_DEF_SIZE;
+		if (this_len > sd->pipe_size)
+			this_len = sd->pipe_size;
 
 		ret = splice(f->fd, &offset, sd->pipe[1], NULL, this_len, SPLICE_F_MORE);
 		if (ret < 0) {
@@ -103,8 +134,8 @@ restart:
 		int this_len = buflen;
 		int flags = 0;
 
-		if (this_len > SPLICE_DEF_SIZE) {
-			this_len = SPLICE_DEF_SIZE;
+		if (this_len > sd->pipe_size) {
+			this_len = sd->pipe_size;
 			flags = SPLICE_F_MORE;
 		}
 
@@ -263,6 +294,8 @@ static int fio_spliceio_init(struct thread_data *td)
 		return 1;
 	}
 
+	sd->pipe_size = fio_splice_pipe_size(sd->pipe[1], td->o.pipe_size);
+
 	/*
 	 * Assume this work, we'll reset this if it doesn't
 	 */
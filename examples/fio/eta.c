@@ -210,11 +210,11 @@ void print_thread_status(void)
 	double perc = 0.0;
 	unsigned long long io_bytes[2];
 	unsigned long rate_time, disp_time, bw_avg_time, *eta_secs, eta_sec;
-	struct timeval now;
+	struct timespec now;
 
 	static unsigned long long rate_io_bytes[2];
 	static unsigned long long disp_io_bytes[2];
-	static struct timeval rate_prev_time, disp_prev_time;
+	static struct timespec rate_prev_time, disp_prev_time;
 	static unsigned int rate[2];
 	static int linelen_last;
 	static int eta_good;
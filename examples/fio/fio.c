@@ -183,7 +183,7 @@ static inline int should_check_rate(struct thread_data *td)
 /*
  * Check if we are above the minimum rate given.
  */
-static int check_min_rate(struct thread_data *td, struct timeval *now)
+static int check_min_rate(struct thread_data *td, struct timespec *now)
 {
 	unsigned long long bytes = 0;
 	unsigned long iops = 0;
@@ -258,7 +258,7 @@ static int check_min_rate(struct thread_data *td, struct timeval *now)
 	return 0;
 }
 
-static inline int runtime_exceeded(struct thread_data *td, struct timeval *t)
+static inline int runtime_exceeded(struct thread_data *td, struct timespec *t)
 {
 	if (!td->o.timeout)
 		return 0;
@@ -526,7 +526,7 @@ static void do_io(struct thread_data *td)
 		td_set_runstate(td, TD_RUNNING);
 
 	while ((td->this_io_bytes[0] + td->this_io_bytes[1]) < td->o.size) {
-		struct timeval comp_time;
+		struct timespec comp_time;
 		long bytes_done = 0;
 		int min_evts = 0;
 		struct io_u *io_u;
@@ -878,7 +878,7 @@ static void reset_io_counters(struct thread_data *td)
 
 void reset_all_stats(struct thread_data *td)
 {
-	struct timeval tv;
+	struct timespec tv;
 	int i;
 
 	reset_io_counters(td);
@@ -916,6 +916,40 @@ static int clear_io_state(struct thread_data *td)
 	return ret;
 }
 
+/*
+ * Binary logs are streamed out by a thread per log, so they have to be
+ * opened from the job itself
+ */
+static int start_logs(struct thread_data *td)
+{
+	if (td->ts.bw_log) {
+		if (td->o.bw_log_file) {
+			if (start_log_named(td, td->ts.bw_log,
+						td->o.bw_log_file, "bw"))
+				return 1;
+		} else if (start_log(td, td->ts.bw_log, "bw"))
+			return 1;
+	}
+	if (td->ts.slat_log) {
+		if (td->o.lat_log_file) {
+			if (start_log_named(td, td->ts.slat_log,
+						td->o.lat_log_file, "slat"))
+				return 1;
+		} else if (start_log(td, td->ts.slat_log, "slat"))
+			return 1;
+	}
+	if (td->ts.clat_log) {
+		if (td->o.lat_log_file) {
+			if (start_log_named(td, td->ts.clat_log,
+						td->o.lat_log_file, "clat"))
+				return 1;
+		} else if (start_log(td, td->ts.clat_log, "clat"))
+			return 1;
+	}
+
+	return 0;
+}
+
 /*
  * Entry point for the thread based jobs. The process based jobs end up
  * here as well, after a little setup.
@@ -1009,6 +1043,9 @@ static void *thread_main(void *data)
 			goto err;
 	}
 
+	if (start_logs(td))
+		goto err;
+
 	fio_gettime(&td->epoch, NULL);
 	getrusage(RUSAGE_SELF, &td->ts.ru_start);
 
@@ -1089,7 +1126,7 @@ static void *thread_main(void *data)
 	if (td->ts.slat_log) {
 		if (td->o.lat_log_file) {
 			finish_log_named(td, td->ts.slat_log,
-						td->o.lat_log_file, "clat");
+						td->o.lat_log_file, "slat");
 		} else
 			finish_log(td, td->ts.slat_log, "slat");
 	}
@@ -1361,7 +1398,7 @@ static void run_threads(void)
 
 	while (todo) {
 		struct thread_data *map[MAX_JOBS];
-		struct timeval this_start;
+		struct timespec this_start;
 		int this_jobs = 0, left;
 
 		/*
@@ -24,6 +24,8 @@
 #include "mutex.h"
 #include "log.h"
 #include "debug.h"
+#include "lat_hist.h"
+#include "binlog.h"
 
 #ifdef FIO_HAVE_GUASI
 #include <guasi.h>
@@ -56,12 +58,21 @@ enum file_lock_mode {
 	FILE_LOCK_READWRITE,
 };
 
+/*
+ * Where fio_gettime() gets the time from
+ */
+enum fio_cs {
+	CS_GTOD		= 1,
+	CS_CGETTIME,
+	CS_CPUCLOCK,
+};
+
 /*
  * Use for maintaining statistics
  */
 struct io_stat {
-	unsigned long max_val;
-	unsigned long min_val;
+	unsigned long long max_val;
+	unsigned long long min_val;
 	unsigned long samples;
 
 	double mean;
@@ -78,12 +89,14 @@ struct io_sample {
 };
 
 /*
- * Dynamically growing data sample log
+ * Dynamically growing data sample log. With binary_log, samples go
+ * straight to bin instead and are never kept here.
  */
 struct io_log {
 	unsigned long nr_samples;
 	unsigned long max_samples;
 	struct io_sample *log;
+	struct binlog *bin;
 };
 
 /*
@@ -135,8 +148,8 @@ struct io_u {
 		aio_result_t resultp;
 #endif
 	};
-	struct timeval start_time;
-	struct timeval issue_time;
+	struct timespec start_time;
+	struct timespec issue_time;
 
 	/*
 	 * Allocated/set buffer and length
@@ -367,12 +380,13 @@ struct thread_stat {
 	/*
 	 * bandwidth and latency stats
 	 */
-	struct io_stat clat_stat[2];		/* completion latency */
-	struct io_stat slat_stat[2];		/* submission latency */
+	struct io_stat clat_stat[2];		/* completion latency, nsec */
+	struct io_stat slat_stat[2];		/* submission latency, nsec */
 	struct io_stat bw_stat[2];		/* bandwidth stats */
+	struct lat_hist clat_hist[2];		/* completion latency, nsec */
 
 	unsigned long long stat_io_bytes[2];
-	struct timeval stat_sample_time[2];
+	struct timespec stat_sample_time[2];
 
 	/*
 	 * fio system usage accounting
@@ -390,8 +404,6 @@ struct thread_stat {
 	unsigned int io_u_map[FIO_IO_U_MAP_NR];
 	unsigned int io_u_submit[FIO_IO_U_MAP_NR];
 	unsigned int io_u_complete[FIO_IO_U_MAP_NR];
-	unsigned int io_u_lat_u[FIO_IO_U_LAT_U_NR];
-	unsigned int io_u_lat_m[FIO_IO_U_LAT_M_NR];
 	unsigned long total_io_u[2];
 	unsigned long short_io_u[2];
 	unsigned long total_submit;
@@ -460,12 +472,14 @@ struct thread_options {
 	unsigned int rand_repeatable;
 	unsigned int write_lat_log;
 	unsigned int write_bw_log;
+	unsigned int binary_log;
 	unsigned int norandommap;
 	unsigned int softrandommap;
 	unsigned int bs_unaligned;
 	unsigned int fsync_on_close;
 
 	unsigned int hugepage_size;
+	unsigned int pipe_size;
 	unsigned int rw_min_bs;
 	unsigned int thinktime;
 	unsigned int thinktime_spin;
@@ -502,6 +516,7 @@ struct thread_options {
 	unsigned int gtod_reduce;
 	unsigned int gtod_cpu;
 	unsigned int gtod_offload;
+	unsigned int clocksource;
 
 	char *read_iolog_file;
 	char *write_iolog_file;
@@ -596,7 +611,7 @@ struct thread_data {
 	long rate_pending_usleep;
 	unsigned long rate_bytes;
 	unsigned long rate_blocks;
-	struct timeval lastrate;
+	struct timespec lastrate;
 
 	unsigned long long total_io_size;
 
@@ -613,11 +628,11 @@ struct thread_data {
 	 */
 	os_random_state_t random_state;
 
-	struct timeval start;	/* start of this loop */
-	struct timeval epoch;	/* time job was started */
-	struct timeval rw_end[2];
-	struct timeval last_issue;
-	struct timeval tv_cache;
+	struct timespec start;	/* start of this loop */
+	struct timespec epoch;	/* time job was started */
+	struct timespec rw_end[2];
+	struct timespec last_issue;
+	struct timespec tv_cache;
 	unsigned int tv_cache_nr;
 	unsigned int tv_cache_mask;
 	unsigned int rw_end_set[2];
@@ -703,6 +718,7 @@ extern unsigned long done_secs;
 extern char *job_section;
 extern int fio_gtod_offload;
 extern int fio_gtod_cpu;
+extern int fio_clock_source;
 
 extern struct thread_data *threads;
 
@@ -776,7 +792,7 @@ struct disk_util {
 	struct flist_head slaves;
 
 	unsigned long msec;
-	struct timeval time;
+	struct timespec time;
 };
 
 #define DISK_UTIL_MSEC	(250)
@@ -803,14 +819,16 @@ extern void write_iolog_close(struct thread_data *);
 /*
  * Logging
  */
-extern void add_clat_sample(struct thread_data *, enum fio_ddir, unsigned long);
-extern void add_slat_sample(struct thread_data *, enum fio_ddir, unsigned long);
-extern void add_bw_sample(struct thread_data *, enum fio_ddir, struct timeval *);
+extern void add_clat_sample(struct thread_data *, enum fio_ddir, unsigned long long);
+extern void add_slat_sample(struct thread_data *, enum fio_ddir, unsigned long long);
+extern void add_bw_sample(struct thread_data *, enum fio_ddir, struct timespec *);
 extern void show_run_stats(void);
 extern void init_disk_util(struct thread_data *);
 extern void update_rusage_stat(struct thread_data *);
 extern void update_io_ticks(void);
 extern void setup_log(struct io_log **);
+extern int start_log(struct thread_data *, struct io_log *, const char *);
+extern int start_log_named(struct thread_data *, struct io_log *, const char *, const char *);
 extern void finish_log(struct thread_data *, struct io_log *, const char *);
 extern void finish_log_named(struct thread_data *, struct io_log *, const char *, const char *);
 extern void __finish_log(struct io_log *, const char *);
@@ -821,17 +839,21 @@ extern void add_agg_sample(unsigned long, enum fio_ddir);
 /*
  * Time functions
  */
-extern unsigned long long utime_since(struct timeval *, struct timeval *);
-extern unsigned long long utime_since_now(struct timeval *);
-extern unsigned long mtime_since(struct timeval *, struct timeval *);
-extern unsigned long mtime_since_now(struct timeval *);
-extern unsigned long time_since_now(struct timeval *);
+extern unsigned long long ntime_since(struct timespec *, struct timespec *);
+extern unsigned long long ntime_since_now(struct timespec *);
+extern unsigned long long utime_since(struct timespec *, struct timespec *);
+extern unsigned long long utime_since_now(struct timespec *);
+extern unsigned long mtime_since(struct timespec *, struct timespec *);
+extern unsigned long mtime_since_now(struct timespec *);
+extern unsigned long mtime_since_tv(struct timeval *, struct timeval *);
+extern unsigned long time_since_now(struct timespec *);
 extern unsigned long mtime_since_genesis(void);
 extern void usec_spin(unsigned int);
 extern void usec_sleep(struct thread_data *, unsigned long);
 extern void rate_throttle(struct thread_data *, unsigned long, unsigned int);
-extern void fill_start_time(struct timeval *);
-extern void fio_gettime(struct timeval *, void *);
+extern void fill_start_time(struct timespec *);
+extern void fio_gettime(struct timespec *, void *);
+extern void fio_clock_init(void);
 extern void fio_gtod_init(void);
 extern void fio_gtod_update(void);
 extern void set_genesis_time(void);
@@ -10,11 +10,12 @@
 
 #include "hash.h"
 
-static int clock_gettime_works;
-static struct timeval last_tv;
-static int last_tv_valid;
+int fio_clock_source = CS_CGETTIME;
 
-static struct timeval *fio_tv;
+static struct timespec last_ts;
+static int last_ts_valid;
+
+static struct timespec *fio_ts;
 int fio_gtod_offload = 0;
 int fio_gtod_cpu = -1;
 
@@ -109,10 +110,250 @@ static void fio_init gtod_init(void)
 
 #endif /* FIO_DEBUG_TIME */
 
+#ifdef ARCH_HAVE_CPU_CLOCK
+
+/*
+ * The cpu clock is calibrated against CLOCK_MONOTONIC over
+ * CLOCK_CAL_ROUNDS intervals of CLOCK_CAL_NSEC. Rounds that disagree by
+ * more than 1/CLOCK_CAL_SPREAD mean the rate isn't constant.
+ */
+#define CLOCK_CAL_ROUNDS	10
+#define CLOCK_CAL_NSEC		5000000ULL
+#define CLOCK_CAL_SPREAD	1000
+
+/*
+ * How far apart CPUs may be, in nsec
+ */
+#define CPU_CLOCK_MAX_SKEW	1000
+
+/*
+ * nsec = nsec_base + ((cycles - cycles_base) * clock_mult) >> CLOCK_SHIFT
+ */
+#define CLOCK_SHIFT		24
+
+static unsigned long long cycles_base, nsec_base;
+static unsigned long long clock_mult;
+
+static unsigned long long mono_nsec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*
+ * Split the multiply so it doesn't overflow for a cycle count of hours
+ */
+static inline unsigned long long cpu_clock_nsec(unsigned long long cycles)
+{
+	unsigned long long delta;
+
+	if ((long long) (cycles - cycles_base) < 0)
+		return nsec_base;
+
+	delta = cycles - cycles_base;
+	return nsec_base + (((delta >> 32) * clock_mult) << (32 - CLOCK_SHIFT)) +
+		(((delta & 0xffffffffULL) * clock_mult) >> CLOCK_SHIFT);
+}
+
+/*
+ * Read the cpu clock and CLOCK_MONOTONIC as close together as we can
+ */
+static void clock_pair(unsigned long long *cycles, unsigned long long *nsec)
+{
+	unsigned long long c0, c1, n, best = -1ULL;
+	int i;
+
+	for (i = 0; i < 5; i++) {
+		c0 = get_cpu_clock();
+		n = mono_nsec();
+		c1 = get_cpu_clock();
+
+		if (c1 - c0 < best) {
+			best = c1 - c0;
+			*cycles = c0 + best / 2;
+			*nsec = n;
+		}
+	}
+}
+
+static int calibrate_cpu_clock(void)
+{
+	unsigned long long c[CLOCK_CAL_ROUNDS + 1], n[CLOCK_CAL_ROUNDS + 1];
+	double rate, min = 0, max = 0;
+	int i;
+
+	clock_pair(&c[0], &n[0]);
+	for (i = 1; i <= CLOCK_CAL_ROUNDS; i++) {
+		do {
+			clock_pair(&c[i], &n[i]);
+		} while (n[i] - n[i - 1] < CLOCK_CAL_NSEC);
+
+		rate = (double) (c[i] - c[i - 1]) / (double) (n[i] - n[i - 1]);
+		if (i == 1 || rate < min)
+			min = rate;
+		if (i == 1 || rate > max)
+			max = rate;
+	}
+
+	if ((max - min) * CLOCK_CAL_SPREAD > min) {
+		log_err("fio: cpu clock rate varies from %.1f to %.1f MHz\n",
+						min * 1000.0, max * 1000.0);
+		return 1;
+	}
+
+	/*
+	 * Use the whole span for the rate, the rounds only check it
+	 */
+	rate = (double) (c[CLOCK_CAL_ROUNDS] - c[0]) /
+			(double) (n[CLOCK_CAL_ROUNDS] - n[0]);
+	if (rate < 0.01) {
+		log_err("fio: cpu clock too slow, %.1f MHz\n", rate * 1000.0);
+		return 1;
+	}
+
+	clock_mult = (unsigned long long) ((1ULL << CLOCK_SHIFT) / rate + 0.5);
+	cycles_base = c[CLOCK_CAL_ROUNDS];
+	nsec_base = n[CLOCK_CAL_ROUNDS];
+
+	dprint(FD_TIME, "cpu clock %.3f MHz, mult=%llu\n", rate * 1000.0,
+								clock_mult);
+	return 0;
+}
+
+/*
+ * Jobs may run on any CPU, so check that every CPU we can run on has a
+ * clock that agrees with CLOCK_MONOTONIC after calibration
+ */
+static int check_cpu_clock_skew(void)
+{
+#ifdef FIO_HAVE_CPU_BIND
+	os_cpu_mask_t old, mask;
+	unsigned long long cycles, nsec;
+	long long off, lo = 0, hi = 0;
+	int cpu, nr = 0;
+
+	if (fio_getaffinity(0, &old) < 0) {
+		log_err("fio: can't get cpu affinity: %s\n", strerror(errno));
+		return 1;
+	}
+
+	for (cpu = 0; cpu < FIO_MAX_CPUS; cpu++) {
+		if (!fio_cpu_isset(&old, cpu))
+			continue;
+
+		fio_cpuset_init(&mask);
+		fio_cpu_set(&mask, cpu);
+		if (fio_cpu_bind(&mask) < 0)
+			continue;
+
+		clock_pair(&cycles, &nsec);
+		off = (long long) (nsec - cpu_clock_nsec(cycles));
+		dprint(FD_TIME, "cpu %d clock offset %lld nsec\n", cpu, off);
+
+		if (!nr || off < lo)
+			lo = off;
+		if (!nr || off > hi)
+			hi = off;
+		nr++;
+	}
+
+	fio_cpu_bind(&old);
+
+	if (hi - lo > CPU_CLOCK_MAX_SKEW) {
+		log_err("fio: cpu clocks are %lld nsec apart\n", hi - lo);
+		return 1;
+	}
+#endif
+	/*
+	 * Without a way to bind to a CPU, trust the invariant bit
+	 */
+	return 0;
+}
+
+static void fio_cpu_clock_init(void)
+{
+	if (!arch_cpu_clock_invariant())
+		log_err("fio: cpu clock isn't invariant\n");
+	else if (!calibrate_cpu_clock() && !check_cpu_clock_skew())
+		return;
+
+	log_err("fio: using clock_gettime instead of the cpu clock\n");
+	fio_clock_source = CS_CGETTIME;
+}
+
+#else
+
+static void fio_cpu_clock_init(void)
+{
+	log_err("fio: no cpu clock on this arch, using clock_gettime\n");
+	fio_clock_source = CS_CGETTIME;
+}
+
+#endif /* ARCH_HAVE_CPU_CLOCK */
+
+/*
+ * Called once the options are parsed, before any job runs, so forked
+ * jobs inherit the calibration
+ */
+void fio_clock_init(void)
+{
+	if (fio_clock_source == CS_CPUCLOCK)
+		fio_cpu_clock_init();
+}
+
+static void __fio_gettime(struct timespec *tp)
+{
+	switch (fio_clock_source) {
+#ifdef ARCH_HAVE_CPU_CLOCK
+	case CS_CPUCLOCK: {
+		unsigned long long nsec = cpu_clock_nsec(get_cpu_clock());
+
+		/*
+		 * The clocks were only checked to agree across CPUs to
+		 * within CPU_CLOCK_MAX_SKEW, so a migration can still step
+		 * back a little. The fixup below catches that.
+		 */
+		tp->tv_sec = nsec / 1000000000ULL;
+		tp->tv_nsec = nsec - tp->tv_sec * 1000000000ULL;
+		break;
+		}
+#endif
+	case CS_CGETTIME:
+		if (!clock_gettime(CLOCK_MONOTONIC, tp))
+			break;
+		fio_clock_source = CS_GTOD;
+		/* fall through */
+	default: {
+		struct timeval tv;
+
+		gettimeofday(&tv, NULL);
+		tp->tv_sec = tv.tv_sec;
+		tp->tv_nsec = tv.tv_usec * 1000;
+		break;
+		}
+	}
+
+	/*
+	 * If Linux is using the tsc clock on non-synced processors, or the
+	 * cpu clock moved to a CPU that is slightly behind, time can appear
+	 * to drift backwards. Fix that up.
+	 */
+	if (last_ts_valid) {
+		if (tp->tv_sec < last_ts.tv_sec ||
+		    (tp->tv_sec == last_ts.tv_sec &&
+		     tp->tv_nsec < last_ts.tv_nsec))
+			*tp = last_ts;
+	}
+	last_ts_valid = 1;
+	memcpy(&last_ts, tp, sizeof(*tp));
+}
+
 #ifdef FIO_DEBUG_TIME
-void fio_gettime(struct timeval *tp, void *caller)
+void fio_gettime(struct timespec *tp, void *caller)
 #else
-void fio_gettime(struct timeval *tp, void fio_unused *caller)
+void fio_gettime(struct timespec *tp, void fio_unused *caller)
 #endif
 {
 #ifdef FIO_DEBUG_TIME
@@ -121,46 +362,21 @@ void fio_gettime(struct timeval *tp, void fio_unused *caller)
 
 	gtod_log_caller(caller);
 #endif
-	if (fio_tv) {
-		memcpy(tp, fio_tv, sizeof(*tp));
+	if (fio_ts) {
+		memcpy(tp, fio_ts, sizeof(*tp));
 		return;
-	} else if (!clock_gettime_works) {
-gtod:
-		gettimeofday(tp, NULL);
-	} else {
-		struct timespec ts;
-
-		if (clock_gettime(CLOCK_MONOTONIC, &ts) < 0) {
-			clock_gettime_works = 0;
-			goto gtod;
-		}
-
-		tp->tv_sec = ts.tv_sec;
-		tp->tv_usec = ts.tv_nsec / 1000;
 	}
 
-	/*
-	 * If Linux is using the tsc clock on non-synced processors,
-	 * sometimes time can appear to drift backwards. Fix that up.
-	 */
-	if (last_tv_valid) {
-		if (tp->tv_sec < last_tv.tv_sec)
-			tp->tv_sec = last_tv.tv_sec;
-		else if (last_tv.tv_sec == tp->tv_sec &&
-			 tp->tv_usec < last_tv.tv_usec)
-			tp->tv_usec = last_tv.tv_usec;
-	}
-	last_tv_valid = 1;
-	memcpy(&last_tv, tp, sizeof(*tp));
+	__fio_gettime(tp);
 }
 
 void fio_gtod_init(void)
 {
-	fio_tv = smalloc(sizeof(struct timeval));
-	assert(fio_tv);
+	fio_ts = smalloc(sizeof(struct timespec));
+	assert(fio_ts);
 }
 
 void fio_gtod_update(void)
 {
-	gettimeofday(fio_tv, NULL);
+	__fio_gettime(fio_ts);
 }
@@ -487,9 +487,9 @@ static int add_job(struct thread_data *td, const char *jobname, int job_add_num)
 
 	td->mutex = fio_mutex_init(0);
 
-	td->ts.clat_stat[0].min_val = td->ts.clat_stat[1].min_val = ULONG_MAX;
-	td->ts.slat_stat[0].min_val = td->ts.slat_stat[1].min_val = ULONG_MAX;
-	td->ts.bw_stat[0].min_val = td->ts.bw_stat[1].min_val = ULONG_MAX;
+	td->ts.clat_stat[0].min_val = td->ts.clat_stat[1].min_val = -1ULL;
+	td->ts.slat_stat[0].min_val = td->ts.slat_stat[1].min_val = -1ULL;
+	td->ts.bw_stat[0].min_val = td->ts.bw_stat[1].min_val = -1ULL;
 	td->ddir_nr = td->o.ddir_nr;
 
 	if ((td->o.stonewall || td->o.numjobs > 1 || td->o.new_group)
@@ -886,6 +886,7 @@ struct debug_level debug_levels[] = {
 	{ .name = "parse",	.shift = FD_PARSE },
 	{ .name = "diskutil",	.shift = FD_DISKUTIL },
 	{ .name = "job",	.shift = FD_JOB },
+	{ .name = "time",	.shift = FD_TIME },
 	{ .name = NULL, },
 };
 
@@ -1112,6 +1113,8 @@ int parse_options(int argc, char *argv[])
 		return 1;
 	}
 
+	fio_clock_init();
+
 	if (def_thread.o.gtod_offload) {
 		fio_gtod_init();
 		fio_gtod_offload = 1;
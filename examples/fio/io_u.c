@@ -13,7 +13,7 @@ struct io_completion_data {
 
 	int error;			/* output */
 	unsigned long bytes_done[2];	/* output */
-	struct timeval time;		/* output */
+	struct timespec time;		/* output */
 };
 
 /*
@@ -516,100 +516,6 @@ void io_u_mark_depth(struct thread_data *td, unsigned int nr)
 	td->ts.io_u_map[index] += nr;
 }
 
-static void io_u_mark_lat_usec(struct thread_data *td, unsigned long usec)
-{
-	int index = 0;
-
-	assert(usec < 1000);
-
-	switch (usec) {
-	case 750 ... 999:
-		index = 9;
-		break;
-	case 500 ... 749:
-		index = 8;
-		break;
-	case 250 ... 499:
-		index = 7;
-		break;
-	case 100 ... 249:
-		index = 6;
-		break;
-	case 50 ... 99:
-		index = 5;
-		break;
-	case 20 ... 49:
-		index = 4;
-		break;
-	case 10 ... 19:
-		index = 3;
-		break;
-	case 4 ... 9:
-		index = 2;
-		break;
-	case 2 ... 3:
-		index = 1;
-	case 0 ... 1:
-		break;
-	}
-
-	assert(index < FIO_IO_U_LAT_U_NR);
-	td->ts.io_u_lat_u[index]++;
-}
-
-static void io_u_mark_lat_msec(struct thread_data *td, unsigned long msec)
-{
-	int index = 0;
-
-	switch (msec) {
-	default:
-		index = 11;
-		break;
-	case 1000 ... 1999:
-		index = 10;
-		break;
-	case 750 ... 999:
-		index = 9;
-		break;
-	case 500 ... 749:
-		index = 8;
-		break;
-	case 250 ... 499:
-		index = 7;
-		break;
-	case 100 ... 249:
-		index = 6;
-		break;
-	case 50 ... 99:
-		index = 5;
-		break;
-	case 20 ... 49:
-		index = 4;
-		break;
-	case 10 ... 19:
-		index = 3;
-		break;
-	case 4 ... 9:
-		index = 2;
-		break;
-	case 2 ... 3:
-		index = 1;
-	case 0 ... 1:
-		break;
-	}
-
-	assert(index < FIO_IO_U_LAT_M_NR);
-	td->ts.io_u_lat_m[index]++;
-}
-
-static void io_u_mark_latency(struct thread_data *td, unsigned long usec)
-{
-	if (usec < 1000)
-		io_u_mark_lat_usec(td, usec);
-	else
-		io_u_mark_lat_msec(td, usec / 1000);
-}
-
 /*
  * Get next file to service by choosing one at random
  */
@@ -882,12 +788,6 @@ void io_u_log_error(struct thread_data *td, struct io_u *io_u)
 static void io_completed(struct thread_data *td, struct io_u *io_u,
 			 struct io_completion_data *icd)
 {
-	/*
-	 * Older gcc's are too dumb to realize that usec is always used
-	 * initialized, silence that warning.
-	 */
-	unsigned long uninitialized_var(usec);
-
 	dprint_io_u(io_u, "io complete");
 
 	assert(io_u->flags & IO_U_F_FLIGHT);
@@ -910,13 +810,12 @@ static void io_completed(struct thread_data *td, struct io_u *io_u,
 		td->this_io_bytes[idx] += bytes;
 
 		if (ramp_time_over(td)) {
-			if (!td->o.disable_clat || !td->o.disable_bw)
-				usec = utime_since(&io_u->issue_time,
-							&icd->time);
-
 			if (!td->o.disable_clat) {
-				add_clat_sample(td, idx, usec);
-				io_u_mark_latency(td, usec);
+				unsigned long long nsec;
+
+				nsec = ntime_since(&io_u->issue_time,
+							&icd->time);
+				add_clat_sample(td, idx, nsec);
 			}
 			if (!td->o.disable_bw)
 				add_bw_sample(td, idx, &icd->time);
@@ -1021,9 +920,9 @@ long io_u_queued_complete(struct thread_data *td, int min_evts)
 void io_u_queued(struct thread_data *td, struct io_u *io_u)
 {
 	if (!td->o.disable_slat) {
-		unsigned long slat_time;
+		unsigned long long slat_time;
 
-		slat_time = utime_since(&io_u->start_time, &io_u->issue_time);
+		slat_time = ntime_since(&io_u->start_time, &io_u->issue_time);
 		add_slat_sample(td, io_u->ddir, slat_time);
 	}
 }
@@ -0,0 +1,89 @@
+/*
+ * Latency histogram reporting, see lat_hist.h for the layout
+ */
+#include "lat_hist.h"
+
+void lat_hist_sum(struct lat_hist *dst, struct lat_hist *src)
+{
+	int i;
+
+	for (i = 0; i < LAT_HIST_NR; i++)
+		dst->buckets[i] += src->buckets[i];
+
+	dst->samples += src->samples;
+}
+
+/*
+ * Lowest value that goes into bucket idx
+ */
+static unsigned long long bucket_start(unsigned int idx, unsigned int *shift)
+{
+	unsigned int octave, sub;
+
+	if (idx < LAT_HIST_SUB) {
+		*shift = 0;
+		return idx;
+	}
+
+	idx -= LAT_HIST_SUB;
+	octave = idx / (LAT_HIST_SUB / 2);
+	sub = idx % (LAT_HIST_SUB / 2);
+
+	*shift = octave + 1;
+	return (unsigned long long) (sub + LAT_HIST_SUB / 2) << *shift;
+}
+
+/*
+ * The value a bucket stands for, the middle of it
+ */
+unsigned long long lat_hist_value(unsigned int idx)
+{
+	unsigned long long start;
+	unsigned int shift;
+
+	start = bucket_start(idx, &shift);
+	return start + ((1ULL << shift) - 1) / 2;
+}
+
+/*
+ * Value that perc percent of the samples are at or below
+ */
+unsigned long long lat_hist_percentile(struct lat_hist *h, double perc)
+{
+	unsigned long want, seen = 0;
+	int i;
+
+	if (!h->samples)
+		return 0;
+
+	want = (unsigned long) (perc / 100.0 * h->samples + 0.5);
+	if (!want)
+		want = 1;
+	if (want > h->samples)
+		want = h->samples;
+
+	for (i = 0; i < LAT_HIST_NR; i++) {
+		seen += h->buckets[i];
+		if (seen >= want)
+			return lat_hist_value(i);
+	}
+
+	return lat_hist_value(LAT_HIST_NR - 1);
+}
+
+/*
+ * Samples below nsec. A bucket that straddles nsec counts by its middle.
+ */
+unsigned long lat_hist_count_below(struct lat_hist *h, unsigned long long nsec)
+{
+	unsigned long count = 0;
+	int i;
+
+	for (i = 0; i < LAT_HIST_NR; i++) {
+		if (lat_hist_value(i) >= nsec)
+			break;
+		count += h->buckets[i];
+	}
+
+	return count;
+}
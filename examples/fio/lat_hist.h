@@ -0,0 +1,57 @@
+#ifndef FIO_LAT_HIST_H
+#define FIO_LAT_HIST_H
+
+/*
+ * Log-linear latency histogram, values are in nsec. Below LAT_HIST_SUB
+ * every value has a bucket of its own, above that every power of two is
+ * split into LAT_HIST_SUB / 2 equal buckets. A bucket is then never wider
+ * than 1/64 of the values in it, and reporting its middle is off by less
+ * than 0.8%. Anything from 2^LAT_HIST_MAX_BITS nsec (~4.6 minutes) up
+ * lands in the last bucket.
+ *
+ * Each thread only ever adds to its own histograms, so there's no locking.
+ * They are summed up once the jobs are done.
+ */
+#define LAT_HIST_SUB_BITS	7
+#define LAT_HIST_SUB		(1 << LAT_HIST_SUB_BITS)
+#define LAT_HIST_MAX_BITS	38
+#define LAT_HIST_NR		(LAT_HIST_SUB + \
+		(LAT_HIST_MAX_BITS - LAT_HIST_SUB_BITS) * (LAT_HIST_SUB / 2))
+
+struct lat_hist {
+	unsigned long samples;
+	unsigned long buckets[LAT_HIST_NR];
+};
+
+static inline unsigned int lat_hist_index(unsigned long long nsec)
+{
+	unsigned int msb, shift;
+
+	if (nsec < LAT_HIST_SUB)
+		return nsec;
+	if (nsec >> LAT_HIST_MAX_BITS)
+		return LAT_HIST_NR - 1;
+
+	/*
+	 * keep the top LAT_HIST_SUB_BITS - 1 bits below the leading one
+	 */
+	msb = 63 - __builtin_clzll(nsec);
+	shift = msb - (LAT_HIST_SUB_BITS - 1);
+
+	return LAT_HIST_SUB + (msb - LAT_HIST_SUB_BITS) * (LAT_HIST_SUB / 2) +
+		(nsec >> shift) - LAT_HIST_SUB / 2;
+}
+
+static inline void lat_hist_add_sample(struct lat_hist *h,
+				       unsigned long long nsec)
+{
+	h->buckets[lat_hist_index(nsec)]++;
+	h->samples++;
+}
+
+extern void lat_hist_sum(struct lat_hist *, struct lat_hist *);
+extern unsigned long long lat_hist_value(unsigned int);
+extern unsigned long long lat_hist_percentile(struct lat_hist *, double);
+extern unsigned long lat_hist_count_below(struct lat_hist *, unsigned long long);
+
+#endif
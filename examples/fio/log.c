@@ -447,14 +447,54 @@ void setup_log(struct io_log **log)
 	l->nr_samples = 0;
 	l->max_samples = 1024;
 	l->log = malloc(l->max_samples * sizeof(struct io_sample));
+	l->bin = NULL;
 	*log = l;
 }
 
+/*
+ * For binary_log, open the log file now and stream samples to it while
+ * the job runs
+ */
+int start_log_named(struct thread_data *td, struct io_log *log,
+		    const char *prefix, const char *postfix)
+{
+	char file_name[256], *p;
+
+	if (!td->o.binary_log)
+		return 0;
+
+	snprintf(file_name, 200, "%s_%s.log.bin", prefix, postfix);
+	p = basename(file_name);
+
+	log->bin = binlog_open(p);
+	if (!log->bin) {
+		td_verror(td, errno, "binlog_open");
+		return 1;
+	}
+
+	return 0;
+}
+
+int start_log(struct thread_data *td, struct io_log *log, const char *name)
+{
+	return start_log_named(td, log, td->o.name, name);
+}
+
 void __finish_log(struct io_log *log, const char *name)
 {
 	unsigned int i;
 	FILE *f;
 
+	if (log->bin) {
+		int ret = binlog_close(log->bin);
+
+		if (ret)
+			log_err("fio: writing %s.bin: %s\n", name, strerror(-ret));
+		free(log->log);
+		free(log);
+		return;
+	}
+
 	f = fopen(name, "a");
 	if (!f) {
 		perror("fopen log");
@@ -0,0 +1,48 @@
+/*
+ * Convert a binary bw/lat log written with binary_log=1 to the text log
+ * format, so fio_generate_plots and friends can read it
+ */
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#include "binlog.h"
+
+int main(int argc, char *argv[])
+{
+	FILE *in, *out;
+	int ret;
+
+	if (argc < 2 || argc > 3) {
+		fprintf(stderr, "usage: %s <binary log> [text log]\n", argv[0]);
+		return 1;
+	}
+
+	in = fopen(argv[1], "r");
+	if (!in) {
+		fprintf(stderr, "%s: %s\n", argv[1], strerror(errno));
+		return 1;
+	}
+
+	out = stdout;
+	if (argc == 3) {
+		out = fopen(argv[2], "w");
+		if (!out) {
+			fprintf(stderr, "%s: %s\n", argv[2], strerror(errno));
+			fclose(in);
+			return 1;
+		}
+	}
+
+	ret = binlog_decode(in, out);
+	if (ret)
+		fprintf(stderr, "%s: bad or truncated log\n", argv[1]);
+
+	fclose(in);
+	if (out != stdout && fclose(out)) {
+		fprintf(stderr, "%s: %s\n", argv[2], strerror(errno));
+		ret = 1;
+	}
+
+	return ret;
+}
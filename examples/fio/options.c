@@ -546,6 +546,17 @@ static int str_gtod_cpu_cb(void *data, int *il)
 	return 0;
 }
 
+/*
+ * The clock is shared by all jobs, so whoever sets it last wins
+ */
+static int str_clocksource_cb(void *data, const char fio_unused *str)
+{
+	struct thread_data *td = data;
+
+	fio_clock_source = td->o.clocksource;
+	return 0;
+}
+
 #define __stringify_1(x)	#x
 #define __stringify(x)		__stringify_1(x)
 
@@ -1372,6 +1383,13 @@ static struct fio_option options[] = {
 		.cb	= str_write_lat_log_cb,
 		.help	= "Write log of latency during run",
 	},
+	{
+		.name	= "binary_log",
+		.type	= FIO_OPT_BOOL,
+		.off1	= td_var_offset(binary_log),
+		.help	= "Stream bw/lat logs to disk in binary format",
+		.def	= "0",
+	},
 	{
 		.name	= "hugepage-size",
 		.type	= FIO_OPT_STR_VAL_INT,
@@ -1379,6 +1397,13 @@ static struct fio_option options[] = {
 		.help	= "When using hugepages, specify size of each page",
 		.def	= __stringify(FIO_HUGE_PAGE),
 	},
+	{
+		.name	= "pipe_size",
+		.type	= FIO_OPT_STR_VAL_INT,
+		.off1	= td_var_offset(pipe_size),
+		.help	= "Grow splice pipes to this size, capped at pipe-max-size",
+		.def	= "0",
+	},
 	{
 		.name	= "group_reporting",
 		.type	= FIO_OPT_STR_SET,
@@ -1443,6 +1468,27 @@ static struct fio_option options[] = {
 		.cb	= str_gtod_cpu_cb,
 		.help	= "Setup dedicated gettimeofday() thread on this CPU",
 	},
+	{
+		.name	= "clocksource",
+		.type	= FIO_OPT_STR,
+		.off1	= td_var_offset(clocksource),
+		.cb	= str_clocksource_cb,
+		.help	= "What type of timing source to use",
+		.posval	= {
+			  { .ival = "gettimeofday",
+			    .oval = CS_GTOD,
+			    .help = "Use gettimeofday(2) for timing",
+			  },
+			  { .ival = "clock_gettime",
+			    .oval = CS_CGETTIME,
+			    .help = "Use CLOCK_MONOTONIC for timing",
+			  },
+			  { .ival = "cpu",
+			    .oval = CS_CPUCLOCK,
+			    .help = "Use the calibrated CPU clock (TSC) for timing",
+			  },
+		},
+	},
 	{
 		.name = NULL,
 	},
@@ -16,6 +16,7 @@
 #define FIO_HAVE_POSIXAIO
 #define FIO_HAVE_FADVISE
 #define FIO_HAVE_CPU_AFFINITY
+#define FIO_HAVE_CPU_BIND
 #define FIO_HAVE_DISK_UTIL
 #define FIO_HAVE_SGIO
 #define FIO_HAVE_IOPRIO
@@ -56,15 +57,20 @@ typedef struct drand48_data os_random_state_t;
 	sched_setaffinity((td)->pid, sizeof((td)->o.cpumask), &(td)->o.cpumask)
 #define fio_getaffinity(pid, ptr)	\
 	sched_getaffinity((pid), sizeof(cpu_set_t), (ptr))
+#define fio_cpu_bind(ptr)		\
+	sched_setaffinity(0, sizeof(cpu_set_t), (ptr))
 #else
 #define fio_setaffinity(td)		\
 	sched_setaffinity((td)->pid, &(td)->o.cpumask)
 #define fio_getaffinity(pid, ptr)	\
 	sched_getaffinity((pid), (ptr))
+#define fio_cpu_bind(ptr)		\
+	sched_setaffinity(0, (ptr))
 #endif
 
 #define fio_cpu_clear(mask, cpu)	CPU_CLR((cpu), (mask))
 #define fio_cpu_set(mask, cpu)		CPU_SET((cpu), (mask))
+#define fio_cpu_isset(mask, cpu)	CPU_ISSET((cpu), (mask))
 
 static inline int fio_cpuset_init(os_cpu_mask_t *mask)
 {
@@ -116,6 +122,11 @@ static inline int vmsplice(int fd, const struct iovec *iov,
 
 #define SPLICE_DEF_SIZE	(64*1024)
 
+#ifndef F_SETPIPE_SZ
+#define F_SETPIPE_SZ	(1024 + 7)
+#define F_GETPIPE_SZ	(1024 + 8)
+#endif
+
 #ifdef FIO_HAVE_SYSLET
 
 struct syslet_uatom;
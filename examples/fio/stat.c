@@ -12,7 +12,7 @@
 /*
  * Cheesy number->string conversion, complete with carry rounding error.
  */
-static char *num2str(unsigned long num, int maxlen, int base, int pow2)
+static char *num2str(unsigned long long num, int maxlen, int base, int pow2)
 {
 	char postfix[] = { ' ', 'K', 'M', 'G', 'P', 'E' };
 	unsigned int thousand;
@@ -32,7 +32,7 @@ static char *num2str(unsigned long num, int maxlen, int base, int pow2)
 	do {
 		int len, carry = 0;
 
-		len = sprintf(buf, "%'lu", num);
+		len = sprintf(buf, "%'llu", num);
 		if (len <= maxlen) {
 			if (i >= 1) {
 				buf[len] = postfix[i];
@@ -58,9 +58,9 @@ void update_rusage_stat(struct thread_data *td)
 
 	getrusage(RUSAGE_SELF, &ts->ru_end);
 
-	ts->usr_time += mtime_since(&ts->ru_start.ru_utime,
+	ts->usr_time += mtime_since_tv(&ts->ru_start.ru_utime,
 					&ts->ru_end.ru_utime);
-	ts->sys_time += mtime_since(&ts->ru_start.ru_stime,
+	ts->sys_time += mtime_since_tv(&ts->ru_start.ru_stime,
 					&ts->ru_end.ru_stime);
 	ts->ctx += ts->ru_end.ru_nvcsw + ts->ru_end.ru_nivcsw
 			- (ts->ru_start.ru_nvcsw + ts->ru_start.ru_nivcsw);
@@ -70,8 +70,8 @@ void update_rusage_stat(struct thread_data *td)
 	memcpy(&ts->ru_start, &ts->ru_end, sizeof(ts->ru_end));
 }
 
-static int calc_lat(struct io_stat *is, unsigned long *min, unsigned long *max,
-		    double *mean, double *dev)
+static int calc_lat(struct io_stat *is, unsigned long long *min,
+		    unsigned long long *max, double *mean, double *dev)
 {
 	double n = is->samples;
 
@@ -143,20 +143,50 @@ static void stat_calc_dist(unsigned int *map, unsigned long total,
 	}
 }
 
+/*
+ * Upper ends of the coarse latency ranges
+ */
+static const unsigned long lat_u_ranges[FIO_IO_U_LAT_U_NR] = {
+	2, 4, 10, 20, 50, 100, 250, 500, 750, 1000,
+};
+static const unsigned long lat_m_ranges[FIO_IO_U_LAT_M_NR] = {
+	2, 4, 10, 20, 50, 100, 250, 500, 750, 1000, 2000, 0,
+};
+
+/*
+ * Read the coarse ranges off the latency histograms, ranges[] are in usec
+ * times mult and the last one is open ended if it is 0
+ */
 static void stat_calc_lat(struct thread_stat *ts, double *dst,
-			  unsigned int *src, int nr)
+			  const unsigned long *ranges, int nr,
+			  unsigned long mult, unsigned long start_usec)
 {
 	unsigned long total = ts_total_io_u(ts);
-	int i;
+	unsigned long long start = start_usec * 1000ULL;
+	int i, j;
 
 	/*
 	 * Do latency distribution calculations
 	 */
 	for (i = 0; i < nr; i++) {
+		unsigned long long end = ranges[i] * mult * 1000ULL;
+		unsigned long count = 0;
+
+		for (j = 0; j <= DDIR_WRITE; j++) {
+			struct lat_hist *h = &ts->clat_hist[j];
+
+			if (end)
+				count += lat_hist_count_below(h, end);
+			else
+				count += h->samples;
+			count -= lat_hist_count_below(h, start);
+		}
+		start = end;
+
 		if (total) {
-			dst[i] = (double) src[i] / (double) total;
+			dst[i] = (double) count / (double) total;
 			dst[i] *= 100.0;
-			if (dst[i] < 0.01 && src[i])
+			if (dst[i] < 0.01 && count)
 				dst[i] = 0.01;
 		} else
 			dst[i] = 0.0;
@@ -165,33 +195,78 @@ static void stat_calc_lat(struct thread_stat *ts, double *dst,
 
 static void stat_calc_lat_u(struct thread_stat *ts, double *io_u_lat)
 {
-	stat_calc_lat(ts, io_u_lat, ts->io_u_lat_u, FIO_IO_U_LAT_U_NR);
+	stat_calc_lat(ts, io_u_lat, lat_u_ranges, FIO_IO_U_LAT_U_NR, 1, 0);
 }
 
 static void stat_calc_lat_m(struct thread_stat *ts, double *io_u_lat)
 {
-	stat_calc_lat(ts, io_u_lat, ts->io_u_lat_m, FIO_IO_U_LAT_M_NR);
+	stat_calc_lat(ts, io_u_lat, lat_m_ranges, FIO_IO_U_LAT_M_NR, 1000,
+		      1000);
 }
 
-static int usec_to_msec(unsigned long *min, unsigned long *max, double *mean,
-			double *dev)
+static void lat_div_1000(unsigned long long *min, unsigned long long *max,
+			 double *mean, double *dev)
 {
-	if (*min > 1000 && *max > 1000 && *mean > 1000.0 && *dev > 1000.0) {
-		*min /= 1000;
-		*max /= 1000;
-		*mean /= 1000.0;
-		*dev /= 1000.0;
-		return 0;
+	*min /= 1000;
+	*max /= 1000;
+	*mean /= 1000.0;
+	*dev /= 1000.0;
+}
+
+/*
+ * Latencies are kept in nsec. Scale them up to usec or msec as long as
+ * all the numbers stay above 1000, and return the unit they ended up in.
+ */
+static const char *lat_scale(unsigned long long *min, unsigned long long *max,
+			     double *mean, double *dev)
+{
+	static const char *units[] = { "(nsec)", "(usec)", "(msec)" };
+	int i;
+
+	for (i = 0; i < 2; i++) {
+		if (*min <= 1000 || *max <= 1000 || *mean <= 1000.0 ||
+		    *dev <= 1000.0)
+			break;
+		lat_div_1000(min, max, mean, dev);
 	}
 
-	return 1;
+	return units[i];
+}
+
+static void show_clat_percentiles(struct lat_hist *h)
+{
+	static const double percs[] = { 50.0, 90.0, 99.0, 99.9, 99.99 };
+	static const char *names[] = { "50", "90", "99", "99.9", "99.99" };
+	unsigned long long vals[5];
+	const char *base = "usec";
+	double div = 1000.0;
+	int i;
+
+	if (!h->samples)
+		return;
+
+	for (i = 0; i < 5; i++)
+		vals[i] = lat_hist_percentile(h, percs[i]);
+
+	if (vals[0] > 1000000ULL) {
+		base = "msec";
+		div = 1000000.0;
+	} else if (vals[0] < 1000ULL) {
+		base = "nsec";
+		div = 1.0;
+	}
+
+	log_info("     clat percentiles (%s):", base);
+	for (i = 0; i < 5; i++)
+		log_info("%s p%s=%.2f", i ? "," : "", names[i], vals[i] / div);
+	log_info("\n");
 }
 
 static void show_ddir_status(struct group_run_stats *rs, struct thread_stat *ts,
 			     int ddir)
 {
 	const char *ddir_str[] = { "read ", "write" };
-	unsigned long min, max;
+	unsigned long long min, max;
 	unsigned long long bw, iops;
 	double mean, dev;
 	char *io_p, *bw_p, *iops_p;
@@ -214,12 +289,9 @@ static void show_ddir_status(struct group_run_stats *rs, struct thread_stat *ts,
 	free(iops_p);
 
 	if (calc_lat(&ts->slat_stat[ddir], &min, &max, &mean, &dev)) {
-		const char *base = "(usec)";
+		const char *base = lat_scale(&min, &max, &mean, &dev);
 		char *minp, *maxp;
 
-		if (!usec_to_msec(&min, &max, &mean, &dev))
-			base = "(msec)";
-
 		minp = num2str(min, 6, 1, 0);
 		maxp = num2str(max, 6, 1, 0);
 
@@ -230,12 +302,9 @@ static void show_ddir_status(struct group_run_stats *rs, struct thread_stat *ts,
 		free(maxp);
 	}
 	if (calc_lat(&ts->clat_stat[ddir], &min, &max, &mean, &dev)) {
-		const char *base = "(usec)";
+		const char *base = lat_scale(&min, &max, &mean, &dev);
 		char *minp, *maxp;
 
-		if (!usec_to_msec(&min, &max, &mean, &dev))
-			base = "(msec)";
-
 		minp = num2str(min, 6, 1, 0);
 		maxp = num2str(max, 6, 1, 0);
 
@@ -244,12 +313,14 @@ static void show_ddir_status(struct group_run_stats *rs, struct thread_stat *ts,
 
 		free(minp);
 		free(maxp);
+
+		show_clat_percentiles(&ts->clat_hist[ddir]);
 	}
 	if (calc_lat(&ts->bw_stat[ddir], &min, &max, &mean, &dev)) {
 		double p_of_agg;
 
 		p_of_agg = mean * 100 / (double) rs->agg[ddir];
-		log_info("    bw (KiB/s) : min=%5lu, max=%5lu, per=%3.2f%%,"
+		log_info("    bw (KiB/s) : min=%5llu, max=%5llu, per=%3.2f%%,"
 			 " avg=%5.02f, stdev=%5.02f\n", min, max, p_of_agg,
 							mean, dev);
 	}
@@ -379,7 +450,7 @@ static void show_thread_status(struct thread_stat *ts,
 static void show_ddir_status_terse(struct thread_stat *ts,
 				   struct group_run_stats *rs, int ddir)
 {
-	unsigned long min, max;
+	unsigned long long min, max;
 	unsigned long long bw;
 	double mean, dev;
 
@@ -390,23 +461,28 @@ static void show_ddir_status_terse(struct thread_stat *ts,
 	log_info(";%llu;%llu;%lu", ts->io_bytes[ddir] >> 10, bw,
 							ts->runtime[ddir]);
 
-	if (calc_lat(&ts->slat_stat[ddir], &min, &max, &mean, &dev))
-		log_info(";%lu;%lu;%f;%f", min, max, mean, dev);
-	else
-		log_info(";%lu;%lu;%f;%f", 0UL, 0UL, 0.0, 0.0);
+	/*
+	 * terse output keeps latencies in usec
+	 */
+	if (calc_lat(&ts->slat_stat[ddir], &min, &max, &mean, &dev)) {
+		lat_div_1000(&min, &max, &mean, &dev);
+		log_info(";%llu;%llu;%f;%f", min, max, mean, dev);
+	} else
+		log_info(";%llu;%llu;%f;%f", 0ULL, 0ULL, 0.0, 0.0);
 
-	if (calc_lat(&ts->clat_stat[ddir], &min, &max, &mean, &dev))
-		log_info(";%lu;%lu;%f;%f", min, max, mean, dev);
-	else
-		log_info(";%lu;%lu;%f;%f", 0UL, 0UL, 0.0, 0.0);
+	if (calc_lat(&ts->clat_stat[ddir], &min, &max, &mean, &dev)) {
+		lat_div_1000(&min, &max, &mean, &dev);
+		log_info(";%llu;%llu;%f;%f", min, max, mean, dev);
+	} else
+		log_info(";%llu;%llu;%f;%f", 0ULL, 0ULL, 0.0, 0.0);
 
 	if (calc_lat(&ts->bw_stat[ddir], &min, &max, &mean, &dev)) {
 		double p_of_agg;
 
 		p_of_agg = mean * 100 / (double) rs->agg[ddir];
-		log_info(";%lu;%lu;%f%%;%f;%f", min, max, p_of_agg, mean, dev);
+		log_info(";%llu;%llu;%f%%;%f;%f", min, max, p_of_agg, mean, dev);
 	} else
-		log_info(";%lu;%lu;%f%%;%f;%f", 0UL, 0UL, 0.0, 0.0, 0.0);
+		log_info(";%llu;%llu;%f%%;%f;%f", 0ULL, 0ULL, 0.0, 0.0, 0.0);
 }
 
 
@@ -524,9 +600,9 @@ void show_run_stats(void)
 
 		memset(ts, 0, sizeof(*ts));
 		for (j = 0; j <= DDIR_WRITE; j++) {
-			ts->clat_stat[j].min_val = -1UL;
-			ts->slat_stat[j].min_val = -1UL;
-			ts->bw_stat[j].min_val = -1UL;
+			ts->clat_stat[j].min_val = -1ULL;
+			ts->slat_stat[j].min_val = -1ULL;
+			ts->bw_stat[j].min_val = -1ULL;
 		}
 		ts->groupid = -1;
 	}
@@ -591,10 +667,8 @@ void show_run_stats(void)
 			ts->io_u_submit[k] += td->ts.io_u_submit[k];
 		for (k = 0; k < FIO_IO_U_MAP_NR; k++)
 			ts->io_u_complete[k] += td->ts.io_u_complete[k];
-		for (k = 0; k < FIO_IO_U_LAT_U_NR; k++)
-			ts->io_u_lat_u[k] += td->ts.io_u_lat_u[k];
-		for (k = 0; k < FIO_IO_U_LAT_M_NR; k++)
-			ts->io_u_lat_m[k] += td->ts.io_u_lat_m[k];
+		for (k = 0; k <= DDIR_WRITE; k++)
+			lat_hist_sum(&ts->clat_hist[k], &td->ts.clat_hist[k]);
 
 
 		for (k = 0; k <= DDIR_WRITE; k++) {
@@ -670,7 +744,8 @@ void show_run_stats(void)
 	free(threadstats);
 }
 
-static inline void add_stat_sample(struct io_stat *is, unsigned long data)
+static inline void add_stat_sample(struct io_stat *is,
+				   unsigned long long data)
 {
 	double val = data;
 	double delta;
@@ -692,6 +767,11 @@ static inline void add_stat_sample(struct io_stat *is, unsigned long data)
 static void __add_log_sample(struct io_log *iolog, unsigned long val,
 			     enum fio_ddir ddir, unsigned long time)
 {
+	if (iolog->bin) {
+		binlog_add(iolog->bin, time, val, ddir);
+		return;
+	}
+
 	if (iolog->nr_samples == iolog->max_samples) {
 		int new_size = sizeof(struct io_sample) * iolog->max_samples*2;
 
@@ -718,30 +798,35 @@ void add_agg_sample(unsigned long val, enum fio_ddir ddir)
 	__add_log_sample(iolog, val, ddir, mtime_since_genesis());
 }
 
+/*
+ * Latencies come in as nsec. The logs stay in usec, as that is what
+ * fio_generate_plots and existing log readers expect.
+ */
 void add_clat_sample(struct thread_data *td, enum fio_ddir ddir,
-		     unsigned long usec)
+		     unsigned long long nsec)
 {
 	struct thread_stat *ts = &td->ts;
 
-	add_stat_sample(&ts->clat_stat[ddir], usec);
+	add_stat_sample(&ts->clat_stat[ddir], nsec);
+	lat_hist_add_sample(&ts->clat_hist[ddir], nsec);
 
 	if (ts->clat_log)
-		add_log_sample(td, ts->clat_log, usec, ddir);
+		add_log_sample(td, ts->clat_log, nsec / 1000, ddir);
 }
 
 void add_slat_sample(struct thread_data *td, enum fio_ddir ddir,
-		     unsigned long usec)
+		     unsigned long long nsec)
 {
 	struct thread_stat *ts = &td->ts;
 
-	add_stat_sample(&ts->slat_stat[ddir], usec);
+	add_stat_sample(&ts->slat_stat[ddir], nsec);
 
 	if (ts->slat_log)
-		add_log_sample(td, ts->slat_log, usec, ddir);
+		add_log_sample(td, ts->slat_log, nsec / 1000, ddir);
 }
 
 void add_bw_sample(struct thread_data *td, enum fio_ddir ddir,
-		   struct timeval *t)
+		   struct timespec *t)
 {
 	struct thread_stat *ts = &td->ts;
 	unsigned long spent = mtime_since(&ts->stat_sample_time[ddir], t);
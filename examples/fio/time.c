@@ -3,41 +3,68 @@
 
 #include "fio.h"
 
-static struct timeval genesis;
+static struct timespec genesis;
 static unsigned long ns_granularity;
 
-unsigned long long utime_since(struct timeval *s, struct timeval *e)
+unsigned long long ntime_since(struct timespec *s, struct timespec *e)
 {
-	long sec, usec;
-	unsigned long long ret;
+	long long sec, nsec;
 
 	sec = e->tv_sec - s->tv_sec;
-	usec = e->tv_usec - s->tv_usec;
-	if (sec > 0 && usec < 0) {
+	nsec = e->tv_nsec - s->tv_nsec;
+	if (sec > 0 && nsec < 0) {
 		sec--;
-		usec += 1000000;
+		nsec += 1000000000LL;
 	}
 
 	/*
 	 * time warp bug on some kernels?
 	 */
-	if (sec < 0 || (sec == 0 && usec < 0))
+	if (sec < 0 || (sec == 0 && nsec < 0))
 		return 0;
 
-	ret = sec * 1000000ULL + usec;
+	return sec * 1000000000ULL + nsec;
+}
+
+unsigned long long ntime_since_now(struct timespec *s)
+{
+	struct timespec t;
 
-	return ret;
+	fio_gettime(&t, NULL);
+	return ntime_since(s, &t);
 }
 
-unsigned long long utime_since_now(struct timeval *s)
+unsigned long long utime_since(struct timespec *s, struct timespec *e)
 {
-	struct timeval t;
+	return ntime_since(s, e) / 1000;
+}
+
+unsigned long long utime_since_now(struct timespec *s)
+{
+	struct timespec t;
 
 	fio_gettime(&t, NULL);
 	return utime_since(s, &t);
 }
 
-unsigned long mtime_since(struct timeval *s, struct timeval *e)
+unsigned long mtime_since(struct timespec *s, struct timespec *e)
+{
+	return ntime_since(s, e) / 1000000;
+}
+
+unsigned long mtime_since_now(struct timespec *s)
+{
+	struct timespec t;
+	void *p = __builtin_return_address(0);
+
+	fio_gettime(&t, p);
+	return mtime_since(s, &t);
+}
+
+/*
+ * For the timevals that getrusage() hands back
+ */
+unsigned long mtime_since_tv(struct timeval *s, struct timeval *e)
 {
 	long sec, usec, ret;
 
@@ -61,16 +88,7 @@ unsigned long mtime_since(struct timeval *s, struct timeval *e)
 	return ret;
 }
 
-unsigned long mtime_since_now(struct timeval *s)
-{
-	struct timeval t;
-	void *p = __builtin_return_address(0);
-
-	fio_gettime(&t, p);
-	return mtime_since(s, &t);
-}
-
-unsigned long time_since_now(struct timeval *s)
+unsigned long time_since_now(struct timespec *s)
 {
 	return mtime_since_now(s) / 1000;
 }
@@ -80,7 +98,7 @@ unsigned long time_since_now(struct timeval *s)
  */
 void usec_spin(unsigned int usec)
 {
-	struct timeval start;
+	struct timespec start;
 
 	fio_gettime(&start, NULL);
 	while (utime_since_now(&start) < usec)
@@ -90,7 +108,7 @@ void usec_spin(unsigned int usec)
 void usec_sleep(struct thread_data *td, unsigned long usec)
 {
 	struct timespec req;
-	struct timeval tv;
+	struct timespec tv;
 
 	do {
 		unsigned long ts = usec;
@@ -146,7 +164,7 @@ void rate_throttle(struct thread_data *td, unsigned long time_spent,
 		td->rate_pending_usleep += s;
 
 		if (td->rate_pending_usleep >= 100000) {
-			struct timeval t;
+			struct timespec t;
 
 			fio_gettime(&t, NULL);
 			usec_sleep(td, td->rate_pending_usleep);
@@ -171,7 +189,7 @@ int in_ramp_time(struct thread_data *td)
 
 int ramp_time_over(struct thread_data *td)
 {
-	struct timeval tv;
+	struct timespec tv;
 
 	if (!td->o.ramp_time || td->ramp_time_over)
 		return 1;
@@ -195,7 +213,7 @@ static void fio_init time_init(void)
 	 * Check the granularity of the nanosleep function
 	 */
 	for (i = 0; i < 10; i++) {
-		struct timeval tv;
+		struct timespec tv;
 		struct timespec ts;
 		unsigned long elapsed;
 
@@ -216,7 +234,7 @@ void set_genesis_time(void)
 	fio_gettime(&genesis, NULL);
 }
 
-void fill_start_time(struct timeval *t)
+void fill_start_time(struct timespec *t)
 {
 	memcpy(t, &genesis, sizeof(genesis));
 }
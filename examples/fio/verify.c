@@ -508,7 +508,7 @@ static void fill_meta(struct verify_header *hdr, struct thread_data *td,
 	vh->thread = td->thread_number;
 
 	vh->time_sec = io_u->start_time.tv_sec;
-	vh->time_usec = io_u->start_time.tv_usec;
+	vh->time_usec = io_u->start_time.tv_nsec / 1000;
 
 	vh->numberio = td->io_issues[DDIR_WRITE];
 
@@ -0,0 +1,126 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+/*
+ * CPU cost accounting shared by the benchmarks. Throughput alone hides what
+ * splice saves, so every run also reports the CPU time the kernel charged
+ * for it and how many bytes that CPU time moved.
+ */
+#include <stdio.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+struct bench_mark {
+	struct timeval tv;
+	struct rusage ru;
+};
+
+struct bench_stat {
+	unsigned long long bytes;
+	/*
+	 * seconds
+	 */
+	double wall;
+	double usr;
+	double sys;
+	long nvcsw;
+	long nivcsw;
+	long minflt;
+	long majflt;
+};
+
+static inline double tv_secs(struct timeval *tv)
+{
+	return tv->tv_sec + tv->tv_usec / 1000000.0;
+}
+
+/*
+ * Start measuring who, RUSAGE_SELF or RUSAGE_CHILDREN. For the latter only
+ * children reaped between the start and stop are counted.
+ */
+static inline void bench_start(struct bench_mark *m, int who)
+{
+	gettimeofday(&m->tv, NULL);
+	getrusage(who, &m->ru);
+}
+
+/*
+ * Add the time and usage since the mark to st
+ */
+static inline void bench_stop(struct bench_stat *st, struct bench_mark *m,
+			      int who)
+{
+	struct timeval now;
+	struct rusage ru;
+
+	gettimeofday(&now, NULL);
+	getrusage(who, &ru);
+
+	st->wall += tv_secs(&now) - tv_secs(&m->tv);
+	st->usr += tv_secs(&ru.ru_utime) - tv_secs(&m->ru.ru_utime);
+	st->sys += tv_secs(&ru.ru_stime) - tv_secs(&m->ru.ru_stime);
+	st->nvcsw += ru.ru_nvcsw - m->ru.ru_nvcsw;
+	st->nivcsw += ru.ru_nivcsw - m->ru.ru_nivcsw;
+	st->minflt += ru.ru_minflt - m->ru.ru_minflt;
+	st->majflt += ru.ru_majflt - m->ru.ru_majflt;
+}
+
+/*
+ * Sum runs that happened at the same time, so the wall time is the longest
+ * of them rather than the sum
+ */
+static inline void bench_add(struct bench_stat *sum, struct bench_stat *st)
+{
+	sum->bytes += st->bytes;
+	if (st->wall > sum->wall)
+		sum->wall = st->wall;
+	sum->usr += st->usr;
+	sum->sys += st->sys;
+	sum->nvcsw += st->nvcsw;
+	sum->nivcsw += st->nivcsw;
+	sum->minflt += st->minflt;
+	sum->majflt += st->majflt;
+}
+
+static inline double bench_mib_s(struct bench_stat *st)
+{
+	if (st->wall <= 0)
+		return 0;
+
+	return st->bytes / st->wall / (1024 * 1024);
+}
+
+static inline double bench_cpu_pct(struct bench_stat *st)
+{
+	if (st->wall <= 0)
+		return 0;
+
+	return (st->usr + st->sys) * 100 / st->wall;
+}
+
+/*
+ * MiB moved per second of CPU time, higher is cheaper
+ */
+static inline double bench_mib_per_cpu_s(struct bench_stat *st)
+{
+	double cpu = st->usr + st->sys;
+
+	/*
+	 * Below the getrusage tick it is just noise
+	 */
+	if (cpu < 0.001)
+		cpu = 0.001;
+
+	return st->bytes / cpu / (1024 * 1024);
+}
+
+static inline void bench_print(FILE *f, const char *prefix,
+			       struct bench_stat *st)
+{
+	fprintf(f, "%susr %.3fs sys %.3fs (%.1f%% CPU), %.1f MiB per CPU-second, %ld/%ld ctx switches (vol/invol), %ld/%ld faults (min/maj)\n",
+		prefix, st->usr, st->sys, bench_cpu_pct(st),
+		bench_mib_per_cpu_s(st), st->nvcsw, st->nivcsw, st->minflt,
+		st->majflt);
+}
+
+#endif
@@ -1,57 +1,141 @@
 /*
  * A tee implementation using sys_tee. Sends out the data received over
- * stdin to the given host:port and over stdout.
+ * stdin to the given host:port targets and over stdout.
+ *
+ * Every target gets its own pipe which the input is tee'd into, and which is
+ * spliced to the non blocking socket from an epoll loop. A target that falls
+ * behind by more than its pipe depth is handled by its lag policy:
+ *
+ *	block		hold the input back until the target catches up
+ *	drop		skip data for the target until it catches up
+ *	disconnect	close the target
+ *
+ * Per target throughput and lag counters are printed at exit, on SIGUSR1
+ * and every -i seconds.
  */
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
 #include <fcntl.h>
+#include <signal.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <netdb.h>
 #include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/ioctl.h>
+#include <sys/epoll.h>
+#include <sys/time.h>
 #include <errno.h>
+#include <assert.h>
 #include <limits.h>
 
 #include "splice.h"
 
-static int do_splice(int infd, int outfd, unsigned int len, char *msg)
+enum {
+	LAG_BLOCK,
+	LAG_DROP,
+	LAG_DISCONNECT,
+};
+
+static const char *lag_names[] = {
+	"block", "drop", "disconnect",
+};
+
+struct target {
+	char *name;
+	int fd;
+	int pfds[2];
+	int policy;
+	int dead;
+	/*
+	 * Files can not be polled, they are always writable
+	 */
+	int always_ready;
+	/*
+	 * Bytes from the head of stdin this target already has a copy of,
+	 * and bytes in its pipe not yet sent
+	 */
+	int taken;
+	int queued;
+	int pipe_full;
+	int sock_full;
+
+	unsigned long long sent;
+	unsigned long long dropped;
+	unsigned long drops;
+	int max_lag;
+};
+
+static int depth;
+static int no_stdout;
+static int interval;
+static int def_policy = LAG_BLOCK;
+static volatile sig_atomic_t show_stats;
+static struct timeval start;
+
+static int usage(char *name)
 {
-	while (len) {
-		int written = ssplice(infd, NULL, outfd, NULL, len, 0);
+	fprintf(stderr, "... | %s: [-n(o stdout)] [-d depth] [-p policy] [-i secs] hostname:port[,policy]...\n", name);
+	fprintf(stderr, "\tpolicy: block, drop or disconnect, for targets lagging more than depth bytes\n");
+	return 1;
+}
+
+static int parse_policy(const char *name)
+{
+	int i;
 
-		if (written <= 0)
-			return error(msg);
+	for (i = LAG_BLOCK; i <= LAG_DISCONNECT; i++)
+		if (!strcmp(name, lag_names[i]))
+			return i;
+
+	return -1;
+}
 
-		len -= written;
+static int parse_options(int argc, char *argv[])
+{
+	int c;
+
+	while ((c = getopt(argc, argv, "nd:p:i:")) != -1) {
+		switch (c) {
+		case 'n':
+			no_stdout = 1;
+			break;
+		case 'd':
+			depth = atoi(optarg);
+			break;
+		case 'p':
+			def_policy = parse_policy(optarg);
+			if (def_policy < 0)
+				return -1;
+			break;
+		case 'i':
+			interval = atoi(optarg);
+			break;
+		default:
+			return -1;
+		}
 	}
 
-	return 0;
+	return optind;
 }
 
-static int usage(char *name)
+static void sig_usr1(int sig)
 {
-	fprintf(stderr, "... | %s: hostname:port\n", name);
-	return 1;
+	show_stats = 1;
 }
 
-int main(int argc, char *argv[])
+static int connect_target(char *target)
 {
 	struct sockaddr_in addr;
 	char *p, *hname;
 	int fd;
 
-	if (argc < 2)
-		return usage(argv[0]);
-
-	if (check_input_pipe())
-		return usage(argv[0]);
-
-	hname = strdup(argv[1]);
+	hname = strdup(target);
 	p = strstr(hname, ":");
 	if (!p)
-		return usage(argv[0]);
+		return -1;
 
 	memset(&addr, 0, sizeof(addr));
 	addr.sin_family = AF_INET;
@@ -66,6 +150,7 @@ int main(int argc, char *argv[])
 
 		memcpy(&addr.sin_addr, hent->h_addr, 4);
 	}
+	free(hname);
 
 	fd = socket(AF_INET, SOCK_STREAM, 0);
 	if (fd < 0)
@@ -74,25 +159,353 @@ int main(int argc, char *argv[])
 	if (connect(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0)
 		return error("connect");
 
-	do {
-		int tee_len = stee(STDIN_FILENO, STDOUT_FILENO, INT_MAX, 0);
+	return fd;
+}
+
+static int open_target(int efd, struct target *t, char *arg)
+{
+	struct epoll_event ev;
+	char *p;
+
+	memset(t, 0, sizeof(*t));
+	t->name = strdup(arg);
+	t->policy = def_policy;
+
+	p = strchr(t->name, ',');
+	if (p) {
+		*p = '\0';
+		t->policy = parse_policy(p + 1);
+		if (t->policy < 0) {
+			fprintf(stderr, "%s: unknown policy %s\n", t->name, p + 1);
+			return -1;
+		}
+	}
+
+	if (!strcmp(t->name, "-"))
+		t->fd = STDOUT_FILENO;
+	else
+		t->fd = connect_target(t->name);
+	if (t->fd < 0) {
+		fprintf(stderr, "%s: could not connect\n", t->name);
+		return -1;
+	}
+
+	fcntl(t->fd, F_SETFL, fcntl(t->fd, F_GETFL) | O_NONBLOCK);
+
+	if (pipe(t->pfds) < 0)
+		return error("pipe");
+	if (depth)
+		grow_pipe(t->pfds[1], depth);
+
+	/*
+	 * Edge triggered, sock_full is cleared when the socket drains
+	 */
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLOUT | EPOLLET;
+	ev.data.ptr = t;
+	if (epoll_ctl(efd, EPOLL_CTL_ADD, t->fd, &ev) < 0) {
+		if (errno != EPERM)
+			return error("epoll_ctl");
+		t->always_ready = 1;
+	}
+
+	return 0;
+}
+
+static void close_target(int efd, struct target *t)
+{
+	epoll_ctl(efd, EPOLL_CTL_DEL, t->fd, NULL);
+	close(t->fd);
+	close(t->pfds[0]);
+	close(t->pfds[1]);
+	t->dead = 1;
+	t->taken = t->queued = 0;
+}
+
+static void print_stats(struct target *targets, int nr)
+{
+	struct timeval now;
+	double secs;
+	int i;
+
+	gettimeofday(&now, NULL);
+	secs = (now.tv_sec - start.tv_sec) + (now.tv_usec - start.tv_usec) / 1e6;
+	if (secs <= 0)
+		secs = 1e-6;
+
+	for (i = 0; i < nr; i++) {
+		struct target *t = &targets[i];
+
+		fprintf(stderr, "%s: %s sent %llu bytes (%.2f MiB/s), dropped %llu bytes in %lu drops, lag %d max %d%s\n",
+			t->name, lag_names[t->policy], t->sent,
+			t->sent / secs / (1024 * 1024), t->dropped, t->drops,
+			t->queued, t->max_lag, t->dead ? ", disconnected" : "");
+	}
+}
+
+/*
+ * Duplicate the head of stdin into every target that is not already ahead.
+ * A target with a full pipe is lagging, which its policy takes care of.
+ */
+static int tee_targets(int efd, struct target *targets, int nr, int avail)
+{
+	int i;
+
+	for (i = 0; i < nr; i++) {
+		struct target *t = &targets[i];
+		int ret;
+
+		if (t->dead || t->taken || t->pipe_full)
+			continue;
+
+		ret = stee(STDIN_FILENO, t->pfds[1], avail, SPLICE_F_NONBLOCK);
+		if (ret >= 0) {
+			t->taken = ret;
+			t->queued += ret;
+			t->max_lag = max(t->max_lag, t->queued);
+			continue;
+		} else if (errno != EAGAIN)
+			return error("tee");
+
+		switch (t->policy) {
+		case LAG_BLOCK:
+			t->pipe_full = 1;
+			break;
+		case LAG_DROP:
+			t->taken = avail;
+			t->dropped += avail;
+			t->drops++;
+			break;
+		case LAG_DISCONNECT:
+			fprintf(stderr, "%s: lagging %d bytes, disconnecting\n",
+				t->name, t->queued);
+			close_target(efd, t);
+			break;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Drop what every live target has a copy of from stdin
+ */
+static int consume(struct target *targets, int nr, int devnull)
+{
+	int i, len = INT_MAX;
+
+	for (i = 0; i < nr; i++)
+		if (!targets[i].dead)
+			len = min(len, targets[i].taken);
+
+	if (!len || len == INT_MAX)
+		return 0;
+
+	for (i = 0; i < nr; i++)
+		if (!targets[i].dead)
+			targets[i].taken -= len;
+
+	while (len) {
+		int ret = ssplice(STDIN_FILENO, NULL, devnull, NULL, len, 0);
+
+		if (ret <= 0)
+			return error("splice-consume");
+		len -= ret;
+	}
+
+	return 0;
+}
+
+static void flush_targets(int efd, struct target *targets, int nr)
+{
+	int i;
+
+	for (i = 0; i < nr; i++) {
+		struct target *t = &targets[i];
+		int ret;
 
-		if (tee_len < 0) {
+		if (t->dead || !t->queued || t->sock_full)
+			continue;
+
+		ret = ssplice(t->pfds[0], NULL, t->fd, NULL, t->queued,
+			      SPLICE_F_NONBLOCK | SPLICE_F_MORE);
+		if (ret < 0) {
 			if (errno == EAGAIN) {
-				usleep(1000);
+				t->sock_full = !t->always_ready;
 				continue;
 			}
-			return error("tee");
-		} else if (!tee_len)
-			break;
+			perror(t->name);
+			close_target(efd, t);
+			continue;
+		}
+
+		t->queued -= ret;
+		t->sent += ret;
+		t->pipe_full = 0;
+	}
+}
+
+static int set_input(int efd, int want, int *have)
+{
+	struct epoll_event ev;
+
+	if (want == *have)
+		return 0;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = want ? EPOLLIN : 0;
+	ev.data.ptr = NULL;
+	if (epoll_ctl(efd, EPOLL_CTL_MOD, STDIN_FILENO, &ev) < 0)
+		return error("epoll_ctl");
+
+	*have = want;
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	struct target *targets;
+	struct epoll_event ev, events[64];
+	struct timeval last;
+	int i, nr = 0, index, efd, devnull, eof = 0, have_input = 1;
+
+	if (check_input_pipe())
+		return usage(argv[0]);
+
+	index = parse_options(argc, argv);
+	if (index == -1 || index >= argc)
+		return usage(argv[0]);
+
+	signal(SIGPIPE, SIG_IGN);
+	signal(SIGUSR1, sig_usr1);
+
+	devnull = open("/dev/null", O_WRONLY);
+	if (devnull < 0)
+		return error("open /dev/null");
+
+	efd = epoll_create(64);
+	if (efd < 0)
+		return error("epoll_create");
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.ptr = NULL;
+	if (epoll_ctl(efd, EPOLL_CTL_ADD, STDIN_FILENO, &ev) < 0)
+		return error("epoll_ctl");
+
+	targets = calloc(argc - index + 1, sizeof(*targets));
+	assert(targets);
+
+	/*
+	 * stdout keeps the old behaviour and holds the input back
+	 */
+	if (!no_stdout && open_target(efd, &targets[nr++], "-,block"))
+		return 1;
+	for (; index < argc; index++)
+		if (open_target(efd, &targets[nr++], argv[index]))
+			return 1;
+
+	gettimeofday(&start, NULL);
+	last = start;
+
+	do {
+		int avail = 0, want_input = 0, busy = 0, alive = 0, n;
+
+		if (ioctl(STDIN_FILENO, FIONREAD, &avail) < 0)
+			return error("FIONREAD");
+
+		if (avail && tee_targets(efd, targets, nr, avail))
+			return 1;
+		if (consume(targets, nr, devnull))
+			return 1;
+		flush_targets(efd, targets, nr);
+
+		for (i = 0; i < nr; i++) {
+			struct target *t = &targets[i];
+
+			if (t->dead)
+				continue;
+			alive++;
+			if (t->pipe_full && !t->queued)
+				t->pipe_full = 0;
+			if (!t->taken && !t->pipe_full)
+				want_input = 1;
+			if (t->queued && !t->sock_full)
+				busy = 1;
+		}
+
+		if (!alive) {
+			fprintf(stderr, "%s: no targets left\n", argv[0]);
+			print_stats(targets, nr);
+			return 1;
+		}
 
 		/*
-		 * Send output to file, also consumes input pipe.
+		 * stdin isn't polled after the hangup, so look again at what
+		 * is left now that the targets have taken their share
 		 */
-		if (do_splice(STDIN_FILENO, fd, tee_len, "splice-net"))
-			break;
+		if (eof) {
+			if (ioctl(STDIN_FILENO, FIONREAD, &avail) < 0)
+				return error("FIONREAD");
+
+			if (!avail) {
+				for (i = 0; i < nr; i++)
+					if (!targets[i].dead && targets[i].queued)
+						break;
+				if (i == nr)
+					break;
+			} else if (want_input) {
+				continue;
+			}
+		}
+
+		if (show_stats) {
+			show_stats = 0;
+			print_stats(targets, nr);
+		}
+
+		if (interval) {
+			struct timeval now;
+
+			gettimeofday(&now, NULL);
+			if (now.tv_sec - last.tv_sec >= interval) {
+				print_stats(targets, nr);
+				last = now;
+			}
+		}
+
+		if (!eof && set_input(efd, want_input, &have_input))
+			return 1;
+
+		/*
+		 * Something can still be sent without waiting
+		 */
+		if (busy)
+			continue;
+
+		n = epoll_wait(efd, events, 64, interval ? interval * 1000 : -1);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return error("epoll_wait");
+		}
+
+		for (i = 0; i < n; i++) {
+			struct target *t = events[i].data.ptr;
+
+			/*
+			 * The writers are gone, what is left in stdin can be
+			 * picked up without waiting for it
+			 */
+			if (t) {
+				t->sock_full = 0;
+			} else if (events[i].events & EPOLLHUP) {
+				eof = 1;
+				epoll_ctl(efd, EPOLL_CTL_DEL, STDIN_FILENO, NULL);
+			}
+		}
 	} while (1);
 
-	close(fd);
+	print_stats(targets, nr);
 	return 0;
 }
@@ -1,95 +1,359 @@
 /*
- * A tee implementation using sys_tee. Stores stdin input in the given file
- * and duplicates that to stdout.
+ * A tee implementation using sys_tee. Duplicates stdin to stdout and any
+ * number of sinks: files, tcp:host:port sockets and |command pipes.
+ *
+ * Every sink gets its own pipe which the input is tee'd into, and which is
+ * then spliced to the sink when it can take data. The input is only consumed
+ * once every sink has a copy, so the slowest sink sets the pace, but the
+ * others can run ahead of it by up to the depth of their pipe.
  */
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
 #include <fcntl.h>
-#include <string.h>
+#include <poll.h>
+#include <signal.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <netdb.h>
 #include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/ioctl.h>
 #include <errno.h>
 #include <assert.h>
 #include <limits.h>
 
 #include "splice.h"
 
-static int splice_flags;
-
-static int do_splice(int infd, int outfd, unsigned int len, char *msg)
-{
-	while (len) {
-		int written = ssplice(infd, NULL, outfd, NULL, len, splice_flags);
-
-		if (written <= 0)
-			return error(msg);
-
-		len -= written;
-	}
+struct sink {
+	char *name;
+	int fd;
+	int pfds[2];
+	/*
+	 * Bytes from the head of stdin this sink already has a copy of
+	 */
+	int taken;
+	/*
+	 * Bytes in the sink pipe not yet spliced to the sink
+	 */
+	int queued;
+	int pipe_full;
+	int sink_full;
+};
 
-	return 0;
-}
+static int splice_flags;
+static int depth;
+static int no_stdout;
 
 static int usage(char *name)
 {
-	fprintf(stderr, "... | %s: [-m(ove)] outfile\n", name);
+	fprintf(stderr, "... | %s: [-m(ove)] [-n(o stdout)] [-d depth] sink...\n", name);
+	fprintf(stderr, "\tsink: file, tcp:host:port or \"|command\"\n");
+	fprintf(stderr, "\tdepth: bytes a sink may run ahead of the slowest one\n");
 	return 1;
 }
 
 static int parse_options(int argc, char *argv[])
 {
-	int c, index = 1;
+	int c;
 
-	while ((c = getopt(argc, argv, "m")) != -1) {
+	while ((c = getopt(argc, argv, "mnd:")) != -1) {
 		switch (c) {
 		case 'm':
 			splice_flags = SPLICE_F_MOVE;
-			index++;
+			break;
+		case 'n':
+			no_stdout = 1;
+			break;
+		case 'd':
+			depth = atoi(optarg);
 			break;
 		default:
 			return -1;
 		}
 	}
 
-	return index;
+	return optind;
 }
 
-int main(int argc, char *argv[])
+static int open_tcp(char *target)
 {
-	int fd, index;
+	struct sockaddr_in addr;
+	char *p, *hname;
+	int fd;
 
-	if (argc < 2)
-		return usage(argv[0]);
+	hname = strdup(target);
+	p = strrchr(hname, ':');
+	if (!p) {
+		fprintf(stderr, "%s: missing port\n", target);
+		return -1;
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(atoi(p + 1));
+	*p = '\0';
+
+	if (inet_aton(hname, &addr.sin_addr) != 1) {
+		struct hostent *hent = gethostbyname(hname);
+
+		if (!hent)
+			return error("gethostbyname");
+
+		memcpy(&addr.sin_addr, hent->h_addr, 4);
+	}
+	free(hname);
+
+	fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (fd < 0)
+		return error("socket");
+
+	if (connect(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0)
+		return error("connect");
+
+	return fd;
+}
+
+/*
+ * Run command with its stdin on a pipe, returns our end of it
+ */
+static int open_command(char *command)
+{
+	int pfds[2];
+	pid_t pid;
+
+	if (pipe(pfds) < 0)
+		return error("pipe");
+
+	pid = fork();
+	if (pid < 0)
+		return error("fork");
+	if (!pid) {
+		dup2(pfds[0], STDIN_FILENO);
+		close(pfds[0]);
+		close(pfds[1]);
+		execl("/bin/sh", "sh", "-c", command, NULL);
+		_exit(127);
+	}
+
+	close(pfds[0]);
+	return pfds[1];
+}
+
+static int open_sink(struct sink *s, char *name)
+{
+	memset(s, 0, sizeof(*s));
+	s->name = name;
+
+	if (!strcmp(name, "-"))
+		s->fd = STDOUT_FILENO;
+	else if (!strncmp(name, "tcp:", 4))
+		s->fd = open_tcp(name + 4);
+	else if (name[0] == '|')
+		s->fd = open_command(name + 1);
+	else
+		s->fd = open(name, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+	if (s->fd < 0)
+		return error(name);
+
+	/*
+	 * Files are always writable, sockets and pipes are polled
+	 */
+	fcntl(s->fd, F_SETFL, fcntl(s->fd, F_GETFL) | O_NONBLOCK);
+
+	if (pipe(s->pfds) < 0)
+		return error("pipe");
+	if (depth)
+		grow_pipe(s->pfds[1], depth);
+
+	return 0;
+}
+
+/*
+ * Duplicate the head of stdin into every sink that is not already ahead
+ */
+static int tee_sinks(struct sink *sinks, int nr, int avail)
+{
+	int i;
+
+	for (i = 0; i < nr; i++) {
+		struct sink *s = &sinks[i];
+		int ret;
+
+		if (s->taken || s->pipe_full)
+			continue;
+
+		ret = stee(STDIN_FILENO, s->pfds[1], avail, SPLICE_F_NONBLOCK);
+		if (ret < 0) {
+			if (errno != EAGAIN)
+				return error("tee");
+			s->pipe_full = 1;
+			continue;
+		}
+
+		s->taken = ret;
+		s->queued += ret;
+	}
+
+	return 0;
+}
+
+/*
+ * Drop what every sink has a copy of from stdin
+ */
+static int consume(struct sink *sinks, int nr, int devnull)
+{
+	int i, len = INT_MAX;
+
+	for (i = 0; i < nr; i++)
+		len = min(len, sinks[i].taken);
+
+	if (!len)
+		return 0;
+
+	for (i = 0; i < nr; i++)
+		sinks[i].taken -= len;
+
+	while (len) {
+		int ret = ssplice(STDIN_FILENO, NULL, devnull, NULL, len, 0);
+
+		if (ret <= 0)
+			return error("splice-consume");
+		len -= ret;
+	}
+
+	return 0;
+}
+
+static int flush_sinks(struct sink *sinks, int nr)
+{
+	int i;
+
+	for (i = 0; i < nr; i++) {
+		struct sink *s = &sinks[i];
+		int ret;
+
+		if (!s->queued || s->sink_full)
+			continue;
+
+		ret = ssplice(s->pfds[0], NULL, s->fd, NULL, s->queued,
+			      splice_flags | SPLICE_F_NONBLOCK);
+		if (ret < 0) {
+			if (errno != EAGAIN)
+				return error(s->name);
+			s->sink_full = 1;
+			continue;
+		}
+
+		s->queued -= ret;
+		s->pipe_full = 0;
+	}
+
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	struct sink *sinks;
+	struct pollfd *pfds;
+	int i, nr = 0, index, devnull, eof = 0;
 
 	if (check_input_pipe())
 		return usage(argv[0]);
 
 	index = parse_options(argc, argv);
-	if (index == -1 || index + 1 > argc)
+	if (index == -1 || (index >= argc && no_stdout))
 		return usage(argv[0]);
 
-	fd = open(argv[index], O_WRONLY | O_CREAT | O_TRUNC, 0644);
-	if (fd < 0)
-		return error("open output");
+	signal(SIGPIPE, SIG_IGN);
+
+	devnull = open("/dev/null", O_WRONLY);
+	if (devnull < 0)
+		return error("open /dev/null");
+
+	sinks = calloc(argc - index + 1, sizeof(*sinks));
+	pfds = calloc(argc - index + 2, sizeof(*pfds));
+	assert(sinks && pfds);
+
+	if (!no_stdout && open_sink(&sinks[nr++], "-"))
+		return 1;
+	for (; index < argc; index++)
+		if (open_sink(&sinks[nr++], argv[index]))
+			return 1;
 
 	do {
-		int tee_len = stee(STDIN_FILENO, STDOUT_FILENO, INT_MAX, 0);
+		int avail = 0, nfds = 0, want_input = 0;
 
-		if (tee_len < 0) {
-			if (errno == EAGAIN) {
-				usleep(1000);
-				continue;
+		if (ioctl(STDIN_FILENO, FIONREAD, &avail) < 0)
+			return error("FIONREAD");
+
+		if (avail && tee_sinks(sinks, nr, avail))
+			return 1;
+		if (consume(sinks, nr, devnull))
+			return 1;
+		if (flush_sinks(sinks, nr))
+			return 1;
+
+		/*
+		 * Wait for input only while some sink can take it, which is
+		 * what pushes back on the producer
+		 */
+		for (i = 0; i < nr; i++) {
+			struct sink *s = &sinks[i];
+
+			if (!s->taken && !s->pipe_full)
+				want_input = 1;
+			if (s->pipe_full && !s->queued)
+				s->pipe_full = 0;
+		}
+
+		if (!avail && eof) {
+			for (i = 0; i < nr; i++)
+				if (sinks[i].queued)
+					break;
+			if (i == nr)
+				break;
+		}
+
+		if (want_input && !eof) {
+			pfds[nfds].fd = STDIN_FILENO;
+			pfds[nfds++].events = POLLIN;
+		}
+		for (i = 0; i < nr; i++) {
+			if (sinks[i].sink_full) {
+				pfds[nfds].fd = sinks[i].fd;
+				pfds[nfds++].events = POLLOUT;
 			}
-			return error("tee");
-		} else if (!tee_len)
-			break;
+		}
 
 		/*
-		 * Send output to file, also consumes input pipe.
+		 * A full sink pipe drains as its sink takes data, so waiting
+		 * for the sinks covers the pipes too
 		 */
-		if (do_splice(STDIN_FILENO, fd, tee_len, "splice-file"))
-			break;
+		if (!nfds)
+			continue;
+
+		if (poll(pfds, nfds, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			return error("poll");
+		}
+
+		for (i = 0; i < nfds; i++) {
+			int j;
+
+			if (pfds[i].fd == STDIN_FILENO) {
+				if ((pfds[i].revents & POLLHUP) &&
+				    !(pfds[i].revents & POLLIN))
+					eof = 1;
+				continue;
+			}
+			for (j = 0; j < nr; j++)
+				if (sinks[j].fd == pfds[i].fd && pfds[i].revents)
+					sinks[j].sink_full = 0;
+		}
 	} while (1);
 
 	return 0;
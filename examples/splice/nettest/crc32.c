@@ -15,6 +15,11 @@
    along with this program; if not, write to the Free Software Foundation,
    Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.  */
 
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
 #include "crc32.h"
 
 static const unsigned long crctab[256] = {
@@ -72,11 +77,253 @@ static const unsigned long crctab[256] = {
   0xA2F33668, 0xBCB4666D, 0xB8757BDA, 0xB5365D03, 0xB1F740B4
 };
 
+/*
+ * Slicing tables, slice_tab[k][i] is the crc of byte i followed by k zero
+ * bytes. slice_tab[0] is crctab.
+ */
+static uint32_t slice_tab[16][256];
+
+static uint32_t crc32_bytes(uint32_t crc, const unsigned char *p, size_t len)
+{
+	while (len--)
+		crc = (crc << 8) ^ slice_tab[0][(crc >> 24) ^ *p++];
+
+	return crc;
+}
+
+static inline uint32_t get_be32(const unsigned char *p)
+{
+	return ((uint32_t) p[0] << 24) | ((uint32_t) p[1] << 16) |
+		((uint32_t) p[2] << 8) | p[3];
+}
+
+/*
+ * Fold four bytes of crc or data into the tables for the given distance
+ * from the end of the slice
+ */
+#define SLICE4(w, k)						\
+	(slice_tab[(k) + 3][(w) >> 24] ^			\
+	 slice_tab[(k) + 2][((w) >> 16) & 0xff] ^		\
+	 slice_tab[(k) + 1][((w) >> 8) & 0xff] ^		\
+	 slice_tab[(k)][(w) & 0xff])
+
+static uint32_t crc32_slice8(uint32_t crc, const unsigned char *p, size_t len)
+{
+	while (len >= 8) {
+		uint32_t one = crc ^ get_be32(p);
+		uint32_t two = get_be32(p + 4);
+
+		crc = SLICE4(one, 4) ^ SLICE4(two, 0);
+		p += 8;
+		len -= 8;
+	}
+
+	return crc32_bytes(crc, p, len);
+}
+
+static uint32_t crc32_slice16(uint32_t crc, const unsigned char *p, size_t len)
+{
+	while (len >= 16) {
+		uint32_t one = crc ^ get_be32(p);
+		uint32_t two = get_be32(p + 4);
+		uint32_t three = get_be32(p + 8);
+		uint32_t four = get_be32(p + 12);
+
+		crc = SLICE4(one, 12) ^ SLICE4(two, 8) ^
+			SLICE4(three, 4) ^ SLICE4(four, 0);
+		p += 16;
+		len -= 16;
+	}
+
+	return crc32_slice8(crc, p, len);
+}
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <cpuid.h>
+#include <immintrin.h>
+
+#define HAVE_CRC32_PCLMUL
+
+/*
+ * x^n mod P for the folding constants
+ */
+static uint64_t xpow_mod(int n)
+{
+	uint64_t r = 1;
+
+	while (n--) {
+		r <<= 1;
+		if (r & (1ULL << 32))
+			r ^= 0x104C11DB7ULL;
+	}
+
+	return r;
+}
+
+static uint64_t fold_512_hi, fold_512_lo, fold_128_hi, fold_128_lo;
+
+static int have_pclmul(void)
+{
+	unsigned int eax, ebx, ecx, edx;
+
+	if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+		return 0;
+
+	return (ecx & bit_PCLMUL) && (ecx & bit_SSSE3);
+}
+
+/*
+ * x is a 128-bit remainder with the first message byte in the top byte,
+ * fold it forward over the distance k was made for
+ */
+__attribute__((target("pclmul,ssse3")))
+static inline __m128i fold(__m128i x, __m128i k)
+{
+	return _mm_xor_si128(_mm_clmulepi64_si128(x, k, 0x11),
+			     _mm_clmulepi64_si128(x, k, 0x00));
+}
+
+/*
+ * Carry-less multiply folding, 64 bytes at a time into four remainders,
+ * then down to one which the tables reduce to the crc. The crc is
+ * MSB first, so every block is byte reversed on load.
+ */
+__attribute__((target("pclmul,ssse3")))
+static uint32_t crc32_pclmul(uint32_t crc, const unsigned char *p, size_t len)
+{
+	const __m128i bswap = _mm_setr_epi8(15, 14, 13, 12, 11, 10, 9, 8,
+					    7, 6, 5, 4, 3, 2, 1, 0);
+	__m128i k512, k128, x0, x1, x2, x3;
+	unsigned char rem[16];
+
+	if (len < 128)
+		return crc32_slice16(crc, p, len);
+
+	k512 = _mm_set_epi64x(fold_512_hi, fold_512_lo);
+	k128 = _mm_set_epi64x(fold_128_hi, fold_128_lo);
+
+#define LOAD(off) _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) (p + (off))), bswap)
+
+	x0 = LOAD(0);
+	x1 = LOAD(16);
+	x2 = LOAD(32);
+	x3 = LOAD(48);
+	x0 = _mm_xor_si128(x0, _mm_set_epi32(crc, 0, 0, 0));
+	p += 64;
+	len -= 64;
+
+	while (len >= 64) {
+		x0 = _mm_xor_si128(fold(x0, k512), LOAD(0));
+		x1 = _mm_xor_si128(fold(x1, k512), LOAD(16));
+		x2 = _mm_xor_si128(fold(x2, k512), LOAD(32));
+		x3 = _mm_xor_si128(fold(x3, k512), LOAD(48));
+		p += 64;
+		len -= 64;
+	}
+
+	x1 = _mm_xor_si128(fold(x0, k128), x1);
+	x2 = _mm_xor_si128(fold(x1, k128), x2);
+	x0 = _mm_xor_si128(fold(x2, k128), x3);
+
+	while (len >= 16) {
+		x0 = _mm_xor_si128(fold(x0, k128), LOAD(0));
+		p += 16;
+		len -= 16;
+	}
+
+#undef LOAD
+
+	/*
+	 * The crc of the remainder is the crc of everything so far
+	 */
+	_mm_storeu_si128((__m128i *) rem, _mm_shuffle_epi8(x0, bswap));
+	crc = crc32_slice16(0, rem, sizeof(rem));
+
+	return crc32_slice16(crc, p, len);
+}
+#endif
+
+static struct {
+	const char *name;
+	uint32_t (*fn)(uint32_t, const unsigned char *, size_t);
+} crc32_impls[] = {
+	{ "byte",	crc32_bytes },
+	{ "slice8",	crc32_slice8 },
+	{ "slice16",	crc32_slice16 },
+#ifdef HAVE_CRC32_PCLMUL
+	{ "pclmul",	crc32_pclmul },
+#endif
+};
+
+#define NR_IMPLS	(sizeof(crc32_impls) / sizeof(crc32_impls[0]))
+
+static int crc32_impl = 2;
+
+/*
+ * Build the tables and pick the fastest implementation the CPU has, or the
+ * one CRC32_IMPL names
+ */
+__attribute__((constructor))
+static void crc32_init(void)
+{
+	const char *env = getenv("CRC32_IMPL");
+	int i, k;
+
+	for (i = 0; i < 256; i++)
+		slice_tab[0][i] = crctab[i];
+	for (k = 1; k < 16; k++)
+		for (i = 0; i < 256; i++) {
+			uint32_t c = slice_tab[k - 1][i];
+
+			slice_tab[k][i] = (c << 8) ^ slice_tab[0][c >> 24];
+		}
+
+#ifdef HAVE_CRC32_PCLMUL
+	fold_512_hi = xpow_mod(512 + 64);
+	fold_512_lo = xpow_mod(512);
+	fold_128_hi = xpow_mod(128 + 64);
+	fold_128_lo = xpow_mod(128);
+
+	if (have_pclmul())
+		crc32_impl = NR_IMPLS - 1;
+#endif
+
+	if (!env)
+		return;
+
+	for (i = 0; i < NR_IMPLS; i++) {
+		if (!strcmp(env, crc32_impls[i].name)) {
+			crc32_impl = i;
+			return;
+		}
+	}
+
+	fprintf(stderr, "crc32: unknown CRC32_IMPL %s, using %s\n", env,
+		crc32_impls[crc32_impl].name);
+}
+
+const char *crc32_name(void)
+{
+	return crc32_impls[crc32_impl].name;
+}
+
 unsigned long crc32(const void *buffer, unsigned long length)
 {
 	const unsigned char *cp = (const unsigned char *) buffer;
 	unsigned long crc = 0;
 
+	/*
+	 * Only the low 32 bits of crc are the checksum, a 64-bit unsigned
+	 * long also carries the top bytes of the last four crc states. The
+	 * fast paths do all but the last four bytes, which go through the
+	 * original loop so the result stays bit identical.
+	 */
+	if (length > 4) {
+		crc = crc32_impls[crc32_impl].fn(0, cp, length - 4);
+		cp += length - 4;
+		length = 4;
+	}
+
 	while (length--)
 		crc = (crc << 8) ^ crctab[((crc >> 24) ^ *(cp++)) & 0xFF];
 
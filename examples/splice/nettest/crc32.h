@@ -19,5 +19,6 @@
 #define CRC32_H
 
 extern unsigned long crc32(const void * const, unsigned long);
+extern const char *crc32_name(void);
 
 #endif
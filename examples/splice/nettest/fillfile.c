@@ -19,17 +19,15 @@ static int usage(const char *name)
 
 static int parse_options(int argc, char *argv[])
 {
-	int c, index = 1;
+	int c;
 
 	while ((c = getopt(argc, argv, "s:z:")) != -1) {
 		switch (c) {
 		case 's':
 			msg_size = atoi(optarg);
-			index++;
 			break;
 		case 'z':
 			file_size = atoi(optarg);
-			index++;
 			break;
 		default:
 			return -1;
@@ -37,7 +35,7 @@ static int parse_options(int argc, char *argv[])
 	}
 
 	printf("msg_size=%u, file_size=%umb\n", msg_size, file_size);
-	return index;
+	return optind;
 }
 
 static void fill_buf(struct msg *m, unsigned int len)
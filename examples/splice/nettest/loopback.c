@@ -0,0 +1,419 @@
+/*
+ * Run every xmit/sf and recv combination against each other on this host,
+ * over a loopback TCP connection or a socketpair, and print one table of
+ * throughput, CPU use and crc errors.
+ *
+ * The driver sets up the connection itself and hands the two ends to the
+ * programs with -f, so nothing has to be started by hand and no port has to
+ * match.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <limits.h>
+#include <signal.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <errno.h>
+
+#include "../splice.h"
+
+struct mode {
+	const char *name;
+	const char *prog;
+	const char *flag;
+	/*
+	 * Whether this kernel can run the mode at all, NULL if it always can
+	 */
+	int (*usable)(void);
+	const char *why;
+	int skip;
+};
+
+static int vmsplice_move_usable(void);
+
+static struct mode xmit_modes[] = {
+	{ "vmsplice+splice",	"xmit",	NULL },
+	{ "send",		"xmit",	"-n" },
+	{ "sendfile",		"sf",	NULL },
+	{ "splice-move",	"xmit",	"-m" },
+	{ "pipelined-gift",	"xmit",	"-P" },
+};
+
+static struct mode recv_modes[] = {
+	{ "recv",		"recv",	"-r" },
+	{ "splice",		"recv",	NULL },
+	{ "splice-move+unmap",	"recv",	"-m", vmsplice_move_usable,
+	  "vmsplice can't move pipe pages to user space, SPLICE_F_UNMAP is gone" },
+	{ "zerocopy",		"recv",	"-z" },
+};
+
+#define NR_XMIT	(sizeof(xmit_modes) / sizeof(xmit_modes[0]))
+#define NR_RECV	(sizeof(recv_modes) / sizeof(recv_modes[0]))
+
+static unsigned int msg_size = 4096;
+static unsigned int file_mb = 256;
+static int use_socketpair;
+static char *data_file;
+static char bindir[PATH_MAX];
+
+static int usage(char *name)
+{
+	fprintf(stderr, "%s: [-s msg size] [-z MiB per run] [-u(nix socketpair)] [-F data file]\n", name);
+	return 1;
+}
+
+static int parse_options(int argc, char *argv[])
+{
+	int c;
+
+	while ((c = getopt(argc, argv, "s:z:uF:")) != -1) {
+		switch (c) {
+		case 's':
+			msg_size = atoi(optarg);
+			break;
+		case 'z':
+			file_mb = atoi(optarg);
+			break;
+		case 'u':
+			use_socketpair = 1;
+			break;
+		case 'F':
+			data_file = optarg;
+			break;
+		default:
+			return -1;
+		}
+	}
+
+	return optind;
+}
+
+/*
+ * A connected pair over loopback TCP, the same path two hosts would take
+ * minus the wire
+ */
+static int tcp_pair(int fds[2])
+{
+	struct sockaddr_in addr;
+	socklen_t len = sizeof(addr);
+	int lfd, opt = 1;
+
+	lfd = socket(AF_INET, SOCK_STREAM, 0);
+	if (lfd < 0)
+		return error("socket");
+
+	setsockopt(lfd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	if (bind(lfd, (struct sockaddr *) &addr, sizeof(addr)) < 0)
+		return error("bind");
+	if (listen(lfd, 1) < 0)
+		return error("listen");
+	if (getsockname(lfd, (struct sockaddr *) &addr, &len) < 0)
+		return error("getsockname");
+
+	fds[1] = socket(AF_INET, SOCK_STREAM, 0);
+	if (fds[1] < 0)
+		return error("socket");
+	if (connect(fds[1], (struct sockaddr *) &addr, sizeof(addr)) < 0)
+		return error("connect");
+
+	fds[0] = accept(lfd, NULL, NULL);
+	if (fds[0] < 0)
+		return error("accept");
+
+	close(lfd);
+	return 0;
+}
+
+/*
+ * Run bindir/prog with args and stdout to out_fd. close_fd is the end of
+ * the connection the program must not hold on to.
+ */
+static pid_t spawn(char **args, int out_fd, int close_fd)
+{
+	char path[PATH_MAX];
+	pid_t pid;
+
+	if (snprintf(path, sizeof(path), "%s/%s", bindir, args[0]) >= sizeof(path))
+		return error("path too long");
+
+	pid = fork();
+	if (pid < 0)
+		return error("fork");
+	if (!pid) {
+		close(close_fd);
+		dup2(out_fd, STDOUT_FILENO);
+		execv(path, args);
+		perror(path);
+		_exit(127);
+	}
+
+	return pid;
+}
+
+/*
+ * recv -m has vmsplice map the pipe pages into its address space, which
+ * mainline never did. Ask for a page the same way and see if we get it.
+ */
+static int vmsplice_move_usable(void)
+{
+	char buf[4096];
+	struct iovec iov = {
+		.iov_base = NULL,
+		.iov_len = sizeof(buf),
+	};
+	int pfds[2], ret;
+
+	if (pipe(pfds) < 0)
+		return 0;
+
+	memset(buf, 0, sizeof(buf));
+	ret = write(pfds[1], buf, sizeof(buf)) == sizeof(buf) &&
+		svmsplice(pfds[0], &iov, 1, SPLICE_F_MOVE) > 0;
+
+	close(pfds[0]);
+	close(pfds[1]);
+	return ret;
+}
+
+/*
+ * Returns 1 and says why in buf if the program did not exit cleanly
+ */
+static int child_failed(const char *prog, int status, char *buf, size_t len)
+{
+	buf[0] = '\0';
+	if (WIFEXITED(status) && !WEXITSTATUS(status))
+		return 0;
+
+	if (WIFEXITED(status))
+		snprintf(buf, len, "%s exited with %d", prog, WEXITSTATUS(status));
+	else if (WIFSIGNALED(status))
+		snprintf(buf, len, "%s killed by signal %d", prog, WTERMSIG(status));
+	else
+		snprintf(buf, len, "%s did not exit", prog);
+	return 1;
+}
+
+static double rusage_secs(struct rusage *ru)
+{
+	return ru->ru_utime.tv_sec + ru->ru_utime.tv_usec / 1e6 +
+		ru->ru_stime.tv_sec + ru->ru_stime.tv_usec / 1e6;
+}
+
+static int run_one(struct mode *x, struct mode *r, unsigned long packets)
+{
+	char size_arg[32], pkt_arg[32], rfd_arg[32], xfd_arg[32], buf[4096];
+	char *xargs[12], *rargs[12], xwhy[64], rwhy[64];
+	unsigned long msgs = 0, crc_errors = 0;
+	struct rusage xru, rru;
+	struct timeval start, end;
+	int fds[2], out[2], devnull, nx = 0, nr = 0, xstatus, rstatus, len, ret;
+	pid_t xpid, rpid;
+	double secs;
+	char *p;
+
+	if (use_socketpair)
+		ret = socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+	else
+		ret = tcp_pair(fds);
+	if (ret < 0)
+		return error("connection");
+
+	if (pipe(out) < 0)
+		return error("pipe");
+	devnull = open("/dev/null", O_WRONLY);
+
+	sprintf(size_arg, "%u", msg_size);
+	sprintf(pkt_arg, "%lu", packets);
+	sprintf(rfd_arg, "%d", fds[0]);
+	sprintf(xfd_arg, "%d", fds[1]);
+
+	rargs[nr++] = (char *) r->prog;
+	rargs[nr++] = "-s";
+	rargs[nr++] = size_arg;
+	if (r->flag)
+		rargs[nr++] = (char *) r->flag;
+	rargs[nr++] = "-f";
+	rargs[nr++] = rfd_arg;
+	rargs[nr] = NULL;
+
+	xargs[nx++] = (char *) x->prog;
+	xargs[nx++] = "-f";
+	xargs[nx++] = xfd_arg;
+	if (!strcmp(x->prog, "sf"))
+		xargs[nx++] = data_file;
+	else {
+		xargs[nx++] = "-s";
+		xargs[nx++] = size_arg;
+		xargs[nx++] = "-p";
+		xargs[nx++] = pkt_arg;
+		if (x->flag)
+			xargs[nx++] = (char *) x->flag;
+	}
+	xargs[nx] = NULL;
+
+	gettimeofday(&start, NULL);
+	rpid = spawn(rargs, out[1], fds[1]);
+	xpid = spawn(xargs, devnull, fds[0]);
+
+	/*
+	 * recv only sees the end of the stream once nobody else holds the
+	 * sending side open
+	 */
+	close(fds[0]);
+	close(fds[1]);
+	close(out[1]);
+	close(devnull);
+
+	if (xpid < 0 || rpid < 0)
+		return -1;
+
+	if (wait4(xpid, &xstatus, 0, &xru) < 0)
+		xstatus = -1;
+	if (wait4(rpid, &rstatus, 0, &rru) < 0)
+		rstatus = -1;
+	gettimeofday(&end, NULL);
+
+	len = 0;
+	while ((ret = read(out[0], buf + len, sizeof(buf) - 1 - len)) > 0)
+		len += ret;
+	buf[len] = '\0';
+	close(out[0]);
+
+	/*
+	 * A throughput from a run that broke off would look like a
+	 * regression, or hide one
+	 */
+	if (child_failed("xmit", xstatus, xwhy, sizeof(xwhy)) |
+	    child_failed("recv", rstatus, rwhy, sizeof(rwhy))) {
+		printf("%-16s %-18s %10s  %s%s%s\n", x->name, r->name, "FAILED",
+			xwhy, xwhy[0] && rwhy[0] ? ", " : "", rwhy);
+		fflush(stdout);
+		return -1;
+	}
+
+	p = strstr(buf, "msgs=");
+	if (p)
+		sscanf(p, "msgs=%lu, crc_errors=%lu", &msgs, &crc_errors);
+
+	secs = (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1e6;
+	if (secs <= 0)
+		secs = 1e-6;
+
+	printf("%-16s %-18s %10.2f %8.1f %8.1f %8lu/%-8lu %6lu\n",
+		x->name, r->name,
+		(double) msgs * msg_size / secs / (1024 * 1024),
+		rusage_secs(&xru) * 100 / secs, rusage_secs(&rru) * 100 / secs,
+		msgs, packets, crc_errors);
+	fflush(stdout);
+	return 0;
+}
+
+/*
+ * sf sends a file of messages, made by fillfile
+ */
+static int make_data_file(void)
+{
+	static char name[] = "/tmp/nettest-loopback-XXXXXX";
+	char size_arg[32], mb_arg[32];
+	char *args[] = { "fillfile", "-s", size_arg, "-z", mb_arg, name, NULL };
+	int fd, status, devnull;
+	pid_t pid;
+
+	fd = mkstemp(name);
+	if (fd < 0)
+		return error("mkstemp");
+	close(fd);
+
+	sprintf(size_arg, "%u", msg_size);
+	sprintf(mb_arg, "%u", file_mb);
+
+	devnull = open("/dev/null", O_WRONLY);
+	pid = spawn(args, devnull, -1);
+	close(devnull);
+	if (pid < 0 || waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) ||
+	    WEXITSTATUS(status))
+		return -1;
+
+	data_file = name;
+	return 1;
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned long packets;
+	int i, j, index, len, made_file = 0, failed = 0;
+	struct stat sb;
+	char *p;
+
+	index = parse_options(argc, argv);
+	if (index == -1 || index != argc || !msg_size || !file_mb)
+		return usage(argv[0]);
+
+	/*
+	 * The test programs live next to us
+	 */
+	len = readlink("/proc/self/exe", bindir, sizeof(bindir) - 1);
+	if (len > 0) {
+		bindir[len] = '\0';
+		p = dirname(bindir);
+		memmove(bindir, p, strlen(p) + 1);
+	} else
+		strcpy(bindir, ".");
+
+	signal(SIGPIPE, SIG_IGN);
+
+	if (!data_file) {
+		made_file = make_data_file();
+		if (made_file < 0) {
+			fprintf(stderr, "could not make data file with fillfile\n");
+			return 1;
+		}
+	}
+
+	/*
+	 * fillfile writes whole messages only, so the others send as many
+	 */
+	if (stat(data_file, &sb) < 0)
+		return error(data_file);
+	packets = sb.st_size / msg_size;
+
+	printf("loopback: %s, msg=%u bytes, %lu msgs per run\n",
+		use_socketpair ? "socketpair" : "tcp", msg_size, packets);
+	/*
+	 * A mode the kernel can't do would only add rows of failures
+	 */
+	for (j = 0; j < NR_RECV; j++) {
+		struct mode *r = &recv_modes[j];
+
+		if (r->usable && !r->usable()) {
+			printf("recv %s: skipped, %s\n", r->name, r->why);
+			r->skip = 1;
+		}
+	}
+
+	printf("%-16s %-18s %10s %8s %8s %17s %6s\n", "xmit", "recv", "MiB/s",
+		"xmit cpu", "recv cpu", "msgs", "crc");
+
+	for (i = 0; i < NR_XMIT; i++)
+		for (j = 0; j < NR_RECV; j++)
+			if (!recv_modes[j].skip &&
+			    run_one(&xmit_modes[i], &recv_modes[j], packets))
+				failed++;
+
+	if (made_file)
+		unlink(data_file);
+	return failed ? 1 : 0;
+}
@@ -13,18 +13,41 @@
 #include <sys/poll.h>
 #include <sys/time.h>
 #include <sys/resource.h>
+#include <sys/mman.h>
+#include <netinet/tcp.h>
 
 #include "../splice.h"
 #include "crc32.h"
 #include "msg.h"
 
+#ifndef TCP_ZEROCOPY_RECEIVE
+#define TCP_ZEROCOPY_RECEIVE	35
+struct tcp_zerocopy_receive {
+	uint64_t address;
+	uint32_t length;
+	uint32_t recv_skip_hint;
+};
+#endif
+
+/*
+ * Windows of the socket mapping for -z, reused round robin
+ */
+#define ZC_RING		8
+
 static unsigned int msg_size = 4096;
 static int use_splice = 1;
 static int splice_move;
+static int conn_fd = -1;
+static int zerocopy;
+static int verbose;
+static int mss;
+
+static unsigned long msgs, crc_errors;
+static unsigned long zc_moved, zc_partial, zc_copied;
 
 static int usage(const char *name)
 {
-	fprintf(stderr, "%s: [-s(ize)] [-m(ove)] [-r(ecv)] port\n", name);
+	fprintf(stderr, "%s: [-s(ize)] [-m(ove)] [-r(ecv)] [-z(erocopy recv)] [-v(erbose)] [-M mss] [-f connected fd] port\n", name);
 	return 1;
 }
 
@@ -92,28 +115,37 @@ static int get_connect(int fd, struct sockaddr_in *addr)
 
 static int parse_options(int argc, char *argv[])
 {
-	int c, index = 1;
+	int c;
 
-	while ((c = getopt(argc, argv, "s:mr")) != -1) {
+	while ((c = getopt(argc, argv, "s:mrzvM:f:")) != -1) {
 		switch (c) {
 		case 's':
 			msg_size = atoi(optarg);
-			index++;
 			break;
 		case 'm':
 			splice_move = 1;
-			index++;
 			break;
 		case 'r':
 			use_splice = 0;
-			index++;
+			break;
+		case 'f':
+			conn_fd = atoi(optarg);
+			break;
+		case 'z':
+			zerocopy = 1;
+			break;
+		case 'v':
+			verbose = 1;
+			break;
+		case 'M':
+			mss = atoi(optarg);
 			break;
 		default:
 			return -1;
 		}
 	}
 
-	return index;
+	return optind;
 }
 
 static int verify_crc(struct msg *m)
@@ -124,10 +156,16 @@ static int verify_crc(struct msg *m)
 	data += sizeof(*m);
 	crc = crc32(data, m->msg_size - sizeof(*m));
 
+	msgs++;
 	if (crc == m->crc32)
 		return 0;
 
-	fprintf(stderr, "crc error: got %lx, wanted %lx\n", crc, m->crc32);
+	/*
+	 * Once it goes wrong it tends to go wrong a lot, the count is
+	 * printed at the end
+	 */
+	if (++crc_errors <= 10)
+		fprintf(stderr, "crc error: got %lx, wanted %lx\n", crc, m->crc32);
 	return 1;
 }
 
@@ -148,30 +186,37 @@ static int do_recv(int fd, void *buf, unsigned int len)
 	return len;
 }
 
+/*
+ * The receive loops return -1 if the stream broke off with an error, the
+ * end of the stream is not one
+ */
 static int normal_recv_loop(int fd)
 {
 	struct msg *m;
+	int ret;
 
 	m = malloc(msg_size);
 
 	while (1) {
-		if (do_recv(fd, m, msg_size))
+		ret = do_recv(fd, m, msg_size);
+		if (ret)
 			break;
 
 		if (m->msg_size != msg_size) {
 			fprintf(stderr, "Bad packet length: wanted %u, got %lu\n", msg_size, m->msg_size);
+			ret = -1;
 			break;
 		}
 
 		/*
-		 * now verify data
+		 * now verify data, a bad message is counted but the stream
+		 * is still in sync
 		 */
-		if (verify_crc(m))
-			break;
+		verify_crc(m);
 	}
 
 	free(m);
-	return 0;
+	return ret < 0 ? -1 : 0;
 }
 
 static int splice_in(int sockfd, int pipefd, unsigned int size)
@@ -245,7 +290,7 @@ static int splice_recv_loop(int fd)
 {
 	struct msg *m;
 	void *buf;
-	int pipes[2];
+	int pipes[2], ret;
 
 	if (pipe(pipes) < 0)
 		return error("pipe");
@@ -259,7 +304,8 @@ static int splice_recv_loop(int fd)
 		/*
 		 * fill pipe with network data
 		 */
-		if (splice_in(fd, pipes[1], msg_size))
+		ret = splice_in(fd, pipes[1], msg_size);
+		if (ret)
 			break;
 
 		/*
@@ -270,24 +316,28 @@ static int splice_recv_loop(int fd)
 		else
 			buf = NULL;
 
-		if (vmsplice_out(&buf, pipes[0], msg_size))
+		if (vmsplice_out(&buf, pipes[0], msg_size)) {
+			ret = -1;
 			break;
+		}
 
 		m = buf;
 
 		if (m->msg_size != msg_size) {
 			fprintf(stderr, "Bad packet length: wanted %u, got %lu\n", msg_size, m->msg_size);
+			ret = -1;
 			break;
 		}
 
 		/*
 		 * now verify data
 		 */
-		if (verify_crc(m))
-			break;
+		verify_crc(m);
 
-		if (splice_move && vmsplice_unmap(pipes[0], buf, msg_size))
+		if (splice_move && vmsplice_unmap(pipes[0], buf, msg_size)) {
+			ret = -1;
 			break;
+		}
 	}
 
 	if (!splice_move)
@@ -295,7 +345,189 @@ static int splice_recv_loop(int fd)
 
 	close(pipes[0]);
 	close(pipes[1]);
-	return 0;
+	return ret < 0 ? -1 : 0;
+}
+
+/*
+ * Zero copy receive. vmsplice to user memory always copies on current
+ * kernels and SPLICE_F_UNMAP is gone, the way to get the network pages
+ * themselves is to mmap the socket and have TCP_ZEROCOPY_RECEIVE map them
+ * into it. That only works for whole, page aligned pages, so whatever
+ * part of a message can't be mapped is copied instead, and every message
+ * is counted as moved, partly moved or copied.
+ *
+ * Segments only carry whole pages if the MSS minus tcp options is a page
+ * multiple, -M sets it. Even then the pages must be plain receive pages,
+ * over loopback they are the sender's and everything ends up copied.
+ */
+struct zc_slot {
+	/*
+	 * window of the socket mapping, and a private buffer for messages
+	 * that must be copied
+	 */
+	void *map;
+	void *copy;
+};
+
+/*
+ * Returns 1 if the kernel maps socket pages for us, 0 if it does not
+ */
+static int zc_probe(int fd, void *map)
+{
+	struct tcp_zerocopy_receive zc;
+	socklen_t len = sizeof(zc);
+
+	if (map == MAP_FAILED)
+		return 0;
+
+	memset(&zc, 0, sizeof(zc));
+	zc.address = (unsigned long) map;
+	if (getsockopt(fd, IPPROTO_TCP, TCP_ZEROCOPY_RECEIVE, &zc, &len) < 0)
+		return 0;
+
+	return 1;
+}
+
+/*
+ * Map up to len bytes of the stream at addr, returns the number mapped.
+ * Stops early when the data at the head of the queue can't be mapped, or
+ * at end of file.
+ */
+static int zc_map(int fd, void *addr, unsigned int len)
+{
+	unsigned int mapped = 0;
+	char c;
+
+	while (mapped < len) {
+		struct tcp_zerocopy_receive zc;
+		socklen_t optlen = sizeof(zc);
+
+		memset(&zc, 0, sizeof(zc));
+		zc.address = (unsigned long) addr + mapped;
+		zc.length = len - mapped;
+
+		if (getsockopt(fd, IPPROTO_TCP, TCP_ZEROCOPY_RECEIVE, &zc, &optlen) < 0) {
+			int err = errno;
+
+			/*
+			 * Once the peer has closed, the kernel fails the
+			 * mapping with EIO instead of mapping nothing
+			 */
+			if (!recv(fd, &c, 1, MSG_PEEK | MSG_DONTWAIT))
+				break;
+
+			errno = err;
+			return error("TCP_ZEROCOPY_RECEIVE");
+		}
+
+		mapped += zc.length;
+		if (zc.recv_skip_hint)
+			break;
+
+		/*
+		 * Nothing queued, wait for data or the end of the stream
+		 */
+		if (!zc.length) {
+			int ret = recv(fd, &c, 1, MSG_PEEK);
+
+			if (ret < 0)
+				return error("recv");
+			else if (!ret)
+				break;
+		}
+	}
+
+	return mapped;
+}
+
+static int zerocopy_recv_loop(int fd)
+{
+	struct zc_slot slots[ZC_RING];
+	unsigned int page_size = sysconf(_SC_PAGESIZE);
+	unsigned int win_len, map_len;
+	void *map;
+	int i, cur = 0, supported, ret = 0;
+
+	win_len = (msg_size + page_size - 1) & ~(page_size - 1);
+	map_len = msg_size & ~(page_size - 1);
+
+	map = mmap(NULL, win_len * ZC_RING, PROT_READ, MAP_SHARED, fd, 0);
+	supported = zc_probe(fd, map);
+	if (!supported) {
+		fprintf(stderr, "zerocopy receive not supported on this socket, copying\n");
+		if (map != MAP_FAILED)
+			munmap(map, win_len * ZC_RING);
+	}
+
+	for (i = 0; i < ZC_RING; i++) {
+		slots[i].map = supported ? map + i * win_len : NULL;
+		if (posix_memalign(&slots[i].copy, page_size, win_len))
+			return error("posix_memalign");
+	}
+
+	while (1) {
+		struct zc_slot *s = &slots[cur];
+		struct msg *m;
+		int mapped = 0;
+
+		if (++cur == ZC_RING)
+			cur = 0;
+
+		/*
+		 * Mapping the window again drops the pages it held from the
+		 * last round
+		 */
+		if (supported && map_len) {
+			mapped = zc_map(fd, s->map, map_len);
+			if (mapped < 0) {
+				ret = -1;
+				break;
+			}
+		}
+
+		if (mapped == msg_size) {
+			m = s->map;
+			zc_moved++;
+		} else {
+			m = s->copy;
+			memcpy(m, s->map, mapped);
+			ret = do_recv(fd, (void *) m + mapped, msg_size - mapped);
+			if (ret)
+				break;
+			if (mapped)
+				zc_partial++;
+			else
+				zc_copied++;
+		}
+
+		if (verbose) {
+			fprintf(stderr, "msg %lu: ", msgs);
+			if (mapped == msg_size)
+				fprintf(stderr, "moved\n");
+			else if (mapped)
+				fprintf(stderr, "partly moved, %d of %u bytes\n", mapped, msg_size);
+			else
+				fprintf(stderr, "copied\n");
+		}
+
+		if (m->msg_size != msg_size) {
+			fprintf(stderr, "Bad packet length: wanted %u, got %lu\n", msg_size, m->msg_size);
+			ret = -1;
+			break;
+		}
+
+		verify_crc(m);
+	}
+
+	for (i = 0; i < ZC_RING; i++)
+		free(slots[i].copy);
+	if (supported)
+		munmap(map, win_len * ZC_RING);
+
+	printf("zerocopy: %s, moved=%lu, partial=%lu, copied=%lu\n",
+		supported ? "supported" : "unsupported", zc_moved, zc_partial,
+		zc_copied);
+	return ret < 0 ? -1 : 0;
 }
 
 static int recv_loop(int fd)
@@ -308,7 +540,9 @@ static int recv_loop(int fd)
 	gettimeofday(&start, NULL);
 	getrusage(RUSAGE_SELF, &ru_s);
 
-	if (use_splice)
+	if (zerocopy)
+		ret = zerocopy_recv_loop(fd);
+	else if (use_splice)
 		ret = splice_recv_loop(fd);
 	else
 		ret = normal_recv_loop(fd);
@@ -320,6 +554,7 @@ static int recv_loop(int fd)
 	rt = mtime_since_now(&start);
 
 	printf("usr=%lu, sys=%lu, real=%lu\n", ut, st, rt);
+	printf("msgs=%lu, crc_errors=%lu\n", msgs, crc_errors);
 
 	return ret;
 }
@@ -334,11 +569,13 @@ int main(int argc, char *argv[])
 		return usage(argv[0]);
 
 	index = parse_options(argc, argv);
-	if (index == -1 || index + 1 > argc)
+	if (index == -1 || (conn_fd < 0 && index + 1 > argc))
 		return usage(argv[0]);
 
 	printf("recv: msg=%ukb, ", msg_size >> 10);
-	if (use_splice) {
+	if (zerocopy)
+		printf("zerocopy recv");
+	else if (use_splice) {
 		printf("splice() ");
 		if (splice_move)
 			printf("zero map ");
@@ -348,6 +585,12 @@ int main(int argc, char *argv[])
 		printf("recv()");
 	printf("\n");
 
+	/*
+	 * Already connected, eg by the loopback driver
+	 */
+	if (conn_fd >= 0)
+		return recv_loop(conn_fd);
+
 	port = atoi(argv[index]);
 
 	fd = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
@@ -363,6 +606,12 @@ int main(int argc, char *argv[])
 	addr.sin_addr.s_addr = htonl(INADDR_ANY);
 	addr.sin_port = htons(port);
 
+	/*
+	 * Advertised to the sender, so set before the connection exists
+	 */
+	if (mss && setsockopt(fd, IPPROTO_TCP, TCP_MAXSEG, &mss, sizeof(mss)) < 0)
+		return error("TCP_MAXSEG");
+
 	if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0)
 		return error("bind");
 	if (listen(fd, 1) < 0)
@@ -16,6 +16,7 @@
 #include <errno.h>
 
 static int loop;
+static int conn_fd = -1;
 
 static inline int error(const char *n)
 {
@@ -25,7 +26,7 @@ static inline int error(const char *n)
 
 static int usage(char *name)
 {
-	fprintf(stderr, "%s: file target port\n", name);
+	fprintf(stderr, "%s: [-l(oop)] [-f connected fd] file [target port]\n", name);
 	return 1;
 }
 
@@ -57,39 +58,48 @@ static int do_sf(int filefd, int sockfd)
 
 static int parse_options(int argc, char *argv[])
 {
-	int c, index = 1;
+	int c;
 
-	while ((c = getopt(argc, argv, "l")) != -1) {
+	while ((c = getopt(argc, argv, "lf:")) != -1) {
 		switch (c) {
 		case 'l':
 			loop = 1;
-			index++;
+			break;
+		case 'f':
+			conn_fd = atoi(optarg);
 			break;
 		default:
 			return -1;
 		}
 	}
 
-	return index;
+	return optind;
 }
 
 int main(int argc, char *argv[])
 {
 	struct sockaddr_in addr;
 	unsigned short port;
-	int fd, filefd, index;
+	int fd, filefd, index, ret;
 
-	if (argc < 4)
+	if (argc < 3)
 		return usage(argv[0]);
 
 	index = parse_options(argc, argv);
-	if (index == -1 || index + 1 > argc)
+	if (index == -1 || index + (conn_fd < 0 ? 3 : 1) > argc)
 		return usage(argv[0]);
 
 	filefd = open(argv[index], O_RDONLY);
 	if (filefd < 0)
 		return error("open input file");
 
+	/*
+	 * Already connected, eg by the loopback driver
+	 */
+	fd = conn_fd;
+	if (fd >= 0)
+		goto send;
+
 	port = atoi(argv[index + 2]);
 
 	memset(&addr, 0, sizeof(addr));
@@ -114,12 +124,14 @@ int main(int argc, char *argv[])
 	if (connect(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0)
 		return error("connect");
 
+send:
 	do {
-		if (do_sf(filefd, fd))
+		ret = do_sf(filefd, fd);
+		if (ret)
 			break;
 	} while (loop);
 
 	close(fd);
 	close(filefd);
-	return 0;
+	return ret ? 1 : 0;
 }
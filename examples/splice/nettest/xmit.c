@@ -12,6 +12,8 @@
 #include <errno.h>
 #include <sys/time.h>
 #include <sys/resource.h>
+#include <sys/mman.h>
+#include <pthread.h>
 
 #include "../splice.h"
 #include "crc32.h"
@@ -22,7 +24,11 @@ static int cur_buf, nr_bufs;
 
 static unsigned int msg_size = 4096;
 static int use_splice = 1;
+static int splice_flags;
 static unsigned long packets = -1;
+static int conn_fd = -1;
+static int pipelined;
+static int ring_size = 8;
 
 static unsigned long seed = 0x9e370001UL;
 
@@ -60,34 +66,43 @@ unsigned long mtime_since_now(struct timeval *s)
 
 static int usage(char *name)
 {
-	fprintf(stderr, "%s: [-s(ize)] [-p(ackets to send)] [-n(ormal send())] target port\n", name);
+	fprintf(stderr, "%s: [-s(ize)] [-p(ackets to send)] [-n(ormal send())] [-m(ove)] [-P(ipelined)] [-k ring buffers] [-f connected fd] target port\n", name);
 	return 1;
 }
 
 static int parse_options(int argc, char *argv[])
 {
-	int c, index = 1;
+	int c;
 
-	while ((c = getopt(argc, argv, "s:np:")) != -1) {
+	while ((c = getopt(argc, argv, "s:np:mf:Pk:")) != -1) {
 		switch (c) {
 		case 's':
 			msg_size = atoi(optarg);
-			index++;
 			break;
 		case 'n':
 			use_splice = 0;
-			index++;
 			break;
 		case 'p':
 			packets = atoi(optarg);
-			index++;
+			break;
+		case 'm':
+			splice_flags = SPLICE_F_MOVE;
+			break;
+		case 'f':
+			conn_fd = atoi(optarg);
+			break;
+		case 'P':
+			pipelined = 1;
+			break;
+		case 'k':
+			ring_size = atoi(optarg);
 			break;
 		default:
 			return -1;
 		}
 	}
 
-	return index;
+	return optind;
 }
 
 static void fill_buf(struct msg *m, unsigned int len)
@@ -116,7 +131,7 @@ static void fill_buf(struct msg *m, unsigned int len)
 static int splice_out(int sockfd, int pipefd, unsigned int len)
 {
 	while (len) {
-		int ret = ssplice(pipefd, NULL, sockfd, NULL, len, 0);
+		int ret = ssplice(pipefd, NULL, sockfd, NULL, len, splice_flags);
 
 		if (ret < 0)
 			return error("splice to network");
@@ -129,7 +144,8 @@ static int splice_out(int sockfd, int pipefd, unsigned int len)
 	return len;
 }
 
-static int vmsplice_in(void *buf, int pipefd, unsigned int len)
+static int vmsplice_in(void *buf, int pipefd, unsigned int len,
+		       unsigned int flags)
 {
 	struct iovec iov = {
 		.iov_base = buf,
@@ -137,7 +153,7 @@ static int vmsplice_in(void *buf, int pipefd, unsigned int len)
 	};
 
 	while (len) {
-		int ret = svmsplice(pipefd, &iov, 1, 0);
+		int ret = svmsplice(pipefd, &iov, 1, flags);
 
 		if (ret < 0)
 			return error("vmsplice");
@@ -180,10 +196,13 @@ static void free_buffers(void)
 	free(buffers);
 }
 
+/*
+ * The send loops return -1 if not every message could be sent
+ */
 static int splice_send_loop(int fd)
 {
 	struct msg *m = NULL;
-	int pipes[2];
+	int pipes[2], ret = 0;
 
 	if (pipe(pipes) < 0)
 		return error("pipe");
@@ -203,22 +222,185 @@ static int splice_send_loop(int fd)
 		/*
 		 * map data to our pipe
 		 */
-		if (vmsplice_in(m, pipes[1], msg_size))
+		if (vmsplice_in(m, pipes[1], msg_size, 0)) {
+			ret = -1;
 			break;
+		}
 
 		/*
 		 * then transmit pipe to network
 		 */
-		if (splice_out(fd, pipes[0], msg_size))
+		if (splice_out(fd, pipes[0], msg_size)) {
+			ret = -1;
 			break;
+		}
 	}
 
 	free_buffers();
 	close(pipes[0]);
 	close(pipes[1]);
+	return ret;
+}
+
+/*
+ * Pipelined mode. A producer thread fills and checksums a ring of buffers
+ * while this thread gifts them to the pipe and splices them out, so the
+ * two overlap and the slower one sets the pace.
+ *
+ * Once a buffer has been spliced out its pages may still sit in the socket
+ * or the receiver's queue, and there's no telling when the kernel lets go
+ * of them. So rather than waiting, the buffer is remapped with fresh pages:
+ * the gifted ones now belong to the kernel alone and are freed when it is
+ * done with them, and the producer can fill the slot right away.
+ */
+static struct msg **ring;
+static unsigned int ring_len;
+static unsigned long ring_filled, ring_sent;
+static int ring_stop;
+static unsigned long producer_waits, sender_waits;
+
+static pthread_mutex_t ring_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t ring_fill_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t ring_free_cond = PTHREAD_COND_INITIALIZER;
+
+static void *map_buf(void *addr)
+{
+	int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+
+	if (addr)
+		flags |= MAP_FIXED;
+
+	return mmap(addr, ring_len, PROT_READ | PROT_WRITE, flags, -1, 0);
+}
+
+static int setup_ring(void)
+{
+	int i;
+
+	ring_len = (msg_size + 4095) & ~4095U;
+	ring = malloc(sizeof(struct msg *) * ring_size);
+	if (!ring)
+		return error("malloc");
+
+	for (i = 0; i < ring_size; i++) {
+		ring[i] = map_buf(NULL);
+		if (ring[i] == MAP_FAILED)
+			return error("mmap");
+	}
+
 	return 0;
 }
 
+static void free_ring(void)
+{
+	int i;
+
+	for (i = 0; i < ring_size; i++)
+		munmap(ring[i], ring_len);
+
+	free(ring);
+}
+
+static void *producer_fn(void *data)
+{
+	unsigned long i;
+
+	for (i = 0; i < packets; i++) {
+		pthread_mutex_lock(&ring_lock);
+		while (ring_filled - ring_sent == ring_size && !ring_stop) {
+			producer_waits++;
+			pthread_cond_wait(&ring_free_cond, &ring_lock);
+		}
+		if (ring_stop) {
+			pthread_mutex_unlock(&ring_lock);
+			break;
+		}
+		pthread_mutex_unlock(&ring_lock);
+
+		/*
+		 * fill with random data and crc sum it
+		 */
+		fill_buf(ring[i % ring_size], msg_size);
+
+		pthread_mutex_lock(&ring_lock);
+		ring_filled++;
+		pthread_cond_signal(&ring_fill_cond);
+		pthread_mutex_unlock(&ring_lock);
+	}
+
+	return NULL;
+}
+
+static int pipelined_send_loop(int fd)
+{
+	pthread_t producer;
+	unsigned long i;
+	int pipes[2], ret = 0;
+
+	if (ring_size < 2)
+		ring_size = 2;
+
+	if (pipe(pipes) < 0)
+		return error("pipe");
+	if (msg_size > SPLICE_SIZE)
+		grow_pipe(pipes[1], msg_size);
+
+	if (setup_ring())
+		return -1;
+
+	if (pthread_create(&producer, NULL, producer_fn, NULL)) {
+		free_ring();
+		return error("pthread_create");
+	}
+
+	for (i = 0; i < packets; i++) {
+		struct msg *m = ring[i % ring_size];
+
+		pthread_mutex_lock(&ring_lock);
+		while (ring_filled == i) {
+			sender_waits++;
+			pthread_cond_wait(&ring_fill_cond, &ring_lock);
+		}
+		pthread_mutex_unlock(&ring_lock);
+
+		/*
+		 * gift the pages to our pipe, then transmit pipe to network
+		 */
+		if (vmsplice_in(m, pipes[1], msg_size, SPLICE_F_GIFT) ||
+		    splice_out(fd, pipes[0], msg_size)) {
+			ret = -1;
+			break;
+		}
+
+		/*
+		 * the old pages are the kernel's now, give the slot new ones
+		 */
+		if (map_buf(m) == MAP_FAILED) {
+			ret = error("mmap");
+			break;
+		}
+
+		pthread_mutex_lock(&ring_lock);
+		ring_sent++;
+		pthread_cond_signal(&ring_free_cond);
+		pthread_mutex_unlock(&ring_lock);
+	}
+
+	pthread_mutex_lock(&ring_lock);
+	ring_stop = 1;
+	pthread_cond_signal(&ring_free_cond);
+	pthread_mutex_unlock(&ring_lock);
+	pthread_join(producer, NULL);
+
+	printf("pipelined: %d buffers, producer waited %lu times, sender %lu times\n",
+		ring_size, producer_waits, sender_waits);
+
+	free_ring();
+	close(pipes[0]);
+	close(pipes[1]);
+	return ret;
+}
+
 static int do_send(int fd, void *buf, unsigned int len)
 {
 	while (len) {
@@ -239,6 +421,7 @@ static int do_send(int fd, void *buf, unsigned int len)
 static int normal_send_loop(int fd)
 {
 	struct msg *m;
+	int ret = 0;
 
 	m = malloc(msg_size);
 
@@ -248,12 +431,14 @@ static int normal_send_loop(int fd)
 		 */
 		fill_buf(m, msg_size);
 
-		if (do_send(fd, m, msg_size))
+		if (do_send(fd, m, msg_size)) {
+			ret = -1;
 			break;
+		}
 	}
 
 	free(m);
-	return 0;
+	return ret;
 }
 
 static int send_loop(int fd)
@@ -266,7 +451,9 @@ static int send_loop(int fd)
 	gettimeofday(&start, NULL);
 	getrusage(RUSAGE_SELF, &ru_s);
 
-	if (use_splice)
+	if (use_splice && pipelined)
+		ret = pipelined_send_loop(fd);
+	else if (use_splice)
 		ret = splice_send_loop(fd);
 	else
 		ret = normal_send_loop(fd);
@@ -292,9 +479,23 @@ int main(int argc, char *argv[])
 		return usage(argv[0]);
 
 	index = parse_options(argc, argv);
-	if (index == -1 || index + 1 > argc)
+	if (index == -1 || (conn_fd < 0 && index + 2 > argc))
 		return usage(argv[0]);
 
+	printf("xmit: msg=%ukb, ", msg_size >> 10);
+	if (use_splice)
+		printf("%svmsplice() -> splice()%s\n",
+			pipelined ? "pipelined " : "",
+			splice_flags ? " move" : "");
+	else
+		printf("send()\n");
+
+	/*
+	 * Already connected, eg by the loopback driver
+	 */
+	if (conn_fd >= 0)
+		return send_loop(conn_fd);
+
 	port = atoi(argv[index + 1]);
 
 	memset(&addr, 0, sizeof(addr));
@@ -310,12 +511,6 @@ int main(int argc, char *argv[])
 		memcpy(&addr.sin_addr, hent->h_addr, 4);
 	}
 
-	printf("xmit: msg=%ukb, ", msg_size >> 10);
-	if (use_splice)
-		printf("vmsplice() -> splice()\n");
-	else
-		printf("send()\n");
-
 	printf("Connecting to %s/%d\n", argv[index], port);
 
 	fd = socket(AF_INET, SOCK_STREAM, 0);
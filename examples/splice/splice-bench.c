@@ -17,8 +17,34 @@
 #include <arpa/inet.h>
 #include <netdb.h>
 #include <sched.h>
+#include <dirent.h>
+#include <sys/resource.h>
 
 #include "splice.h"
+#include "bench.h"
+
+enum {
+	M_SPLICE,
+	M_MMAP,
+	M_RW,
+	M_NR,
+};
+
+static const char *method_names[] = { "splice", "mmap", "rw" };
+
+/*
+ * Filled in by each client, in memory shared with the parent so a sweep
+ * can add up the clients of a round. The method runs in a child of the
+ * client, which reports bytes and msecs of its timed loop, and the client
+ * adds what the child cost from getrusage(RUSAGE_CHILDREN).
+ */
+struct client_result {
+	unsigned long long bytes;
+	unsigned long msecs;
+	struct bench_stat stat;
+};
+
+#define MAX_SWEEP	16
 
 static int nr_clients = 8;
 static int net_port = 8888;
@@ -32,8 +58,22 @@ static unsigned int max_client_run = 15;
 static int run_rw = 1;
 static int run_splice = 1;
 static int run_mmap = 1;
+static int pipe_size;
+static int bind_numa;
+static int sweep;
+
+static int sweep_clients[MAX_SWEEP], nr_sweep_clients;
+static int sweep_chunks[MAX_SWEEP], nr_sweep_chunks;
+static int sweep_pipes[MAX_SWEEP], nr_sweep_pipes;
 
 static int nr_cpus;
+static struct client_result *results;
+
+/*
+ * CPUs of each NUMA node, for -A
+ */
+static int *node_cpus[64], node_nr_cpus[64];
+static int nr_nodes;
 
 static int usage(char *name)
 {
@@ -47,46 +87,71 @@ static int usage(char *name)
 	fprintf(stderr, "\t[-b] (splice chunk size)\n");
 	fprintf(stderr, "\t[-t] (max client runtime in seconds)\n");
 	fprintf(stderr, "\t[-c] (clients to run (rw/mmap/splice)\n");
+	fprintf(stderr, "\t[-P] (pipe size, F_SETPIPE_SZ)\n");
+	fprintf(stderr, "\t[-A] (pin each server/client pair to one NUMA node)\n");
+	fprintf(stderr, "\t[-S] (sweep -N, -B and -P, print a CSV matrix)\n");
+	fprintf(stderr, "\t[-N] (client counts to sweep, eg 1,2,4)\n");
+	fprintf(stderr, "\t[-B] (chunk sizes to sweep, eg 4k,64k,1m)\n");
+	fprintf(stderr, "\tsizes take k and m suffixes, sweeps need filename0..N-1\n");
 	return 1;
 }
 
+static int parse_size(const char *str)
+{
+	char *end;
+	long val = strtol(str, &end, 10);
+
+	if (*end == 'k' || *end == 'K')
+		val <<= 10;
+	else if (*end == 'm' || *end == 'M')
+		val <<= 20;
+
+	return val;
+}
+
+/*
+ * Comma separated list of sizes, returns the number of entries
+ */
+static int parse_list(char *str, int *vals)
+{
+	char *p;
+	int nr = 0;
+
+	for (p = strtok(str, ","); p && nr < MAX_SWEEP; p = strtok(NULL, ","))
+		vals[nr++] = parse_size(p);
+
+	return nr;
+}
+
 static int parse_options(int argc, char *argv[])
 {
-	int c, index = 1;
+	int c;
 
-	while ((c = getopt(argc, argv, "n:p:l:azsb:t:c:")) != -1) {
+	while ((c = getopt(argc, argv, "n:p:l:azsb:t:c:P:ASN:B:")) != -1) {
 		switch (c) {
 		case 'n':
 			nr_clients = atoi(optarg);
-			index++;
 			break;
 		case 'p':
 			net_port = atoi(optarg);
-			index++;
 			break;
 		case 'l':
 			client_loops = atoi(optarg);
-			index++;
 			break;
 		case 'a':
 			bind_cpu = 1;
-			index++;
 			break;
 		case 'z':
 			write_to_null = 1;
-			index++;
 			break;
 		case 's':
 			same_file = 1;
-			index++;
 			break;
 		case 'b':
-			splice_size = atoi(optarg);
-			index++;
+			splice_size = parse_size(optarg);
 			break;
 		case 't':
 			max_client_run = atoi(optarg);
-			index++;
 			break;
 		case 'c':
 			if (!strstr(optarg, "rw"))
@@ -95,17 +160,108 @@ static int parse_options(int argc, char *argv[])
 				run_splice = 0;
 			if (!strstr(optarg, "mmap"))
 				run_mmap = 0;
-			index++;
+			break;
+		case 'P':
+			nr_sweep_pipes = parse_list(optarg, sweep_pipes);
+			pipe_size = sweep_pipes[0];
+			break;
+		case 'A':
+			bind_cpu = bind_numa = 1;
+			break;
+		case 'S':
+			sweep = 1;
+			break;
+		case 'N':
+			nr_sweep_clients = parse_list(optarg, sweep_clients);
+			break;
+		case 'B':
+			nr_sweep_chunks = parse_list(optarg, sweep_chunks);
 			break;
 		default:
 			return -1;
 		}
 	}
 
-	return index;
+	return optind;
+}
+
+/*
+ * Parse a sysfs cpulist like 0-3,8-11
+ */
+static int parse_cpulist(char *str, int *cpus)
+{
+	char *p;
+	int nr = 0;
+
+	for (p = strtok(str, ",\n"); p; p = strtok(NULL, ",\n")) {
+		int first, last;
+
+		if (sscanf(p, "%d-%d", &first, &last) != 2)
+			last = first = atoi(p);
+		while (first <= last && nr < nr_cpus)
+			cpus[nr++] = first++;
+	}
+
+	return nr;
+}
+
+/*
+ * Find the CPUs of every NUMA node, everything is one node if sysfs does
+ * not tell
+ */
+static void init_numa(void)
+{
+	struct dirent *dent;
+	DIR *dir;
+	int i;
+
+	dir = opendir("/sys/devices/system/node");
+	while (dir && (dent = readdir(dir)) != NULL && nr_nodes < 64) {
+		char path[PATH_MAX], buf[4096];
+		FILE *f;
+		int node, nr;
+
+		if (sscanf(dent->d_name, "node%d", &node) != 1)
+			continue;
+
+		sprintf(path, "/sys/devices/system/node/%s/cpulist", dent->d_name);
+		f = fopen(path, "r");
+		if (!f)
+			continue;
+		if (!fgets(buf, sizeof(buf), f)) {
+			fclose(f);
+			continue;
+		}
+		fclose(f);
+
+		node_cpus[nr_nodes] = malloc(nr_cpus * sizeof(int));
+		nr = parse_cpulist(buf, node_cpus[nr_nodes]);
+		/*
+		 * Memory only nodes have no CPUs to run on
+		 */
+		if (nr)
+			node_nr_cpus[nr_nodes++] = nr;
+		else
+			free(node_cpus[nr_nodes]);
+	}
+	if (dir)
+		closedir(dir);
+
+	if (!nr_nodes) {
+		node_cpus[0] = malloc(nr_cpus * sizeof(int));
+		for (i = 0; i < nr_cpus; i++)
+			node_cpus[0][i] = i;
+		node_nr_cpus[0] = nr_cpus;
+		nr_nodes = 1;
+	}
 }
 
-static int bind_to_cpu(int index)
+/*
+ * Pin a server or client. With -A pair index goes to node index % nr_nodes,
+ * its server and client on neighbouring CPUs of that node, so the socket
+ * buffers and the page cache copies stay node local.
+ */
+static int bind_to_cpu(int index, int is_server)
 {
 	cpu_set_t cpu_mask;
 	pid_t pid;
@@ -114,7 +270,13 @@ static int bind_to_cpu(int index)
 	if (!bind_cpu || nr_cpus == 1)
 		return 0;
 
-	cpu = index % nr_cpus;
+	if (bind_numa) {
+		int node = index % nr_nodes;
+		int slot = 2 * (index / nr_nodes) + is_server;
+
+		cpu = node_cpus[node][slot % node_nr_cpus[node]];
+	} else
+		cpu = index % nr_cpus;
 
 	CPU_ZERO(&cpu_mask);
 	CPU_SET((cpu), &cpu_mask);
@@ -160,7 +322,7 @@ static int server(int offset)
 	unsigned int len;
 	int sk, opt;
 
-	bind_to_cpu(offset);
+	bind_to_cpu(offset, 1);
 	nice(-20);
 
 	sk = socket(PF_INET, SOCK_STREAM, 0);
@@ -212,6 +374,18 @@ static unsigned long mtime_since_now(struct timeval *s)
 	return mtime_since(s, &t);
 }
 
+/*
+ * Record what a client method moved in its timed loop
+ */
+static void client_done(int offset, int method, struct timeval *start,
+			off_t file_size, int loops)
+{
+	struct client_result *r = &results[offset * M_NR + method];
+
+	r->bytes = (unsigned long long) file_size * loops;
+	r->msecs = mtime_since_now(start) ? : 1;
+}
+
 static int client_rw(int out_fd, int file_fd, int offset)
 {
 	int loops = client_loops;
@@ -219,7 +393,6 @@ static int client_rw(int out_fd, int file_fd, int offset)
 	struct stat sb;
 	char *buf;
 	unsigned long long size;
-	unsigned long msecs;
 
 	if (fstat(file_fd, &sb) < 0)
 		return error("fstat");
@@ -256,10 +429,7 @@ again:
 		goto again;
 
 	free(buf);
-	size = sb.st_size >> 10;
-	size *= (client_loops - loops);
-	msecs = mtime_since_now(&start);
-	fprintf(stdout, "Client%d (rw): %Lu MiB/sec (%LuMiB in %lu msecs)\n", offset, size / (unsigned long long) msecs, size >> 10, msecs);
+	client_done(offset, M_RW, &start, sb.st_size, client_loops - loops);
 	return 0;
 }
 
@@ -270,7 +440,6 @@ static int client_mmap(int out_fd, int file_fd, int offset)
 	struct stat sb;
 	void *mmap_area, *buf;
 	unsigned long long size;
-	unsigned long msecs;
 
 	if (fstat(file_fd, &sb) < 0)
 		return error("fstat");
@@ -302,10 +471,7 @@ again:
 	if ((mtime_since_now(&start) < max_client_run * 1000) && loops)
 		goto again;
 
-	size = sb.st_size >> 10;
-	size *= (client_loops - loops);
-	msecs = mtime_since_now(&start);
-	fprintf(stdout, "Client%d (mmap): %Lu MiB/sec (%LuMiB in %lu msecs)\n", offset, size / (unsigned long long) msecs, size >> 10, msecs);
+	client_done(offset, M_MMAP, &start, sb.st_size, client_loops - loops);
 	munmap(mmap_area, sb.st_size);
 	return 0;
 
@@ -315,7 +481,6 @@ static int client_splice_loop(int out_fd, int fd, int *pfd, int offset)
 {
 	struct timeval start;
 	unsigned long long size;
-	unsigned long msecs;
 	struct stat sb;
 	int loops = client_loops;
 	loff_t off;
@@ -351,10 +516,7 @@ again:
 	if ((mtime_since_now(&start) < max_client_run * 1000) && loops)
 		goto again;
 
-	size = sb.st_size >> 10;
-	size *= (client_loops - loops);
-	msecs = mtime_since_now(&start);
-	fprintf(stdout, "Client%d (splice): %Lu MiB/sec (%LuMiB in %lu msecs)\n", offset, size / (unsigned long long) msecs, size >> 10, msecs);
+	client_done(offset, M_SPLICE, &start, sb.st_size, client_loops - loops);
 	return 0;
 }
 
@@ -364,32 +526,66 @@ static int client_splice(int out_fd, int file_fd, int offset)
 
 	if (pipe(pfd) < 0)
 		return error("pipe");
-	
+	if (pipe_size)
+		grow_pipe(pfd[1], pipe_size);
+
 	ret = client_splice_loop(out_fd, file_fd, pfd, offset);
 	close(pfd[0]);
 	close(pfd[1]);
 	return ret;
 }
 
+static int (*client_fns[M_NR])(int, int, int) = {
+	client_splice, client_mmap, client_rw,
+};
+
+/*
+ * Run each method in a child of its own, so RUSAGE_CHILDREN around it is
+ * exactly what that method cost
+ */
 static int do_client(int out_fd, int file_fd, int offset)
 {
-	int ret;
+	int run[M_NR] = { run_splice, run_mmap, run_rw };
+	int m;
 
-	if (run_splice) {
-		ret = client_splice(out_fd, file_fd, offset);
-		if (ret)
-			return ret;
-	}
-	if (run_mmap) {
-		ret = client_mmap(out_fd, file_fd, offset);
-		if (ret)
-			return ret;
-	}
-	if (run_rw) {
-		ret = client_rw(out_fd, file_fd, offset);
-		if (ret)
-			return ret;
+	for (m = 0; m < M_NR; m++) {
+		struct client_result *r = &results[offset * M_NR + m];
+		struct bench_mark mark;
+		unsigned long long size;
+		int status;
+		pid_t pid;
+
+		if (!run[m])
+			continue;
+
+		fflush(stdout);
+		bench_start(&mark, RUSAGE_CHILDREN);
+		pid = fork();
+		if (pid < 0)
+			return error("fork");
+		else if (!pid)
+			exit(client_fns[m](out_fd, file_fd, offset) ? 1 : 0);
+
+		if (waitpid(pid, &status, 0) < 0)
+			return error("waitpid");
+		if (!WIFEXITED(status) || WEXITSTATUS(status))
+			return -1;
+
+		/*
+		 * CPU covers the whole child, the rate only its timed loop
+		 */
+		bench_stop(&r->stat, &mark, RUSAGE_CHILDREN);
+		r->stat.bytes = r->bytes;
+		r->stat.wall = r->msecs / 1000.0;
+
+		if (sweep)
+			continue;
+
+		size = r->bytes >> 10;
+		fprintf(stdout, "Client%d (%s): %Lu MiB/sec (%LuMiB in %lu msecs)\n", offset, method_names[m], size / (unsigned long long) r->msecs, size >> 10, r->msecs);
+		bench_print(stdout, "\t", &r->stat);
 	}
+
 	return 0;
 }
 
@@ -419,7 +615,7 @@ static int client(int offset)
 	int file_fd, out_fd;
 	char fname[64];
 
-	bind_to_cpu(offset);
+	bind_to_cpu(offset, 0);
 	nice(-20);
 
 	if (!write_to_null)
@@ -438,10 +634,150 @@ static int client(int offset)
 	return do_client(out_fd, file_fd, offset);
 }
 
+/*
+ * Run nr clients against the servers and wait for them
+ */
+static void run_clients(pid_t *cpids, int nr)
+{
+	int i;
+
+	memset(results, 0, nr * M_NR * sizeof(*results));
+	fflush(stdout);
+
+	/*
+	 * fork clients
+	 */
+	for (i = 0; i < nr; i++) {
+		pid_t pid = fork();
+
+		if (pid)
+			cpids[i] = pid;
+		else {
+			client(i);
+			cpids[i] = 0;
+			exit(0);
+		}
+	}
+
+	/*
+	 * wait for clients to exit
+	 */
+	if (!sweep)
+		fprintf(stdout, "Waiting for clients\n");
+	for (i = 0; i < nr; i++) {
+		if (cpids[i]) {
+			waitpid(cpids[i], NULL, 0);
+			cpids[i] = 0;
+		}
+	}
+}
+
+/*
+ * Add up what the clients of a round did with method m
+ */
+static void method_total(int nr, int m, struct bench_stat *sum)
+{
+	int i;
+
+	memset(sum, 0, sizeof(*sum));
+	for (i = 0; i < nr; i++)
+		bench_add(sum, &results[i * M_NR + m].stat);
+}
+
+static void print_totals(int nr)
+{
+	int run[M_NR] = { run_splice, run_mmap, run_rw };
+	struct bench_stat sum;
+	int m;
+
+	for (m = 0; m < M_NR; m++) {
+		if (!run[m])
+			continue;
+
+		method_total(nr, m, &sum);
+		fprintf(stdout, "Total (%s): %.2f MiB/sec\n", method_names[m],
+			bench_mib_s(&sum));
+		bench_print(stdout, "\t", &sum);
+	}
+}
+
+/*
+ * The pipe size F_SETPIPE_SZ really gives for size, 0 is the default pipe
+ */
+static int real_pipe_size(int size)
+{
+	int pfd[2], ret = SPLICE_SIZE;
+
+	if (pipe(pfd) < 0)
+		return error("pipe");
+
+	if (size)
+		ret = grow_pipe(pfd[1], size);
+	else if (fcntl(pfd[1], F_GETPIPE_SZ) > 0)
+		ret = fcntl(pfd[1], F_GETPIPE_SZ);
+
+	close(pfd[0]);
+	close(pfd[1]);
+	return ret;
+}
+
+/*
+ * Run every client count, chunk size and pipe size combination, one method
+ * at a time, and print a CSV row per combination. The pipe size only
+ * matters to splice, so rw and mmap are run once per chunk size.
+ */
+static void sweep_run(pid_t *cpids)
+{
+	int run[M_NR] = { run_splice, run_mmap, run_rw };
+	struct bench_stat stats[M_NR];
+	int c, b, p, m;
+
+	fprintf(stdout, "clients,chunk_size,pipe_size");
+	for (m = 0; m < M_NR; m++)
+		if (run[m])
+			fprintf(stdout, ",%s_mib_s,%s_cpu_pct,%s_mib_per_cpu_s",
+				method_names[m], method_names[m], method_names[m]);
+	fprintf(stdout, "\n");
+
+	for (c = 0; c < nr_sweep_clients; c++) {
+		int nr = sweep_clients[c];
+
+		for (b = 0; b < nr_sweep_chunks; b++) {
+			splice_size = sweep_chunks[b];
+
+			for (p = 0; p < nr_sweep_pipes; p++) {
+				pipe_size = sweep_pipes[p];
+
+				for (m = 0; m < M_NR; m++) {
+					if (!run[m] || (p && m != M_SPLICE))
+						continue;
+
+					run_splice = m == M_SPLICE;
+					run_mmap = m == M_MMAP;
+					run_rw = m == M_RW;
+					run_clients(cpids, nr);
+					method_total(nr, m, &stats[m]);
+				}
+
+				fprintf(stdout, "%d,%d,%d", nr, splice_size,
+					real_pipe_size(pipe_size));
+				for (m = 0; m < M_NR; m++)
+					if (run[m])
+						fprintf(stdout, ",%.2f,%.1f,%.1f",
+							bench_mib_s(&stats[m]),
+							bench_cpu_pct(&stats[m]),
+							bench_mib_per_cpu_s(&stats[m]));
+				fprintf(stdout, "\n");
+				fflush(stdout);
+			}
+		}
+	}
+}
+
 int main(int argc, char *argv[])
 {
 	pid_t *spids, *cpids;
-	int i, index;
+	int i, index, max_clients;
 
 	index = parse_options(argc, argv);
 	if (index < 0)
@@ -450,20 +786,53 @@ int main(int argc, char *argv[])
 	if (index < argc)
 		filename = argv[index];
 
-	spids = malloc(nr_clients * sizeof(pid_t));
-	cpids = malloc(nr_clients * sizeof(pid_t));
-	memset(spids, 0, nr_clients * sizeof(pid_t));
-	memset(cpids, 0, nr_clients * sizeof(pid_t));
-
 	nr_cpus = sysconf(_SC_NPROCESSORS_ONLN);
 	if (nr_cpus < 0)
 		return error("_SC_NPROCESSORS_ONLN");
 
+	if (bind_numa)
+		init_numa();
+
+	/*
+	 * Sweep defaults: clients doubling up to -n, 16k to 256k chunks and
+	 * the default pipe up to 1MiB
+	 */
+	if (sweep) {
+		if (!nr_sweep_clients)
+			for (i = 1; i <= nr_clients && nr_sweep_clients < MAX_SWEEP; i <<= 1)
+				sweep_clients[nr_sweep_clients++] = i;
+		if (!nr_sweep_chunks) {
+			sweep_chunks[nr_sweep_chunks++] = 16*1024;
+			sweep_chunks[nr_sweep_chunks++] = 64*1024;
+			sweep_chunks[nr_sweep_chunks++] = 256*1024;
+		}
+		if (!nr_sweep_pipes) {
+			sweep_pipes[nr_sweep_pipes++] = 0;
+			sweep_pipes[nr_sweep_pipes++] = 256*1024;
+			sweep_pipes[nr_sweep_pipes++] = 1024*1024;
+		}
+	}
+
+	max_clients = nr_clients;
+	for (i = 0; i < nr_sweep_clients; i++)
+		max_clients = max(max_clients, sweep_clients[i]);
+
+	spids = malloc(max_clients * sizeof(pid_t));
+	cpids = malloc(max_clients * sizeof(pid_t));
+	memset(spids, 0, max_clients * sizeof(pid_t));
+	memset(cpids, 0, max_clients * sizeof(pid_t));
+
+	results = mmap(NULL, max_clients * M_NR * sizeof(*results),
+		       PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (results == MAP_FAILED)
+		return error("mmap");
+
 	/*
-	 * fork servers
+	 * fork servers, they take new connections for every round
 	 */
+	fflush(stdout);
 	if (!write_to_null) {
-		for (i = 0; i < nr_clients; i++) {
+		for (i = 0; i < max_clients; i++) {
 			pid_t pid = fork();
 
 			if (pid)
@@ -477,36 +846,17 @@ int main(int argc, char *argv[])
 		sleep(1); /* should have servers started now */
 	}
 
-	/*
-	 * fork clients
-	 */
-	for (i = 0; i < nr_clients; i++) {
-		pid_t pid = fork();
-
-		if (pid)
-			cpids[i] = pid;
-		else {
-			client(i);
-			cpids[i] = 0;
-			exit(0);
-		}
-	}
-
-	/*
-	 * wait for clients to exit
-	 */
-	fprintf(stdout, "Waiting for clients\n");
-	for (i = 0; i < nr_clients; i++) {
-		if (cpids[i]) {
-			waitpid(cpids[i], NULL, 0);
-			cpids[i] = 0;
-		}
+	if (sweep)
+		sweep_run(cpids);
+	else {
+		run_clients(cpids, nr_clients);
+		print_totals(nr_clients);
 	}
 
 	/*
 	 * then kill servers
 	 */
-	for (i = 0; i < nr_clients; i++) {
+	for (i = 0; i < max_clients; i++) {
 		if (spids[i]) {
 			kill(spids[i], SIGKILL);
 			waitpid(spids[i], NULL, 0);
@@ -4,45 +4,259 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <string.h>
 #include <fcntl.h>
 #include <errno.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/sendfile.h>
+#include <sys/wait.h>
 
 #include "splice.h"
 
-#define BS	SPLICE_SIZE
+/*
+ * Ways to copy, from fastest to the one that always works
+ */
+enum {
+	CP_AUTO,
+	CP_COPY_FILE_RANGE,
+	CP_SENDFILE,
+	CP_SPLICE,
+};
+
+static const char *cp_names[] = {
+	"auto", "copy_file_range", "sendfile", "splice",
+};
+
+/*
+ * copy_file_range and sendfile take large chunks, stay below 2GiB
+ */
+#define CP_CHUNK	(1024*1024*1024)
+
+/*
+ * Ranges copied by parallel workers start on this boundary
+ */
+#define CP_ALIGN	(1024*1024)
 
 static int splice_flags;
+static int pipe_size = -1;
+static int cp_method = CP_AUTO;
+static int verbose;
+static int workers = 1;
 
 static int usage(char *name)
 {
-	fprintf(stderr, "%s: [-m] in_file out_file\n", name);
+	fprintf(stderr, "%s: [-m] [-v] [-p pipe_size|max] [-s method] [-j workers] in_file out_file|-\n", name);
+	fprintf(stderr, "\tmethod: auto, copy_file_range, sendfile or splice\n");
+	fprintf(stderr, "\t-j splits the file in ranges spliced by parallel workers\n");
 	return 1;
 }
 
 static int parse_options(int argc, char *argv[])
 {
-	int c, index = 1;
+	int c, i;
 
-	while ((c = getopt(argc, argv, "m")) != -1) {
+	while ((c = getopt(argc, argv, "mvp:s:j:")) != -1) {
 		switch (c) {
 		case 'm':
 			splice_flags = SPLICE_F_MOVE;
-			index++;
+			break;
+		case 'v':
+			verbose = 1;
+			break;
+		case 'p':
+			if (!strcmp(optarg, "max"))
+				pipe_size = 0;
+			else
+				pipe_size = atoi(optarg);
+			break;
+		case 's':
+			for (i = CP_AUTO; i <= CP_SPLICE; i++)
+				if (!strcmp(optarg, cp_names[i]))
+					break;
+			if (i > CP_SPLICE)
+				return -1;
+			cp_method = i;
+			break;
+		case 'j':
+			workers = atoi(optarg);
+			if (workers < 1)
+				return -1;
 			break;
 		default:
 			return -1;
 		}
 	}
 
-	return index;
+	return optind;
+}
+
+/*
+ * file -> file can be done inside the kernel or even the file system with
+ * copy_file_range, file -> socket in one go with sendfile. Everything else
+ * goes through a pipe.
+ */
+static int pick_method(int in_fd, int out_fd)
+{
+	struct stat in_sb, out_sb;
+
+	if (fstat(in_fd, &in_sb) < 0 || fstat(out_fd, &out_sb) < 0)
+		return CP_SPLICE;
+	if (!S_ISREG(in_sb.st_mode))
+		return CP_SPLICE;
+	if (S_ISREG(out_sb.st_mode))
+		return CP_COPY_FILE_RANGE;
+	if (S_ISSOCK(out_sb.st_mode))
+		return CP_SENDFILE;
+
+	return CP_SPLICE;
+}
+
+/*
+ * The fast paths do not work for every pair of files, these errors mean
+ * try the next method
+ */
+static int can_fall_back(int err)
+{
+	return err == EXDEV || err == EINVAL || err == ENOSYS ||
+		err == EOPNOTSUPP;
+}
+
+static int cp_copy_file_range(int in_fd, int out_fd, off_t *left)
+{
+	while (*left) {
+		ssize_t ret = scopy_file_range(in_fd, NULL, out_fd, NULL,
+					       min(*left, (off_t) CP_CHUNK), 0);
+
+		if (ret < 0)
+			return -1;
+		else if (!ret)
+			break;
+
+		*left -= ret;
+	}
+
+	return 0;
+}
+
+static int cp_sendfile(int in_fd, int out_fd, off_t *left)
+{
+	while (*left) {
+		ssize_t ret = sendfile(out_fd, in_fd, NULL,
+				       min(*left, (off_t) CP_CHUNK));
+
+		if (ret < 0)
+			return -1;
+		else if (!ret)
+			break;
+
+		*left -= ret;
+	}
+
+	return 0;
+}
+
+/*
+ * Splice through a pipe, from and to the file positions if off is NULL or
+ * else from and to the same offset in both files
+ */
+static int cp_splice(int in_fd, int out_fd, loff_t *off, off_t *left)
+{
+	int pfds[2], bs = SPLICE_SIZE;
+	loff_t in_off = 0, out_off = 0;
+
+	if (off)
+		in_off = out_off = *off;
+
+	if (pipe(pfds) < 0)
+		return error("pipe");
+
+	/*
+	 * Splice in chunks of what the pipe can actually hold
+	 */
+	if (pipe_size != -1)
+		bs = grow_pipe(pfds[1], pipe_size);
+
+	while (*left) {
+		int this_len = min((off_t) bs, *left);
+		int ret = ssplice(in_fd, off ? &in_off : NULL, pfds[1], NULL,
+				  this_len, 0);
+
+		if (ret < 0)
+			return error("splice-in");
+		else if (!ret)
+			break;
+
+		*left -= ret;
+		while (ret > 0) {
+			int written = ssplice(pfds[0], NULL, out_fd,
+					      off ? &out_off : NULL, ret,
+					      splice_flags);
+			if (written <= 0)
+				return error("splice-out");
+			ret -= written;
+		}
+	}
+
+	close(pfds[1]);
+	close(pfds[0]);
+	return 0;
+}
+
+/*
+ * Split the file in aligned ranges and let a worker per range splice it with
+ * its own pipe. The output gets its final size up front, so the workers never
+ * extend it at the same time.
+ */
+static int cp_parallel(int in_fd, int out_fd, off_t *left)
+{
+	off_t size = *left, range;
+	int i, nr = 0, failed = 0, status;
+
+	range = (size + workers - 1) / workers;
+	range = (range + CP_ALIGN - 1) & ~((off_t) CP_ALIGN - 1);
+
+	if (size && fallocate(out_fd, 0, 0, size) < 0) {
+		if (errno != EOPNOTSUPP)
+			return error("fallocate");
+		if (ftruncate(out_fd, size) < 0)
+			return error("ftruncate");
+	}
+
+	for (i = 0; i < workers && (off_t) i * range < size; i++) {
+		loff_t off = (off_t) i * range;
+		off_t len = min(range, size - off);
+		pid_t pid = fork();
+
+		if (pid < 0) {
+			failed = error("fork");
+			break;
+		} else if (!pid) {
+			if (cp_splice(in_fd, out_fd, &off, &len) < 0 || len)
+				exit(1);
+			exit(0);
+		}
+		nr++;
+	}
+
+	while (nr--) {
+		if (wait(&status) < 0 || !WIFEXITED(status) ||
+		    WEXITSTATUS(status))
+			failed = -1;
+	}
+
+	if (failed)
+		return -1;
+
+	*left = 0;
+	return 0;
 }
 
 int main(int argc, char *argv[])
 {
-	int in_fd, out_fd, pfds[2], index;
+	int in_fd, out_fd, index, method, ret;
 	struct stat sb;
+	off_t left;
 
 	index = parse_options(argc, argv);
 	if (index == -1 || index + 2 > argc)
@@ -55,34 +269,62 @@ int main(int argc, char *argv[])
 	if (fstat(in_fd, &sb) < 0)
 		return error("stat input");
 
-	out_fd = open(argv[index + 1], O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (!strcmp(argv[index + 1], "-"))
+		out_fd = STDOUT_FILENO;
+	else
+		out_fd = open(argv[index + 1], O_WRONLY | O_CREAT | O_TRUNC, 0644);
 	if (out_fd < 0)
 		return error("open output");
 
-	if (pipe(pfds) < 0)
-		return error("pipe");
+	if (workers > 1) {
+		if (!S_ISREG(sb.st_mode) || out_fd == STDOUT_FILENO) {
+			fprintf(stderr, "%s: -j needs regular files\n", argv[0]);
+			return 1;
+		}
 
-	do {
-		int this_len = min((off_t) BS, sb.st_size);
-		int ret = ssplice(in_fd, NULL, pfds[1], NULL, this_len, 0);
+		left = sb.st_size;
+		if (cp_parallel(in_fd, out_fd, &left) < 0)
+			return 1;
 
-		if (ret < 0)
-			return error("splice-in");
-		else if (!ret)
-			break;
+		if (verbose)
+			fprintf(stderr, "%s: copied %llu bytes with %d splice workers\n",
+				argv[0], (unsigned long long) sb.st_size, workers);
+		close(in_fd);
+		close(out_fd);
+		return 0;
+	}
 
-		sb.st_size -= ret;
-		while (ret > 0) {
-			int written = ssplice(pfds[0], NULL, out_fd, NULL, ret, splice_flags);
-			if (written <= 0)
-				return error("splice-out");
-			ret -= written;
-		}
-	} while (sb.st_size);
+	method = cp_method;
+	if (method == CP_AUTO)
+		method = pick_method(in_fd, out_fd);
+
+	/*
+	 * Both fast paths work on the file positions, so whatever the failed
+	 * method managed to copy is not copied again by the next one
+	 */
+	left = sb.st_size;
+	ret = -1;
+	if (method == CP_COPY_FILE_RANGE) {
+		ret = cp_copy_file_range(in_fd, out_fd, &left);
+		if (ret < 0 && !can_fall_back(errno))
+			return error("copy_file_range");
+	} else if (method == CP_SENDFILE) {
+		ret = cp_sendfile(in_fd, out_fd, &left);
+		if (ret < 0 && !can_fall_back(errno))
+			return error("sendfile");
+	}
+
+	if (ret < 0) {
+		method = CP_SPLICE;
+		if (cp_splice(in_fd, out_fd, NULL, &left) < 0)
+			return 1;
+	}
+
+	if (verbose)
+		fprintf(stderr, "%s: copied %llu bytes with %s\n", argv[0],
+			(unsigned long long) (sb.st_size - left), cp_names[method]);
 
 	close(in_fd);
-	close(pfds[1]);
 	close(out_fd);
-	close(pfds[0]);
 	return 0;
 }
@@ -1,5 +1,11 @@
 /*
- * Splice from network to stdout
+ * Splice from network to stdout, or with -o every connection to its own file
+ *
+ * The sockets are non blocking and driven from epoll. Data is spliced from a
+ * socket into a pipe and straight on to the output, the pipe goes back to a
+ * shared pool as soon as it is drained, so hundreds of connections only need
+ * a handful of pipes. stdout is a pipe itself, so without -o the socket is
+ * spliced straight into it.
  */
 #include <stdio.h>
 #include <stdlib.h>
@@ -13,121 +19,344 @@
 #include <string.h>
 #include <sys/time.h>
 #include <errno.h>
-#include <sys/poll.h>
+#include <limits.h>
+#include <sys/epoll.h>
 
 #include "splice.h"
 
+struct pipe_pair {
+	int pfds[2];
+	struct pipe_pair *next;
+};
+
+struct conn {
+	int fd;
+	int out_fd;
+	char name[64];
+	struct timeval start;
+	unsigned long long bytes;
+	unsigned long splices;
+	/*
+	 * Only held while it has data that is not written out yet
+	 */
+	struct pipe_pair *pipe;
+	int in_pipe;
+	struct conn *next, *prev;
+};
+
 static unsigned int splice_size = SPLICE_SIZE;
-static unsigned int splice_flags;
-static int wait_for_poll;
+static char *out_dir;
+static int max_pipes = 16;
+static int quiet;
+
+static struct pipe_pair *pipe_pool;
+static int nr_pipes;
+
+static struct conn *conns;
+static int nr_conns, total_conns;
+static unsigned long long total_bytes;
+static volatile sig_atomic_t stop;
 
 static int usage(char *name)
 {
-	fprintf(stderr, "%s: [-s splice size] [-w wait for poll] [-n non-blocking] port\n", name);
+	fprintf(stderr, "%s: [-s splice size] [-o output dir] [-p pooled pipes] [-q(uiet)] port\n", name);
+	fprintf(stderr, "\twithout -o one connection is spliced to stdout\n");
 	return 1;
 }
 
-static int splice_from_net(int fd)
+static void sig_stop(int sig)
 {
-	while (1) {
-		int ret;
+	stop = 1;
+}
 
-		if (wait_for_poll) {
-			struct pollfd pfd = {
-				.fd = fd,
-				.events = POLLIN,
-			};
+static struct pipe_pair *get_pipe(void)
+{
+	struct pipe_pair *p = pipe_pool;
 
-			ret = poll(&pfd, 1, -1);
-			if (ret < 0)
-				return error("poll");
-			else if (!ret)
-				continue;
+	if (p) {
+		pipe_pool = p->next;
+		nr_pipes--;
+		return p;
+	}
+
+	p = malloc(sizeof(*p));
+	if (!p || pipe(p->pfds) < 0) {
+		error("pipe");
+		free(p);
+		return NULL;
+	}
+	if (splice_size > SPLICE_SIZE)
+		grow_pipe(p->pfds[1], splice_size);
+
+	return p;
+}
 
-			if (!(pfd.revents & POLLIN))
+static void put_pipe(struct pipe_pair *p)
+{
+	if (nr_pipes >= max_pipes) {
+		close(p->pfds[0]);
+		close(p->pfds[1]);
+		free(p);
+		return;
+	}
+
+	p->next = pipe_pool;
+	pipe_pool = p;
+	nr_pipes++;
+}
+
+static double elapsed(struct timeval *start)
+{
+	struct timeval now;
+
+	gettimeofday(&now, NULL);
+	return (now.tv_sec - start->tv_sec) + (now.tv_usec - start->tv_usec) / 1e6;
+}
+
+static void print_conn(struct conn *c, const char *state)
+{
+	double secs = elapsed(&c->start);
+
+	if (quiet)
+		return;
+	if (secs <= 0)
+		secs = 1e-6;
+
+	fprintf(stderr, "%s: %s %llu bytes in %lu splices, %.2f MiB/s\n",
+		c->name, state, c->bytes, c->splices,
+		c->bytes / secs / (1024 * 1024));
+}
+
+static struct conn *new_conn(int efd, int fd, struct sockaddr_in *addr)
+{
+	struct epoll_event ev;
+	struct conn *c;
+	char path[PATH_MAX];
+
+	c = calloc(1, sizeof(*c));
+	if (!c)
+		return NULL;
+
+	c->fd = fd;
+	gettimeofday(&c->start, NULL);
+	snprintf(c->name, sizeof(c->name), "%s:%u",
+		 inet_ntoa(addr->sin_addr), ntohs(addr->sin_port));
+
+	if (out_dir) {
+		snprintf(path, sizeof(path), "%s/conn-%d-%s", out_dir,
+			 total_conns, c->name);
+		c->out_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		if (c->out_fd < 0) {
+			error(path);
+			free(c);
+			return NULL;
+		}
+	} else
+		c->out_fd = STDOUT_FILENO;
+
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN | EPOLLRDHUP;
+	ev.data.ptr = c;
+	if (epoll_ctl(efd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+		error("epoll_ctl");
+		if (out_dir)
+			close(c->out_fd);
+		free(c);
+		return NULL;
+	}
+
+	c->next = conns;
+	if (conns)
+		conns->prev = c;
+	conns = c;
+	nr_conns++;
+	total_conns++;
+
+	return c;
+}
+
+static void close_conn(int efd, struct conn *c, const char *state)
+{
+	print_conn(c, state);
+
+	epoll_ctl(efd, EPOLL_CTL_DEL, c->fd, NULL);
+	close(c->fd);
+	if (out_dir)
+		close(c->out_fd);
+	/*
+	 * A pipe with data left in it can not be reused
+	 */
+	if (c->pipe && c->in_pipe) {
+		close(c->pipe->pfds[0]);
+		close(c->pipe->pfds[1]);
+		free(c->pipe);
+	} else if (c->pipe)
+		put_pipe(c->pipe);
+
+	if (c->prev)
+		c->prev->next = c->next;
+	else
+		conns = c->next;
+	if (c->next)
+		c->next->prev = c->prev;
+
+	total_bytes += c->bytes;
+	nr_conns--;
+	free(c);
+}
+
+/*
+ * Move whatever the pipe holds to the output. Files and stdout are written
+ * blocking, so the pipe can be given back when this returns.
+ */
+static int drain_pipe(struct conn *c)
+{
+	while (c->in_pipe) {
+		int ret = ssplice(c->pipe->pfds[0], NULL, c->out_fd, NULL,
+				  c->in_pipe, SPLICE_F_MOVE);
+
+		if (ret < 0) {
+			if (errno == EINTR)
 				continue;
+			return error("splice-out");
 		}
+		c->in_pipe -= ret;
+		c->bytes += ret;
+	}
 
-		ret = ssplice(fd, NULL, STDOUT_FILENO, NULL, splice_size, 0);
+	put_pipe(c->pipe);
+	c->pipe = NULL;
+	return 0;
+}
 
-		if (ret < 0)
-			return error("splice");
-		else if (!ret)
-			break;
+/*
+ * Same as below for stdout, which needs no pipe from the pool as it is one.
+ * Only the socket is non blocking, stdout is still written blocking.
+ */
+static int splice_direct(struct conn *c)
+{
+	int i;
+
+	for (i = 0; i < 16; i++) {
+		int ret = ssplice(c->fd, NULL, c->out_fd, NULL, splice_size,
+				  SPLICE_F_MOVE);
+
+		if (ret < 0) {
+			if (errno == EAGAIN)
+				break;
+			if (errno == EINTR)
+				continue;
+			return error("splice-out");
+		} else if (!ret)
+			return 1;
+
+		c->bytes += ret;
+		c->splices++;
 	}
 
 	return 0;
 }
 
-static int get_connect(int fd, struct sockaddr_in *addr)
+/*
+ * Splice a few chunks from a readable connection, returns 1 at end of file.
+ * epoll is level triggered, so a busy connection is simply picked up again
+ * on the next round and can not starve the others.
+ */
+static int splice_conn(struct conn *c)
 {
-	socklen_t socklen = sizeof(*addr);
-	int ret, connfd;
-
-	do {
-		struct pollfd pfd = {
-			.fd = fd,
-			.events = POLLIN,
-		};
-
-		ret = poll(&pfd, 1, -1);
-		if (ret < 0)
-			return error("poll");
-		else if (!ret)
-			continue;
-
-		connfd = accept(fd, (struct sockaddr *) addr, &socklen);
-		if (connfd < 0)
-			return error("accept");
-		break;
-	} while (1);
-			
-	return connfd;
+	int i;
+
+	if (!out_dir)
+		return splice_direct(c);
+
+	for (i = 0; i < 16; i++) {
+		int ret;
+
+		if (!c->pipe) {
+			c->pipe = get_pipe();
+			if (!c->pipe)
+				return -1;
+		}
+
+		ret = ssplice(c->fd, NULL, c->pipe->pfds[1], NULL, splice_size,
+			      SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+		if (ret < 0) {
+			if (errno == EAGAIN)
+				break;
+			if (errno == EINTR)
+				continue;
+			return error("splice-in");
+		} else if (!ret) {
+			if (c->in_pipe && drain_pipe(c))
+				return -1;
+			return 1;
+		}
+
+		c->in_pipe += ret;
+		c->splices++;
+		if (drain_pipe(c))
+			return -1;
+	}
+
+	if (c->pipe && !c->in_pipe) {
+		put_pipe(c->pipe);
+		c->pipe = NULL;
+	}
+
+	return 0;
 }
 
 static int parse_options(int argc, char *argv[])
 {
-	int c, index = 1;
+	int c;
 
-	while ((c = getopt(argc, argv, "s:w:n")) != -1) {
+	while ((c = getopt(argc, argv, "s:o:p:q")) != -1) {
 		switch (c) {
 		case 's':
 			splice_size = atoi(optarg);
-			index++;
 			break;
-		case 'w':
-			wait_for_poll = atoi(optarg);
-			index++;
+		case 'o':
+			out_dir = optarg;
+			break;
+		case 'p':
+			max_pipes = atoi(optarg);
 			break;
-		case 'n':
-			splice_flags |= SPLICE_F_NONBLOCK;
-			index++;
+		case 'q':
+			quiet = 1;
 			break;
 		default:
 			return -1;
 		}
 	}
 
-	return index;
+	return optind;
 }
 
 
 int main(int argc, char *argv[])
 {
 	struct sockaddr_in addr;
+	struct epoll_event ev, events[128];
+	struct timeval start;
 	unsigned short port;
-	int connfd, opt, fd, index;
+	int opt, fd, efd, index, i;
 
 	if (argc < 2)
 		return usage(argv[0]);
 
-	if (check_output_pipe())
-		return usage(argv[0]);
-
 	index = parse_options(argc, argv);
 	if (index == -1 || index + 1 > argc)
 		return usage(argv[0]);
 
+	if (!out_dir) {
+		if (check_output_pipe())
+			return usage(argv[0]);
+		if (splice_size > SPLICE_SIZE)
+			grow_pipe(STDOUT_FILENO, splice_size);
+	}
+
 	port = atoi(argv[index]);
 
 	fd = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
@@ -145,12 +374,76 @@ int main(int argc, char *argv[])
 
 	if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0)
 		return error("bind");
-	if (listen(fd, 1) < 0)
+	if (listen(fd, out_dir ? 128 : 1) < 0)
 		return error("listen");
 
-	connfd = get_connect(fd, &addr);
-	if (connfd < 0)
-		return connfd;
+	efd = epoll_create(128);
+	if (efd < 0)
+		return error("epoll_create");
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.ptr = NULL;
+	if (epoll_ctl(efd, EPOLL_CTL_ADD, fd, &ev) < 0)
+		return error("epoll_ctl");
+
+	signal(SIGINT, sig_stop);
+	signal(SIGTERM, sig_stop);
+	gettimeofday(&start, NULL);
+
+	while (!stop) {
+		int n = epoll_wait(efd, events, 128, -1);
+
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return error("epoll_wait");
+		}
+
+		for (i = 0; i < n; i++) {
+			struct conn *c = events[i].data.ptr;
+			int ret;
 
-	return splice_from_net(connfd);
+			if (!c) {
+				socklen_t socklen = sizeof(addr);
+				int connfd = accept(fd, (struct sockaddr *) &addr, &socklen);
+
+				if (connfd < 0) {
+					error("accept");
+					continue;
+				}
+				if (!new_conn(efd, connfd, &addr)) {
+					close(connfd);
+					continue;
+				}
+
+				/*
+				 * stdout only takes a single stream
+				 */
+				if (!out_dir)
+					epoll_ctl(efd, EPOLL_CTL_DEL, fd, NULL);
+				continue;
+			}
+
+			ret = splice_conn(c);
+			if (ret) {
+				close_conn(efd, c, ret < 0 ? "failed after" : "done,");
+				if (!out_dir)
+					stop = 1;
+			}
+		}
+	}
+
+	while (conns)
+		close_conn(efd, conns, "interrupted after");
+
+	if (out_dir || total_conns > 1) {
+		double secs = elapsed(&start);
+
+		fprintf(stderr, "%d connections, %llu bytes in %.2f s, %.2f MiB/s\n",
+			total_conns, total_bytes, secs,
+			total_bytes / (secs > 0 ? secs : 1e-6) / (1024 * 1024));
+	}
+
+	return 0;
 }
@@ -21,6 +21,7 @@
 #include <unistd.h>
 
 #include "splice.h"
+#include "bench.h"
 
 #define TARGET_HOSTNAME "localhost"
 
@@ -39,77 +40,35 @@ static int splice_pipe_loops = SPLICE_PIPE_LOOPS;
 static int splice_loops = SPLICE_LOOPS;
 #endif
 
-static volatile long long *cycles, cycles_per_sec;
-
-static struct timeval start_time;
-static double start_cycles;
-static double cpu_pct;
+static struct bench_mark start_mark;
 
 static void start_timing(const char *desc)
 {
 	printf("%-20s: ", desc);
 	fflush(stdout);
-	gettimeofday(&start_time, NULL);
-	/*
-	 * Give the lowprio cycles thread a chance to run and thus
-	 * we get an accurate timestamp:
-	 */
-	sched_yield();
-	start_cycles = (double)*cycles;
+	bench_start(&start_mark, RUSAGE_SELF);
 }
 
+/*
+ * Returns the CPU seconds spent per GiB moved, lower is more efficient
+ */
 static double end_timing(unsigned long long bytes, double *rate)
 {
 	static long long total;
-	struct timeval end_time;
-	double usecs;
-	double end_cycles, cpu_cycles;
-
-	gettimeofday(&end_time, NULL);
-	end_cycles = (double)*cycles;
+	struct bench_stat st;
 
-	usecs = (double) (end_time.tv_sec - start_time.tv_sec);
-	usecs *= 1000000.0;
-	usecs += (double) (end_time.tv_usec - start_time.tv_usec);
+	memset(&st, 0, sizeof(st));
+	bench_stop(&st, &start_mark, RUSAGE_SELF);
+	st.bytes = bytes;
 	total += bytes;
 
-	cpu_cycles = end_cycles - start_cycles;
-	cpu_pct = 100.0 -
-		cpu_cycles / cycles_per_sec / ( usecs / 1000000.0 ) * 100.0;
+	*rate = bench_mib_s(&st);
 
-	*rate = (double) bytes / usecs / (1024*1024) * 1000000;
+	printf("%.2fMB/s (%.1fMB total)\n", *rate,
+		(double) total / (1024*1024));
+	bench_print(stdout, "\t", &st);
 
-	printf("%.2fMB/s (%.1fMB total, %.2f%% CPU)\n", *rate,
-		(double) total / (1024*1024),
-		cpu_pct
-	);
-
-	return cpu_pct;
-}
-
-static void calibrate_loops(void)
-{
-	long long l0, l1;
-	int i;
-
-	cycles_per_sec = 0;
-	printf("calibrating cycles: "); fflush(stdout);
-
-	/*
-	 * Make sure we start on a precise timer IRQ boundary:
-	 */
-	usleep(50000);
-
-	for (i = 0; i < 10; i++) {
-		sched_yield();
-		l0 = *cycles;
-		usleep(200000);
-		l1 = *cycles;
-		cycles_per_sec = max(cycles_per_sec, l1-l0);
-	}
-	cycles_per_sec *= 5;
-
-	printf("%Ld cycles/sec\n", cycles_per_sec);
+	return 1024 / bench_mib_per_cpu_s(&st);
 }
 
 static int child(void)
@@ -137,8 +96,6 @@ static int child(void)
 	s_to.sin_family = hp->h_addrtype;
 	s_to.sin_port = htons(1111);
 
-	calibrate_loops();
-
 	fprintf(stdout, "BUFSIZE = %d\n", BUFSIZE);
 	fflush(stdout);
 
@@ -288,95 +245,9 @@ splice_again:
 }
 
 
-static void setup_shared_var(void)
-{
-	char zerobuff [4096] = { 0, };
-	int ret, fd;
-
-	fd = creat(".tmp_mmap", 0700);
-	BUG_ON(fd == -1);
-	close(fd);
-
-	fd = open(".tmp_mmap", O_RDWR|O_CREAT|O_TRUNC, 0666);
-	BUG_ON(fd == -1);
-	ret = write(fd, zerobuff, 4096);
-	BUG_ON(ret != 4096);
-
-	cycles = (void *)mmap(0, 4096, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
-	BUG_ON(cycles == (void *)-1);
-
-	close(fd);
-}
-
-#define SCHED_BATCH 3
-
-#if defined(__i386__)
-#define rdtscll(val)					\
-do {							\
-	__asm__ __volatile__("rdtsc" : "=A" (val));	\
-} while (0)
-#elif defined(__x86_64__)
-#define rdtscll(val)						\
-do {								\
-	uint64_t lo, hi;					\
-	__asm__ __volatile__("rdtsc" : "=a" (lo), "=d" (hi));	\
-	(val) = (hi << 32) | lo;				\
-} while (0)
-#if 0
-#elif defined(__ia64__)
-#define rdtscll(val)					\
-do {							\
-	val = *__mm_clock_dev;				\
-} while (0)
-#endif
-#else
-#define rdtscll(val) \
-	do { (val) = 0LL; } while (0)
-#endif
-
-/*
- * Keep lowprio looping - to meausure the number of idle cycles
- * available. It's tricky: we do a series of RDTSC calls, and
- * if the delay to the last measurement was less than 500 cycles,
- * we conclude that only this loop ran.
- */
-static void lowprio_cycle_soak_loop(void)
-{
-        struct sched_param p = { sched_priority: 0 };
-	unsigned long long t0, t1, delta;
-
-	/*
-	 * We are a nice +19 SCHED_BATCH task:
-	 */
-	BUG_ON(sched_setscheduler(0, SCHED_BATCH, &p) != 0);
-	nice(40);
-
-	rdtscll(t0);
-	while (cycles >= 0) {
-		rdtscll(t1);
-		delta = t1-t0;
-		if (delta < 500)
-			*cycles += delta;
-		t0 = t1;
-	}
-}
-
 int main(__attribute__((__unused__)) int argc, __attribute__((__unused__)) char **argv)
 {
-	pid_t pid;
-
-	setup_shared_var();
-
-	signal(SIGCHLD, SIG_IGN);
-
-	pid = fork();
-	if (!pid) {
-		lowprio_cycle_soak_loop();
-		exit(0);
-	}
-
 	nice(-20);
 	child();
-	kill(pid, SIGHUP);
 	exit(0);
 }
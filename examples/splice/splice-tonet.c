@@ -1,5 +1,9 @@
 /*
  * Splice stdin to net
+ *
+ * The socket is non blocking and the loop waits with poll() for whichever
+ * side held it up, input on stdin or room in the socket. With -z the data is
+ * read and sent with MSG_ZEROCOPY instead, to compare the two.
  */
 #include <stdio.h>
 #include <stdlib.h>
@@ -12,36 +16,298 @@
 #include <arpa/inet.h>
 #include <string.h>
 #include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/ioctl.h>
 #include <errno.h>
+#include <poll.h>
+#include <linux/errqueue.h>
 
 #include "splice.h"
 
+#ifndef SO_ZEROCOPY
+#define SO_ZEROCOPY	60
+#endif
+#ifndef MSG_ZEROCOPY
+#define MSG_ZEROCOPY	0x4000000
+#endif
+#ifndef SO_EE_ORIGIN_ZEROCOPY
+#define SO_EE_ORIGIN_ZEROCOPY		5
+#define SO_EE_CODE_ZEROCOPY_COPIED	1
+#endif
+
+/*
+ * Send buffers for -z, a buffer can only be reused once the kernel says it
+ * is done with it
+ */
+#define ZC_BUFS		16
+
+struct zc_buf {
+	char *data;
+	int len;
+	int sent;
+	/*
+	 * Notification id of the last send from this buffer
+	 */
+	unsigned int last_id;
+};
+
+static unsigned int splice_size = SPLICE_SIZE;
+static int zerocopy;
+
+static unsigned long long total_bytes;
+static unsigned long stalls_in, stalls_out;
+static unsigned long zc_sends, zc_copied;
+
 static int usage(char *name)
 {
-	fprintf(stderr, "%s: target port\n", name);
+	fprintf(stderr, "%s: [-s size] [-z(erocopy send)] target port\n", name);
 	return 1;
 }
 
+static int parse_options(int argc, char *argv[])
+{
+	int c;
+
+	while ((c = getopt(argc, argv, "s:z")) != -1) {
+		switch (c) {
+		case 's':
+			splice_size = atoi(optarg);
+			break;
+		case 'z':
+			zerocopy = 1;
+			break;
+		default:
+			return -1;
+		}
+	}
+
+	return optind;
+}
+
+/*
+ * Block until fd is ready for events
+ */
+static int wait_for(int fd, short events)
+{
+	struct pollfd pfd = {
+		.fd = fd,
+		.events = events,
+	};
+
+	while (poll(&pfd, 1, -1) < 0) {
+		if (errno != EINTR)
+			return error("poll");
+	}
+
+	return 0;
+}
+
+static int splice_to_net(int fd)
+{
+	do {
+		int avail = 0, ret;
+
+		ret = ssplice(STDIN_FILENO, NULL, fd, NULL, splice_size,
+			      SPLICE_F_NONBLOCK | SPLICE_F_MOVE);
+		if (ret > 0) {
+			total_bytes += ret;
+			continue;
+		} else if (!ret)
+			break;
+
+		if (errno != EAGAIN)
+			return error("splice");
+
+		/*
+		 * Either side can be the one that is not ready
+		 */
+		if (ioctl(STDIN_FILENO, FIONREAD, &avail) < 0)
+			return error("FIONREAD");
+
+		if (!avail) {
+			stalls_in++;
+			ret = wait_for(STDIN_FILENO, POLLIN);
+		} else {
+			stalls_out++;
+			ret = wait_for(fd, POLLOUT);
+		}
+		if (ret < 0)
+			return ret;
+	} while (1);
+
+	return 0;
+}
+
+/*
+ * Read completion notifications, returns the number of sends done so far
+ */
+static int zc_reap(int fd, unsigned int *done)
+{
+	char control[128];
+	struct msghdr msg;
+	struct cmsghdr *cm;
+	struct sock_extended_err *serr;
+
+	do {
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof(control);
+
+		if (recvmsg(fd, &msg, MSG_ERRQUEUE) < 0) {
+			if (errno == EAGAIN)
+				return 0;
+			return error("recvmsg errqueue");
+		}
+
+		for (cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm)) {
+			serr = (struct sock_extended_err *) CMSG_DATA(cm);
+			if (serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+				continue;
+
+			/*
+			 * ids [ee_info, ee_data] are done, TCP completes them
+			 * in order
+			 */
+			if ((int) (serr->ee_data + 1 - *done) > 0)
+				*done = serr->ee_data + 1;
+			if (serr->ee_code & SO_EE_CODE_ZEROCOPY_COPIED)
+				zc_copied += serr->ee_data - serr->ee_info + 1;
+		}
+	} while (1);
+}
+
+static int zerocopy_to_net(int fd)
+{
+	struct zc_buf bufs[ZC_BUFS];
+	unsigned int next_id = 0, done = 0;
+	int head = 0, tail = 0, used = 0, eof = 0, i, opt = 1;
+
+	if (setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &opt, sizeof(opt)) < 0)
+		return error("SO_ZEROCOPY");
+
+	for (i = 0; i < ZC_BUFS; i++) {
+		bufs[i].data = malloc(splice_size);
+		if (!bufs[i].data)
+			return error("malloc");
+	}
+
+	fcntl(STDIN_FILENO, F_SETFL, fcntl(STDIN_FILENO, F_GETFL) | O_NONBLOCK);
+
+	while (!eof || used) {
+		struct pollfd pfds[2];
+		struct zc_buf *b;
+		int nfds = 0, nobufs = 0, ret;
+
+		if (zc_reap(fd, &done) < 0)
+			return -1;
+
+		/*
+		 * Give back buffers that are sent and done with
+		 */
+		while (used) {
+			b = &bufs[tail];
+			if (b->sent < b->len || (int) (done - b->last_id) <= 0)
+				break;
+			tail = (tail + 1) % ZC_BUFS;
+			used--;
+		}
+
+		if (eof && !used)
+			break;
+
+		if (!eof && used < ZC_BUFS) {
+			b = &bufs[head];
+			ret = read(STDIN_FILENO, b->data, splice_size);
+			if (ret > 0) {
+				b->len = ret;
+				b->sent = 0;
+				head = (head + 1) % ZC_BUFS;
+				used++;
+			} else if (!ret) {
+				eof = 1;
+				continue;
+			} else if (errno != EAGAIN && errno != EINTR)
+				return error("read");
+		}
+
+		/*
+		 * Send from the oldest buffer that still has data
+		 */
+		b = NULL;
+		for (i = 0; i < used; i++) {
+			struct zc_buf *c = &bufs[(tail + i) % ZC_BUFS];
+
+			if (c->sent < c->len) {
+				b = c;
+				break;
+			}
+		}
+
+		if (b) {
+			ret = send(fd, b->data + b->sent, b->len - b->sent,
+				   MSG_ZEROCOPY | MSG_DONTWAIT);
+			if (ret >= 0) {
+				b->sent += ret;
+				b->last_id = next_id++;
+				total_bytes += ret;
+				zc_sends++;
+				continue;
+			} else if (errno == ENOBUFS) {
+				/*
+				 * Too many sends in flight, only completions
+				 * help
+				 */
+				nobufs = 1;
+			} else if (errno != EAGAIN)
+				return error("send");
+		}
+
+		/*
+		 * Stuck, wait for input, room in the socket or notifications,
+		 * which show up as POLLERR
+		 */
+		if (!eof && used < ZC_BUFS) {
+			pfds[nfds].fd = STDIN_FILENO;
+			pfds[nfds++].events = POLLIN;
+			stalls_in++;
+		}
+		pfds[nfds].fd = fd;
+		pfds[nfds++].events = b && !nobufs ? POLLOUT : 0;
+		if (b)
+			stalls_out++;
+
+		if (poll(pfds, nfds, -1) < 0 && errno != EINTR)
+			return error("poll");
+	}
+
+	return 0;
+}
+
 int main(int argc, char *argv[])
 {
 	struct sockaddr_in addr;
+	struct timeval start, end;
+	struct rusage ru;
 	unsigned short port;
-	int fd, ret;
+	int fd, index, ret;
+	double secs;
 
-	if (argc < 3)
+	index = parse_options(argc, argv);
+	if (index == -1 || index + 2 > argc)
 		return usage(argv[0]);
 
 	if (check_input_pipe())
 		return usage(argv[0]);
 
-	port = atoi(argv[2]);
+	port = atoi(argv[index + 1]);
 
 	memset(&addr, 0, sizeof(addr));
 	addr.sin_family = AF_INET;
 	addr.sin_port = htons(port);
 
-	if (inet_aton(argv[1], &addr.sin_addr) != 1) {
-		struct hostent *hent = gethostbyname(argv[1]);
+	if (inet_aton(argv[index], &addr.sin_addr) != 1) {
+		struct hostent *hent = gethostbyname(argv[index]);
 
 		if (!hent)
 			return error("gethostbyname");
@@ -49,7 +315,7 @@ int main(int argc, char *argv[])
 		memcpy(&addr.sin_addr, hent->h_addr, 4);
 	}
 
-	printf("Connecting to %s/%d\n", argv[1], port);
+	printf("Connecting to %s/%d\n", argv[index], port);
 
 	fd = socket(AF_INET, SOCK_STREAM, 0);
 	if (fd < 0)
@@ -58,17 +324,31 @@ int main(int argc, char *argv[])
 	if (connect(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0)
 		return error("connect");
 
-	do {
-		ret = ssplice(STDIN_FILENO, NULL, fd, NULL, SPLICE_SIZE, SPLICE_F_NONBLOCK);
-		if (ret < 0) {
-			if (errno == EAGAIN) {
-				usleep(100);
-				continue;
-			}
-			return error("splice");
-		} else if (!ret)
-			break;
-	} while (1);
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+	gettimeofday(&start, NULL);
+	if (zerocopy)
+		ret = zerocopy_to_net(fd);
+	else
+		ret = splice_to_net(fd);
+	if (ret < 0)
+		return 1;
+	gettimeofday(&end, NULL);
+
+	getrusage(RUSAGE_SELF, &ru);
+	secs = (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1e6;
+	if (secs <= 0)
+		secs = 1e-6;
+
+	fprintf(stderr, "%s: %llu bytes in %.2f s, %.2f MiB/s, usr %.3f s sys %.3f s, %lu input and %lu output stalls\n",
+		zerocopy ? "zerocopy" : "splice", total_bytes, secs,
+		total_bytes / secs / (1024 * 1024),
+		ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6,
+		ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6,
+		stalls_in, stalls_out);
+	if (zerocopy)
+		fprintf(stderr, "zerocopy: %lu sends, %lu copied by the kernel\n",
+			zc_sends, zc_copied);
 
 	close(fd);
 	return 0;
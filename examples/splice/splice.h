@@ -1,7 +1,9 @@
 #ifndef SPLICE_H
 #define SPLICE_H
 
+#include <stdio.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <sys/uio.h>
 #include <sys/stat.h>
 #include <linux/unistd.h>
@@ -10,18 +12,22 @@
 #define __NR_sys_splice		313
 #define __NR_sys_tee		315
 #define __NR_sys_vmsplice	316
+#define __NR_sys_copy_file_range	377
 #elif defined(__x86_64__)
 #define __NR_sys_splice		275
 #define __NR_sys_tee		276
 #define __NR_sys_vmsplice	278
+#define __NR_sys_copy_file_range	326
 #elif defined(__powerpc__) || defined(__powerpc64__)
 #define __NR_sys_splice		283
 #define __NR_sys_tee		284
 #define __NR_sys_vmsplice	285
+#define __NR_sys_copy_file_range	379
 #elif defined(__ia64__)
 #define __NR_sys_splice		1297
 #define __NR_sys_tee		1301
 #define __NR_sys_vmsplice	1302
+#define __NR_sys_copy_file_range	1347
 #else
 #error unsupported arch
 #endif
@@ -62,8 +68,59 @@ static inline int svmsplice(int fd, const struct iovec *iov,
 	return syscall(__NR_sys_vmsplice, fd, iov, nr_segs, flags);
 }
 
+static inline ssize_t scopy_file_range(int fdin, loff_t *off_in, int fdout,
+					loff_t *off_out, size_t len,
+					unsigned int flags)
+{
+	return syscall(__NR_sys_copy_file_range, fdin, off_in, fdout, off_out,
+		       len, flags);
+}
+
 #define SPLICE_SIZE	(64*1024)
 
+#ifndef F_SETPIPE_SZ
+#define F_SETPIPE_SZ	(1024 + 7)
+#define F_GETPIPE_SZ	(1024 + 8)
+#endif
+
+/*
+ * Largest pipe an unprivileged process may ask for
+ */
+static inline int pipe_max_size(void)
+{
+	FILE *f = fopen("/proc/sys/fs/pipe-max-size", "r");
+	int size = SPLICE_SIZE;
+
+	if (f) {
+		if (fscanf(f, "%d", &size) != 1)
+			size = SPLICE_SIZE;
+		fclose(f);
+	}
+
+	return size;
+}
+
+/*
+ * Grow the pipe to size bytes, or as large as allowed if size is 0, and
+ * return the size it ended up with. Splice chunks should follow that size.
+ */
+static inline int grow_pipe(int fd, int size)
+{
+	int max_size = pipe_max_size();
+	int ret;
+
+	if (!size || size > max_size)
+		size = max_size;
+
+	fcntl(fd, F_SETPIPE_SZ, size);
+
+	ret = fcntl(fd, F_GETPIPE_SZ);
+	if (ret <= 0)
+		return SPLICE_SIZE;
+
+	return ret;
+}
+
 #define BUG_ON(c) assert(!(c))
 
 #define min(x,y) ({ \
@@ -1,6 +1,16 @@
 /*
  * Use vmsplice to fill some user memory into a pipe. vmsplice writes
  * to stdout, so that must be a pipe.
+ *
+ * The memory comes from a ring of gift buffers. Once pages are vmspliced
+ * they can't be touched until the consumer has read them out of the pipe,
+ * and the only thing that tells us how far it got is FIONREAD on the pipe.
+ * So buffers are handed out in order, and the oldest ones go back into the
+ * ring once the pipe holds fewer bytes than were given out after them.
+ *
+ * That is safe as long as the consumer reads (copies) from the pipe. If it
+ * splices on elsewhere, the pages may still be referenced after they left
+ * the pipe.
  */
 #include <stdio.h>
 #include <stdlib.h>
@@ -9,32 +19,201 @@
 #include <string.h>
 #include <getopt.h>
 #include <fcntl.h>
+#include <errno.h>
 #include <sys/poll.h>
 #include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/ioctl.h>
 
 #include "splice.h"
+#include "bench.h"
 
-#define ALIGN(buf)	(void *) (((unsigned long) (buf) + align_mask) & ~align_mask)
+#define ARENA_ALIGN	(2 * 1024 * 1024)
+
+struct gift_ring {
+	char *arena;
+	size_t arena_size;
+	int hugetlb;
+
+	/*
+	 * slots of slot_size bytes, [tail, head) are in the pipe
+	 */
+	unsigned int slot_size;
+	unsigned int nr_slots;
+	unsigned int head, tail, used;
+
+	/*
+	 * bytes vmspliced from slots that are not reclaimed yet
+	 */
+	unsigned long long in_flight;
+	unsigned int *lens;
+
+	unsigned long reclaim_waits;
+};
 
 static int do_clear;
-static int align_mask = 65535;
 static int force_unalign;
 static int splice_flags;
+static unsigned int msg_size = SPLICE_SIZE / 2;
+static unsigned int total_mb = 256;
+static int do_bench;
+
+static unsigned int bench_sizes[] = {
+	4096, 16384, 65536, 262144, 1048576,
+};
+
+/*
+ * Map an arena of at least size bytes, aligned to a huge page. Try real
+ * huge pages first, then let THP back an aligned normal mapping.
+ */
+static int ring_alloc_arena(struct gift_ring *r, size_t size)
+{
+	char *p;
+	size_t off;
+
+	size = (size + ARENA_ALIGN - 1) & ~((size_t) ARENA_ALIGN - 1);
+
+	p = mmap(NULL, size, PROT_READ | PROT_WRITE,
+		 MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+	if (p != MAP_FAILED) {
+		r->arena = p;
+		r->arena_size = size;
+		r->hugetlb = 1;
+		return 0;
+	}
+
+	p = mmap(NULL, size + ARENA_ALIGN, PROT_READ | PROT_WRITE,
+		 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (p == MAP_FAILED)
+		return error("mmap");
+
+	/*
+	 * trim the slack on both sides
+	 */
+	off = ((unsigned long) p + ARENA_ALIGN - 1) & ~((unsigned long) ARENA_ALIGN - 1);
+	off -= (unsigned long) p;
+	if (off)
+		munmap(p, off);
+	munmap(p + off + size, ARENA_ALIGN - off);
+
+	r->arena = p + off;
+	r->arena_size = size;
+	r->hugetlb = 0;
+	madvise(r->arena, size, MADV_HUGEPAGE);
+	return 0;
+}
+
+/*
+ * The ring must hold more than the pipe does, or a full ring would not
+ * mean a full pipe and waiting for room would spin
+ */
+static int ring_init(struct gift_ring *r, int pipefd, unsigned int size)
+{
+	unsigned int page_size = sysconf(_SC_PAGESIZE);
+	int pipe_size = fcntl(pipefd, F_GETPIPE_SZ);
+
+	if (pipe_size <= 0)
+		pipe_size = SPLICE_SIZE;
+
+	memset(r, 0, sizeof(*r));
+	r->slot_size = (size + page_size - 1) & ~(page_size - 1);
+
+	if (ring_alloc_arena(r, 2 * (size_t) pipe_size + 2 * r->slot_size))
+		return -1;
+
+	r->nr_slots = r->arena_size / r->slot_size;
+	r->lens = calloc(r->nr_slots, sizeof(unsigned int));
+	if (!r->lens)
+		return error("calloc");
+
+	return 0;
+}
+
+static void ring_exit(struct gift_ring *r)
+{
+	munmap(r->arena, r->arena_size);
+	free(r->lens);
+}
+
+/*
+ * Give back the oldest slots whose bytes have all left the pipe
+ */
+static int ring_reclaim(struct gift_ring *r, int pipefd)
+{
+	int queued;
+
+	if (ioctl(pipefd, FIONREAD, &queued) < 0)
+		return error("FIONREAD");
+
+	while (r->used && r->in_flight - r->lens[r->tail] >= (unsigned long long) queued) {
+		r->in_flight -= r->lens[r->tail];
+		if (++r->tail == r->nr_slots)
+			r->tail = 0;
+		r->used--;
+	}
 
-int do_vmsplice(int fd, void *b1, void *b2, int len)
+	return 0;
+}
+
+/*
+ * Get the next free slot, waiting for the consumer if they are all in the
+ * pipe
+ */
+static char *ring_get(struct gift_ring *r, int pipefd)
+{
+	struct pollfd pfd = { .fd = pipefd, .events = POLLOUT, };
+
+	if (ring_reclaim(r, pipefd))
+		return NULL;
+
+	while (r->used == r->nr_slots) {
+		r->reclaim_waits++;
+		if (poll(&pfd, 1, -1) < 0 && errno != EINTR) {
+			error("poll");
+			return NULL;
+		}
+		if (ring_reclaim(r, pipefd))
+			return NULL;
+	}
+
+	return r->arena + (size_t) r->head * r->slot_size;
+}
+
+/*
+ * The slot at head went into the pipe with len bytes
+ */
+static void ring_put(struct gift_ring *r, unsigned int len)
+{
+	r->lens[r->head] = len;
+	r->in_flight += len;
+	if (++r->head == r->nr_slots)
+		r->head = 0;
+	r->used++;
+}
+
+/*
+ * Wait for the consumer to empty the pipe, everything is reclaimed after
+ */
+static int ring_drain(struct gift_ring *r, int pipefd)
+{
+	while (r->used) {
+		if (ring_reclaim(r, pipefd))
+			return -1;
+		if (r->used)
+			usleep(100);
+	}
+
+	return 0;
+}
+
+int do_vmsplice(int fd, void *buf, int len)
 {
 	struct pollfd pfd = { .fd = fd, .events = POLLOUT, };
-	struct iovec iov[] = {
-		{
-			.iov_base = b1,
-			.iov_len = len / 2,
-		},
-		{
-			.iov_base = b2,
-			.iov_len = len / 2,
-		},
+	struct iovec iov = {
+		.iov_base = buf,
+		.iov_len = len,
 	};
-	int written, idx = 0;
+	int written;
 
 	while (len) {
 		/*
@@ -45,118 +224,202 @@ int do_vmsplice(int fd, void *b1, void *b2, int len)
 		if (poll(&pfd, 1, -1) < 0)
 			return error("poll");
 
-		written = svmsplice(fd, &iov[idx], 2 - idx, splice_flags);
+		written = svmsplice(fd, &iov, 1, splice_flags);
 
 		if (written <= 0)
 			return error("vmsplice");
 
 		len -= written;
-		if ((size_t) written >= iov[idx].iov_len) {
-			int extra = written - iov[idx].iov_len;
-
-			idx++;
-			iov[idx].iov_len -= extra;
-			iov[idx].iov_base += extra;
-		} else {
-			iov[idx].iov_len -= written;
-			iov[idx].iov_base += written;
-		}
+		iov.iov_len -= written;
+		iov.iov_base += written;
 	}
 
 	return 0;
 }
 
+static int do_write(int fd, void *buf, int len)
+{
+	while (len) {
+		int written = write(fd, buf, len);
+
+		if (written < 0)
+			return error("write");
+
+		len -= written;
+		buf += written;
+	}
+
+	return 0;
+}
+
+/*
+ * Produce bytes worth of size messages into the pipe, from the gift ring
+ * or with write() from a single buffer
+ */
+static int run(int fd, unsigned int size, unsigned long long bytes,
+	       int use_ring, struct bench_stat *st)
+{
+	struct gift_ring r;
+	struct bench_mark m;
+	char *wbuf = NULL;
+	unsigned long long left = bytes;
+	int ret = 0, fill = 0;
+
+	if (use_ring) {
+		if (ring_init(&r, fd, size + (force_unalign ? 1024 : 0)))
+			return -1;
+	} else if (posix_memalign((void **) &wbuf, 4096, size))
+		return error("posix_memalign");
+
+	memset(st, 0, sizeof(*st));
+	bench_start(&m, RUSAGE_SELF);
+
+	while (left) {
+		unsigned int len = min((unsigned long long) size, left);
+		char *buf;
+
+		if (!use_ring) {
+			memset(wbuf, fill++, len);
+			if (do_write(fd, wbuf, len)) {
+				ret = -1;
+				break;
+			}
+			left -= len;
+			continue;
+		}
+
+		buf = ring_get(&r, fd);
+		if (!buf) {
+			ret = -1;
+			break;
+		}
+		if (force_unalign)
+			buf += 1024;
+
+		/*
+		 * a real producer writes its data here
+		 */
+		memset(buf, fill++, len);
+
+		if (do_vmsplice(fd, buf, len)) {
+			ret = -1;
+			break;
+		}
+		ring_put(&r, len);
+		left -= len;
+
+		/*
+		 * Test option - clear the last buffer we got back, the
+		 * consumer must never see that
+		 */
+		if (do_clear && r.used < r.nr_slots) {
+			unsigned int prev = r.tail ? r.tail - 1 : r.nr_slots - 1;
+
+			memset(r.arena + (size_t) prev * r.slot_size, 0, r.slot_size);
+		}
+	}
+
+	if (use_ring && !ret)
+		ret = ring_drain(&r, fd);
+
+	bench_stop(st, &m, RUSAGE_SELF);
+	st->bytes = bytes - left;
+
+	if (use_ring) {
+		fprintf(stderr, "ring: %u slots of %u bytes, %s pages, %lu waits for the consumer\n",
+			r.nr_slots, r.slot_size, r.hugetlb ? "hugetlb" : "thp",
+			r.reclaim_waits);
+		ring_exit(&r);
+	} else
+		free(wbuf);
+
+	return ret;
+}
+
+static void print_run(const char *name, unsigned int size,
+		      struct bench_stat *st)
+{
+	char prefix[64];
+
+	fprintf(stderr, "%-9s %8u bytes: %.1f MiB/s\n", name, size,
+		bench_mib_s(st));
+	snprintf(prefix, sizeof(prefix), "%-9s %8u bytes: ", "", size);
+	bench_print(stderr, prefix, st);
+}
+
 static int usage(char *name)
 {
-	fprintf(stderr, "%s: [-c(lear)] [-u(nalign)] [-g(ift)]| ...\n", name);
+	fprintf(stderr, "%s: [-c(lear)] [-u(nalign)] [-g(ift)] [-s msg size] [-t total MiB] [-B(ench against write)] | ...\n", name);
 	return 1;
 }
 
 static int parse_options(int argc, char *argv[])
 {
-	int c, index = 1;
+	int c;
 
-	while ((c = getopt(argc, argv, "cug")) != -1) {
+	while ((c = getopt(argc, argv, "cugs:t:B")) != -1) {
 		switch (c) {
 		case 'c':
 			do_clear = 1;
-			index++;
 			break;
 		case 'u':
 			force_unalign = 1;
-			index++;
 			break;
 		case 'g':
 			splice_flags = SPLICE_F_GIFT;
-			index++;
+			break;
+		case 's':
+			msg_size = atoi(optarg);
+			break;
+		case 't':
+			total_mb = atoi(optarg);
+			break;
+		case 'B':
+			do_bench = 1;
 			break;
 		default:
 			return -1;
 		}
 	}
 
-	return index;
+	return optind;
 }
 
 int main(int argc, char *argv[])
 {
-	unsigned char *b1, *b2;
+	unsigned long long bytes;
+	struct bench_stat st;
+	int i;
 
-	if (parse_options(argc, argv) < 0)
+	if (parse_options(argc, argv) < 0 || !msg_size || !total_mb)
 		return usage(argv[0]);
 
 	if (check_output_pipe())
 		return usage(argv[0]);
 
-	b1 = ALIGN(malloc(SPLICE_SIZE + align_mask));
-	b2 = ALIGN(malloc(SPLICE_SIZE + align_mask));
+	bytes = (unsigned long long) total_mb * 1024 * 1024;
 
-	if (force_unalign) {
-		b1 += 1024;
-		b2 += 1024;
+	if (!do_bench) {
+		if (run(STDOUT_FILENO, msg_size, bytes, 1, &st))
+			return 1;
+		print_run(splice_flags ? "gift" : "vmsplice", msg_size, &st);
+		return 0;
 	}
 
-	memset(b1, 0xaa, SPLICE_SIZE);
-	memset(b2, 0xbb, SPLICE_SIZE);
-
-    printf("size: %d\n", SPLICE_SIZE);
-    exit(0);
+	/*
+	 * The ring gifts its pages, write() copies them
+	 */
+	splice_flags = SPLICE_F_GIFT;
 
-	do {
-		int half = SPLICE_SIZE / 2;
+	for (i = 0; i < sizeof(bench_sizes) / sizeof(bench_sizes[0]); i++) {
+		if (run(STDOUT_FILENO, bench_sizes[i], bytes, 1, &st))
+			return 1;
+		print_run("gift", bench_sizes[i], &st);
 
-		/*
-		 * vmsplice the first half of the buffer into the pipe
-		 */
-		if (do_vmsplice(STDOUT_FILENO, b1, b2, SPLICE_SIZE))
-			break;
-
-		/*
-		 * first half is now in pipe, but we don't quite know when
-		 * we can reuse it.
-		 */
-
-		/*
-		 * vmsplice second half
-		 */
-		if (do_vmsplice(STDOUT_FILENO, b1 + half, b2 + half, SPLICE_SIZE))
-			break;
-
-		/*
-		 * We still don't know when we can reuse the second half of
-		 * the buffer, but we do now know that all parts of the first
-		 * half have been consumed from the pipe - so we can reuse that.
-		 */
-
-		/*
-		 * Test option - clear the first half of the buffer, should
-		 * be safe now
-		 */
-		if (do_clear) {
-			memset(b1, 0x00, SPLICE_SIZE);
-			memset(b2, 0x00, SPLICE_SIZE);
-		}
-	} while (0);
+		if (run(STDOUT_FILENO, bench_sizes[i], bytes, 0, &st))
+			return 1;
+		print_run("write", bench_sizes[i], &st);
+	}
 
 	return 0;
 }
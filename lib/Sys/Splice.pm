@@ -20,7 +20,8 @@ use warnings;
 
 use base "Exporter";
 
-our @EXPORT_OK = qw(vmsplice_tofh sys_splice sys_vmsplice);
+our @EXPORT_OK = qw(vmsplice_tofh splice_cp splice_batch sys_splice sys_tee 
+    sys_vmsplice pack_iovec);
 our %EXPORT_TAGS = ();
 
 our $VERSION = '1.01';
@@ -33,6 +34,10 @@ Sys::Splice - Give access to Linux the splice/tee/vmsplice system calls from Per
 
 This is simple module that wraps the splice/tee/vmsplice system call on Linux. 
 
+The system calls are made through L<Sys::Splice::XS> that calls the libc
+wrappers directly. If the XS backend can not be loaded Perl's syscall() is
+used instead, see examples/bench-sys-splice.pl for the difference.
+
 =head1 SYNOPSIS
   
   use strict;
@@ -40,8 +45,8 @@ This is simple module that wraps the splice/tee/vmsplice system call on Linux.
 
   use Sys::Splice;
  
-  # Create new splice object
-  my $splice = new Sys::Splice;
+  # Create new splice object with a pool of 4 pipes of 256 KiB
+  my $splice = new Sys::Splice(pipes => 4, pipe_size => 256*1024);
    
   # Open file for writing
   open my $fh, ">", "test.file";
@@ -50,11 +55,14 @@ This is simple module that wraps the splice/tee/vmsplice system call on Linux.
   my $buf2 = "World\n";
 
   # Write both buffers to file handle
-  $splice->vmsplice_buffers($fh, $buf1, $buf2);
+  $splice->vmsplice_tofh($fh, $buf1, $buf2);
 
   close $fh;
 
-  sys_vmsplice();
+  # Copy file, reusing the pipe from before
+  open my $fh_in, "<", "test.file";
+  open my $fh_out, ">", "test.copy";
+  $splice->splice_cp($fh_in, $fh_out);
 
 =head1 METHODS
 
@@ -68,8 +76,10 @@ use Socket;
 use Data::Dumper;
 use Fcntl qw(:mode);
 
-use POSIX qw(uname);
+use POSIX qw(uname EINTR EINVAL ENOSYS EOPNOTSUPP EXDEV);
 use Config;
+use Scalar::Util qw(readonly blessed);
+use IO::Poll qw(POLLOUT);
 
 
 our $SYS_splice;
@@ -84,6 +94,36 @@ our $SYS_SPLICE_F_UNMAP    = 0x10;
 
 our $SYS_SPLICE_SIZE       = (64*1024);
 
+our $SYS_F_SETPIPE_SZ      = 1031;
+our $SYS_F_GETPIPE_SZ      = 1032;
+
+# Largest chunk handed to sendfile and copy_file_range, below 2GiB
+our $SYS_CP_CHUNK          = (1024*1024*1024);
+
+# Ranges copied by parallel splice_cp workers start on this boundary
+our $SYS_CP_ALIGN          = (1024*1024);
+
+# Errors that mean a splice_cp fast path does not work for these files
+my %CP_FALLBACK = map { $_ => 1 } (EXDEV, EINVAL, ENOSYS, EOPNOTSUPP);
+
+# Layout of struct iovec as found by Build.PL
+our $SYS_IOVEC_SIZE;
+our $SYS_IOVEC_TEMPLATE;
+our $SYS_POINTER_TEMPLATE;
+
+if(eval { require Sys::Splice::ConfigData; 1 }) {
+    $SYS_IOVEC_SIZE = Sys::Splice::ConfigData->config('iovec_size');
+    $SYS_IOVEC_TEMPLATE = Sys::Splice::ConfigData->config('iovec_template');
+    $SYS_POINTER_TEMPLATE = 
+        Sys::Splice::ConfigData->config('pointer_template');
+
+} else {
+    # Not built with Build.PL, assume a pointer followed by a size_t
+    $SYS_IOVEC_SIZE = $Config{ptrsize} + $Config{sizesize};
+    $SYS_IOVEC_TEMPLATE = 'P' . ($Config{sizesize} == 8 ? 'Q' : 'L');
+    $SYS_POINTER_TEMPLATE = $Config{ptrsize} == 8 ? 'Q' : 'L';
+}
+
 # Syscall list: linux-2.6/arch/x86/kernel/syscall_table_32.S
 
 if($^O eq 'linux') {
@@ -121,9 +161,26 @@ if($^O eq 'linux') {
     }
 }
 
-=item new()
+=item new(%opts)
+
+Creates a new Sys::Splice object. The object owns a pool of pipes that are 
+reused by the splice_cp() and vmsplice_tofh() methods, instead of making a 
+new pipe for every call. Options:
+
+  pipes     => Number of drained pipes kept in the pool, default 4, 0 closes
+               every pipe after use
+  pipe_size => Resize new pipes to this many bytes with F_SETPIPE_SZ, or 
+               'max' for /proc/sys/fs/pipe-max-size which is also the cap
+  io_uring  => Queue splice_batch() transfers on an io_uring with this many
+               entries, at least 2. Falls back to plain splice if io_uring is
+               missing or the ring can't be set up
+  cp_methods => Array ref with the methods splice_cp() tries in order 
+               before splice, default is to pick them from the file types
+  workers   => Number of processes splice_cp() splits file to file copies
+               over, default 1
 
-Creates a new Sys::Prctl object.
+splice_cp() splices in chunks of the pipe size the kernel reports with 
+F_GETPIPE_SZ, so large pipes mean fewer system calls per byte.
 
 =cut
 
@@ -131,83 +188,220 @@ sub new {
     my ($class, %opts) = @_;
 
     my %self = (
-    
+        pipes     => defined $opts{pipes} ? $opts{pipes} : 4,
+        pipe_size => $opts{pipe_size},
+        pool      => [],
+        cp_methods => $opts{cp_methods},
+        workers   => $opts{workers} || 1,
     );
+
+    # Both a kernel and a build without io_uring are fine, just slower
+    if($opts{io_uring} and Sys::Splice::XS::uring->can('new')) {
+        $self{ring} = eval { Sys::Splice::XS::uring->new($opts{io_uring}) };
+    }
     
     return bless \%self, (ref $class || $class);
 }
 
+=item $splice->io_uring()
 
-=item sys_splice($fd_in, $off_in, $fd_out, $off_out, $len, $flags)
-
-Direct wrapper for splice system call
+Returns the L<Sys::Splice::XS::uring> object used by splice_batch(), or undef
+if transfers are done with plain splice.
 
 =cut
 
-sub sys_splice {
-    my ($fd_in, $off_in, $fd_out, $off_out, $len, $flags) = @_;
-    syscall($SYS_splice, $fd_in, $off_in, $fd_out, $off_out, $len, $flags);
+sub io_uring {
+    my ($self) = @_;
+    return $self->{ring};
 }
 
+# Default object used when splice_cp and vmsplice_tofh are called as 
+# functions
+our $DEFAULT;
 
-=item sys_tee($fd_in, $fd_out, $len, $flags)
+sub _self {
+    my ($args) = @_;
+    if(blessed($args->[0]) and $args->[0]->isa(__PACKAGE__)) {
+        return shift @{$args};
+    }
+    return $DEFAULT ||= __PACKAGE__->new();
+}
 
-Direct wrapper for tee system call
+# Largest pipe size an unprivileged process may ask for
+sub _pipe_max_size {
+    my $size;
+    if(open my $fh, "<", "/proc/sys/fs/pipe-max-size") {
+        $size = <$fh>;
+        close $fh;
+    }
+    return ($size and $size =~ /^(\d+)/) ? $1 : $SYS_SPLICE_SIZE;
+}
 
-=cut
+# Borrow a pipe from the pool, returns ($pipe_out, $pipe_in, $pipe_size)
+sub _get_pipe {
+    my ($self) = @_;
 
-sub sys_tee {
-    my ($fd_in, $fd_out, $len, $flags) = @_;
-    syscall($SYS_tee, $fd_in, $fd_out, $len, $flags);
+    if(my $pipe = pop @{$self->{pool}}) {
+        return @{$pipe};
+    }
+    
+    pipe my $pipe_out, my $pipe_in or die ("Could not make pipe: $!");
+    
+    if(my $size = $self->{pipe_size}) {
+        my $max_size = _pipe_max_size();
+        $size = $max_size if $size eq 'max' or $size > $max_size;
+
+        # Keep the default size if the kernel refuses
+        fcntl($pipe_in, $SYS_F_SETPIPE_SZ, int $size);
+    }
+
+    # Splice in chunks of what the pipe can hold
+    my $pipe_size = fcntl($pipe_in, $SYS_F_GETPIPE_SZ, 0) || $SYS_SPLICE_SIZE;
+
+    return ($pipe_out, $pipe_in, int $pipe_size);
+}
+
+# Give a drained pipe back to the pool, pipes that are not returned are closed
+# when they go out of scope
+sub _put_pipe {
+    my ($self, @pipe) = @_;
+    
+    if(@{$self->{pool}} < $self->{pipes}) {
+        push @{$self->{pool}}, [@pipe];
+    }
 }
 
+=item sys_splice($fd_in, $off_in, $fd_out, $off_out, $len, $flags)
+
+Direct wrapper for splice system call
+
+The offsets are undef to use and move the file position. If an offset is
+defined it is used as the position instead and is advanced by the number of 
+bytes spliced, leaving the file position alone. This lets several processes 
+splice from different parts of the same file descriptor at the same time:
+
+  my $offset = $worker * $range;
+  my $end = $offset + $range;
+  while($offset < $end) {
+      my $ret = sys_splice(fileno($fh), $offset, fileno($pipe_in), undef,
+          min($SYS_SPLICE_SIZE, $end - $offset), 0);
+      ...
+  }
+
+=item sys_tee($fd_in, $fd_out, $len, $flags)
+
+Direct wrapper for tee system call
+
 =item sys_vmsplice($fd, $iov, $nr_segs, $flags)
 
 Direct wrapper for vmsplice system call
 
 =cut
 
-sub sys_vmsplice {
+our $XS = eval { require Sys::Splice::XS; 1 };
+
+if($XS) {
+    *sys_splice = \&Sys::Splice::XS::sys_splice;
+    *sys_tee = \&Sys::Splice::XS::sys_tee;
+    *sys_vmsplice = \&Sys::Splice::XS::sys_vmsplice;
+
+} else {
+    *sys_splice = \&_syscall_splice;
+    *sys_tee = \&_syscall_tee;
+    *sys_vmsplice = \&_syscall_vmsplice;
+}
+
+# Fallback versions using syscall(), these only take file descriptor numbers
+
+sub _syscall_splice {
+    my ($fd_in, $off_in, $fd_out, $off_out, $len, $flags) = @_;
+  
+    # Offsets are passed as pointers to a packed loff_t
+    my $in = defined $off_in ? pack('q', $off_in) : 0;
+    my $out = defined $off_out ? pack('q', $off_out) : 0;
+
+    my $ret = syscall($SYS_splice, $fd_in, $in, $fd_out, $out, $len, $flags);
+    
+    if($ret > 0) {
+        $_[1] = unpack('q', $in) if defined $off_in and !readonly($_[1]);
+        $_[3] = unpack('q', $out) if defined $off_out and !readonly($_[3]);
+    }
+    
+    return $ret;
+}
+
+sub _syscall_tee {
+    my ($fd_in, $fd_out, $len, $flags) = @_;
+    syscall($SYS_tee, $fd_in, $fd_out, $len, $flags);
+}
+
+sub _syscall_vmsplice {
     my ($fd, $iov, $nr_segs, $flags) = @_;
+    $iov = $iov->struct() if ref $iov;
     syscall($SYS_vmsplice, $fd, $iov, $nr_segs, $flags);
 }
 
 
 =item vmsplice_tofh($fh, @buffers)
 
-Copy a list of buffers to a file handle 
+=item $splice->vmsplice_tofh($fh, @buffers)
+
+Copy a list of buffers to a file handle, returns the number of bytes copied.
+The buffers have to fit in the pipe.
 
 =cut
 
 sub vmsplice_tofh {
+    my $self = _self(\@_);
     my ($fh, @bufs) = @_;
   
-    pipe my $pipe_out, my $pipe_in or die ("Could not make pipe: $!");
+    my ($pipe_out, $pipe_in, $pipe_size) = $self->_get_pipe();
     
-    my $vecs;
-    foreach my $buf (@bufs) {
-       $vecs .= pack('P L', $buf, length($buf));
-    }
-    
-    dump_hex($vecs);
+    my $vecs = pack_iovec(@bufs);
    
     my $nr_segs = int @bufs; 
     my $written = sys_vmsplice(fileno($pipe_in), $vecs, $nr_segs, 0);
-    print "$written\n";
     if($written < 0) {
         die "Could vmsplice: $!";
     }
 
-
-    use IO::Poll qw(POLLOUT);
     my $poll = new IO::Poll;
     $poll->mask($fh => POLLOUT);
-    # Wait until there is room in output
-    $poll->poll();
-
+    
     # splice the pipe to our file handle 
-    $written = sys_splice(fileno($pipe_out), 0, fileno($fh), 
-        0, $written, $SYS_SPLICE_F_MOVE);
+    my $left = $written;
+    while($left) {
+        # Wait until there is room in output
+        $poll->poll();
+
+        my $ret = sys_splice(fileno($pipe_out), undef, fileno($fh), 
+            undef, $left, $SYS_SPLICE_F_MOVE);
+        if($ret < 0) {
+            die "Could splice: $!";
+        }
+        $left -= $ret;
+    }
+
+    $self->_put_pipe($pipe_out, $pipe_in, $pipe_size);
+
+    return $written;
+}
+
+
+=item pack_iovec(@buffers)
+
+Pack a list of buffers into an array of C iovec structs, the layout is found 
+by Build.PL and is also available in $SYS_IOVEC_TEMPLATE and $SYS_IOVEC_SIZE.
+The buffers must stay alive and unchanged as long as the array is used.
+
+=cut
+
+sub pack_iovec {
+    my $vecs = '';
+    foreach my $buf (@_) {
+       $vecs .= pack($SYS_IOVEC_TEMPLATE, $buf, length($buf));
+    }
+    return $vecs;
 }
 
 
@@ -216,19 +410,179 @@ sub vmsplice_tofh {
 
 =item splice_cp($fh_in, $fh_out)
 
-Copy the content of one file to another by using the splice syscall
+=item $splice->splice_cp($fh_in, $fh_out)
+
+Copy the content of one file to another, returns the number of bytes copied.
+The fastest method that works for the two files is used:
+
+  copy_file_range  File to file, can be done by the file system without
+                   touching the data at all
+  sendfile         File to socket in one system call per chunk
+  splice           Anything, through a pipe from the pool
+
+If a fast path fails with EXDEV, EINVAL, ENOSYS or EOPNOTSUPP the copy goes
+on with the next one, splice always works. The fast paths need the XS backend.
+
+If the object has more than one worker a file to file copy is split in 
+aligned ranges instead, each spliced by its own process with its own pipe
+at fixed offsets. The output is given its final size with fallocate first so
+the workers never extend it at the same time. This keeps more requests in 
+flight on fast storage. The file positions are not moved in this mode.
 
 =cut
 
 sub splice_cp {
+    my $self = _self(\@_);
     my ($fh_in, $fh_out) = @_;
     my @fh_stat = stat $fh_in;
+
+    my @methods = $self->{cp_methods} ? @{$self->{cp_methods}} 
+        : _cp_methods($fh_in, $fh_out);
+    @methods = ((grep { $XS and $_ ne 'splice' } @methods), 'splice');
+
+    if($self->{workers} > 1 and -f $fh_in and -f $fh_out) {
+        $self->{cp_method} = 'parallel';
+        return $self->_cp_parallel($fh_in, $fh_out, $fh_stat[7]);
+    }
+
+    my $left = $fh_stat[7];
+    foreach my $method (@methods) {
+        $self->{cp_method} = $method;
+
+        if($method eq 'splice') {
+            $left -= $self->_cp_splice($fh_in, $fh_out, $left);
+            last;
+        }
+
+        # Everything goes through the file positions, so whatever a failed
+        # method got copied is not copied again by the next one
+        last if defined _cp_fast($method, $fh_in, $fh_out, \$left);
+    }
     
-    pipe my $pipe_out, my $pipe_in or die ("Could not make pipe: $!");
+    return $fh_stat[7] - $left;
+}
+
+=item $splice->cp_method()
+
+Returns the method the last splice_cp() ended up using, 'copy_file_range', 
+'sendfile', 'splice' or 'parallel'.
+
+=cut
+
+sub cp_method {
+    my ($self) = @_;
+    return $self->{cp_method};
+}
+
+# Look at the file types to find the methods worth trying, best first
+sub _cp_methods {
+    my ($fh_in, $fh_out) = @_;
+
+    return ('splice') if !$XS or !-f $fh_in;
+    return ('copy_file_range', 'splice') if -f $fh_out;
+    return ('sendfile', 'splice') if -S $fh_out;
+    return ('splice');
+}
+
+# Copy with copy_file_range or sendfile, returns the number of bytes copied 
+# or undef if the method does not work for these files
+sub _cp_fast {
+    my ($method, $fh_in, $fh_out, $left) = @_;
+
+    my $copied = 0;
+    while(${$left}) {
+        my $len = min($SYS_CP_CHUNK, ${$left});
+        my $ret = $method eq 'sendfile'
+            ? Sys::Splice::XS::sys_sendfile($fh_out, $fh_in, undef, $len)
+            : Sys::Splice::XS::sys_copy_file_range($fh_in, undef, $fh_out, 
+                undef, $len, 0);
+
+        if($ret < 0) {
+            next if $! == EINTR;
+            return if $CP_FALLBACK{$! + 0};
+            die "$!";
+
+        } elsif(!$ret) {
+            last;
+        }
 
-    while($fh_stat[7]) {
-        my $ret = sys_splice(fileno($fh_in), 0, fileno($pipe_in), 0, 
-            min($SYS_SPLICE_SIZE, $fh_stat[7]), $SYS_SPLICE_F_MOVE);
+        ${$left} -= $ret;
+        $copied += $ret;
+    }
+
+    return $copied;
+}
+
+# Split the copy over the workers, returns the number of bytes copied
+sub _cp_parallel {
+    my ($self, $fh_in, $fh_out, $size) = @_;
+
+    my $range = int(($size + $self->{workers} - 1) / $self->{workers});
+    $range = int(($range + $SYS_CP_ALIGN - 1) / $SYS_CP_ALIGN) * $SYS_CP_ALIGN;
+
+    if($size) {
+        my $ret = $XS ? Sys::Splice::XS::sys_fallocate($fh_out, 0, 0, $size) 
+            : -1;
+        if($ret < 0) {
+            die "$!" if $XS and $! != EOPNOTSUPP;
+            truncate $fh_out, $size or die "$!";
+        }
+    }
+
+    my @pids;
+    for(my $offset = 0; $offset < $size; $offset += $range) {
+        my $pid = fork;
+        if(!defined $pid) {
+            my $err = $!;
+            waitpid $_, 0 for @pids;
+            die "Could not fork: $err";
+
+        } elsif(!$pid) {
+            # The pipes in the pool and the ring are shared with the other
+            # workers
+            $self->{pool} = [];
+            delete $self->{ring};
+            my $len = min($range, $size - $offset);
+            my $copied = eval { $self->_cp_splice($fh_in, $fh_out, $len, 
+                $offset) };
+            POSIX::_exit(defined $copied && $copied == $len ? 0 : 1);
+        }
+        push @pids, $pid;
+    }
+
+    my $failed = 0;
+    foreach my $pid (@pids) {
+        waitpid $pid, 0;
+        $failed++ if $?;
+    }
+    die "$failed of " . int(@pids) . " workers failed" if $failed;
+
+    return $size;
+}
+
+# Copy through a pipe, returns the number of bytes copied. Goes from and to
+# the file positions, or the same $offset in both files if given.
+sub _cp_splice {
+    my ($self, $fh_in, $fh_out, $size, $offset) = @_;
+    my ($off_in, $off_out) = ($offset, $offset);
+    
+    # Run the whole copy loop in C if we can
+    if($XS) {
+        my ($result) = $self->splice_batch([fileno($fh_in), $off_in, 
+            fileno($fh_out), $off_out, $size, $SYS_SPLICE_F_MOVE]);
+        if($result->[1]) {
+            local $! = $result->[1];
+            die "$!";
+        }
+        return $result->[0];
+    }
+
+    my ($pipe_out, $pipe_in, $pipe_size) = $self->_get_pipe();
+
+    my $left = $size;
+    while($left) {
+        my $ret = sys_splice(fileno($fh_in), $off_in, fileno($pipe_in), 
+            undef, min($pipe_size, $left), $SYS_SPLICE_F_MOVE);
        
         if($ret < 0) {
             die "$!";
@@ -237,15 +591,57 @@ sub splice_cp {
             last;
         }
     
+        $left -= $ret;
         while($ret) {
-            my $written = sys_splice(fileno($pipe_out), 0, fileno($fh_out), 
-                0, $ret, $SYS_SPLICE_F_MOVE);
+            my $written = sys_splice(fileno($pipe_out), undef, 
+                fileno($fh_out), $off_out, $ret, $SYS_SPLICE_F_MOVE);
             if($written < 0) {
                 die "$!";
             }
     		$ret -= $written;
         }
     }
+
+    $self->_put_pipe($pipe_out, $pipe_in, $pipe_size);
+    
+    return $size - $left;
+}
+
+=item splice_batch(@transfers)
+
+=item $splice->splice_batch(@transfers)
+
+Run a list of transfers through a pipe from the pool, the splice loop runs in 
+C so Perl is only entered once for the whole batch. Each transfer is an array
+ref of the form:
+
+  [$fd_in, $off_in, $fd_out, $off_out, $len, $flags]
+
+$len can be undef to copy until end of file. Returns a list with an array ref
+of [$bytes, $errno] for each transfer, see L<Sys::Splice::XS>. Needs the XS 
+backend. If the object was made with the io_uring option the splices are 
+queued as linked file to pipe to file pairs on the ring instead.
+
+=cut
+
+sub splice_batch {
+    my $self = _self(\@_);
+    my (@transfers) = @_;
+
+    die "splice_batch needs Sys::Splice::XS" if !$XS;
+
+    my ($pipe_out, $pipe_in, $pipe_size) = $self->_get_pipe();
+
+    my @results = $self->{ring} 
+        ? $self->{ring}->splice_batch($pipe_out, $pipe_in, $pipe_size, 
+            @transfers)
+        : Sys::Splice::XS::splice_batch($pipe_out, $pipe_in, $pipe_size, 
+            @transfers);
+
+    # Failed transfers drain the pipe, so it is always clean here
+    $self->_put_pipe($pipe_out, $pipe_in, $pipe_size);
+
+    return @results;
 }
 
 sub min {
@@ -261,10 +657,12 @@ sub dump_hex {
     }
 }
 
+=back
+
 =head1 NOTES
 
-Currently only 32bit Linux has been tested. So test reports and patches are 
-wellcome. 
+Both 32 and 64 bit Linux are supported, the struct iovec layout is probed when
+running Build.PL.
 
 =head1 AUTHOR
 
@@ -0,0 +1,232 @@
+package Sys::Splice::Pump;
+use strict;
+use warnings;
+
+use POSIX qw(EAGAIN EINTR);
+
+use Sys::Splice qw(sys_splice);
+
+our $VERSION = '1.01';
+
+=head1 NAME
+
+Sys::Splice::Pump - Move data between two file handles without blocking
+
+=head1 DESCRIPTION
+
+A pump moves bytes from a source to a sink through an internal pipe with
+SPLICE_F_NONBLOCK, so the data never passes through user space. It never
+blocks, instead it tells what it is waiting for so it can be driven from an
+event loop like IO::EventMux, together with thousands of other pumps.
+
+The source and sink should be set non blocking, the pipe is borrowed from the
+pool of a L<Sys::Splice> object.
+
+=head1 SYNOPSIS
+
+  use strict;
+  use warnings;
+
+  use IO::Select;
+  use Sys::Splice::Pump;
+
+  my $pump = new Sys::Splice::Pump(in => $socket, out => $fh);
+
+  while(!$pump->done()) {
+      my $rsel = IO::Select->new($pump->want_read ? $pump->in : ());
+      my $wsel = IO::Select->new($pump->want_write ? $pump->out : ());
+      IO::Select->select($rsel, $wsel, undef);
+
+      $pump->step();
+  }
+
+=head1 METHODS
+
+=over
+
+=item new(%opts)
+
+Creates a new Sys::Splice::Pump object. Options:
+
+  in     => Source file handle
+  out    => Sink file handle
+  splice => Sys::Splice object to borrow the pipe from, default a new one
+
+=cut
+
+sub new {
+    my ($class, %opts) = @_;
+
+    my $splice = $opts{splice} || Sys::Splice->new(pipes => 1);
+    my ($pipe_out, $pipe_in, $pipe_size) = $splice->_get_pipe();
+
+    my %self = (
+        in        => $opts{in},
+        out       => $opts{out},
+        splice    => $splice,
+        pipe      => [$pipe_out, $pipe_in, $pipe_size],
+        buffered  => 0,
+        eof       => 0,
+        written   => 0,
+        # The source splice got EAGAIN with data in the pipe, which could be
+        # the pipe running out of slots rather than the source running dry
+        stalled   => 0,
+    );
+
+    return bless \%self, (ref $class || $class);
+}
+
+=item in()
+
+Returns the source file handle
+
+=cut
+
+sub in {
+    my ($self) = @_;
+    return $self->{in};
+}
+
+=item out()
+
+Returns the sink file handle
+
+=cut
+
+sub out {
+    my ($self) = @_;
+    return $self->{out};
+}
+
+=item want_read()
+
+Returns true if the pump is waiting for the source to become readable. The
+pipe can fill up on slots before it fills up on bytes, so after the source 
+splice would block with data in the pipe, this stays false until some of it 
+has been written to the sink.
+
+=cut
+
+sub want_read {
+    my ($self) = @_;
+    return !$self->{eof} && !$self->{stalled} && $self->{pipe}
+        && $self->{buffered} < $self->{pipe}[2];
+}
+
+=item want_write()
+
+Returns true if the pump is waiting for the sink to become writable
+
+=cut
+
+sub want_write {
+    my ($self) = @_;
+    return $self->{buffered} > 0;
+}
+
+=item done()
+
+Returns true when the source is at end of file and everything has been
+written to the sink
+
+=cut
+
+sub done {
+    my ($self) = @_;
+    return $self->{eof} && !$self->{buffered};
+}
+
+=item written()
+
+Returns the number of bytes written to the sink in total
+
+=cut
+
+sub written {
+    my ($self) = @_;
+    return $self->{written};
+}
+
+=item step()
+
+Move as much data as possible without blocking, returns the number of bytes
+written to the sink. Dies on errors other than EAGAIN and EINTR.
+
+=cut
+
+sub step {
+    my ($self) = @_;
+
+    my ($pipe_out, $pipe_in, $pipe_size) = @{$self->{pipe} || []};
+    return 0 if !$pipe_out;
+
+    my $flags = $Sys::Splice::SYS_SPLICE_F_NONBLOCK
+        | $Sys::Splice::SYS_SPLICE_F_MOVE;
+
+    my $written = 0;
+    my $progress = 1;
+    while($progress) {
+        $progress = 0;
+
+        if($self->want_read()) {
+            my $ret = sys_splice(fileno($self->{in}), undef, fileno($pipe_in),
+                undef, $pipe_size - $self->{buffered},
+                $flags | $Sys::Splice::SYS_SPLICE_F_MORE);
+
+            if($ret > 0) {
+                $self->{buffered} += $ret;
+                $progress = 1;
+
+            } elsif($ret == 0) {
+                $self->{eof} = 1;
+
+            } elsif($! == EAGAIN) {
+                $self->{stalled} = 1 if $self->{buffered};
+
+            } elsif($! != EINTR) {
+                die "splice from source: $!";
+            }
+        }
+
+        if($self->{buffered}) {
+            my $ret = sys_splice(fileno($pipe_out), undef, fileno($self->{out}),
+                undef, $self->{buffered}, $flags);
+
+            if($ret > 0) {
+                $self->{buffered} -= $ret;
+                $self->{stalled} = 0;
+                $written += $ret;
+                $progress = 1;
+
+            } elsif($ret < 0 and $! != EAGAIN and $! != EINTR) {
+                die "splice to sink: $!";
+            }
+        }
+    }
+
+    $self->{written} += $written;
+
+    # Give the drained pipe back as soon as we are done with it
+    if($self->done()) {
+        $self->{splice}->_put_pipe(@{delete $self->{pipe}});
+    }
+
+    return $written;
+}
+
+=back
+
+=head1 AUTHOR
+
+Troels Liebe Bentsen <tlb@rapanden.dk>
+
+=head1 COPYRIGHT
+
+Copyright(C) 2005-2007 Troels Liebe Bentsen
+
+This library is free software; you can redistribute it and/or modify
+it under the same terms as Perl itself.
+
+=cut
+
+1;
@@ -0,0 +1,115 @@
+package Sys::Splice::XS;
+use strict;
+use warnings;
+
+use base qw(Exporter DynaLoader);
+
+our @EXPORT_OK = qw(sys_splice sys_tee sys_vmsplice sys_sendfile 
+    sys_copy_file_range sys_fallocate splice_batch);
+our %EXPORT_TAGS = ();
+
+our $VERSION = '1.01';
+
+__PACKAGE__->bootstrap($VERSION);
+
+=head1 NAME
+
+Sys::Splice::XS - Native backend for the splice/tee/vmsplice system calls
+
+=head1 DESCRIPTION
+
+This module calls the libc splice(2), tee(2) and vmsplice(2) wrappers
+directly instead of going through Perl's generic syscall(). It is loaded by
+L<Sys::Splice> when available, so normally there is no need to use it
+directly.
+
+All file descriptor arguments can be given as a filehandle or as a plain
+file descriptor number. The return value is the same as the system call,
+on error -1 is returned and $! is set.
+
+=head1 SYNOPSIS
+
+  use strict;
+  use warnings;
+
+  use Sys::Splice::XS qw(sys_splice);
+
+  pipe my $pipe_out, my $pipe_in or die ("Could not make pipe: $!");
+  open my $fh, "<", "test.file" or die;
+
+  my $bytes = sys_splice($fh, undef, $pipe_in, undef, 4096, 0);
+  die "splice: $!" if $bytes < 0;
+
+  # Read from position 1 MiB without moving the file position
+  my $offset = 1024*1024;
+  $bytes = sys_splice($fh, $offset, $pipe_in, undef, 4096, 0);
+
+=head1 FUNCTIONS
+
+=over
+
+=item sys_splice($fd_in, $off_in, $fd_out, $off_out, $len, $flags)
+
+Call splice(2). An undef offset uses and moves the file position of the file
+descriptor. A defined offset is used as the position to read from or write to
+instead, the file position is left alone and the offset variable is advanced
+by the number of bytes spliced. Offsets can not be used on pipes.
+
+=item sys_tee($fd_in, $fd_out, $len, $flags)
+
+Call tee(2).
+
+=item sys_vmsplice($fd, $iov, $nr_segs, $flags)
+
+Call vmsplice(2), $iov is a L<Sys::Splice::iovec> object or a packed array of
+C iovec structs holding at least $nr_segs entries. An iovec object is used
+without copying, starting from its current position.
+
+=item sys_sendfile($fd_out, $fd_in, $offset, $count)
+
+Call sendfile(2). $offset works like the offsets of sys_splice().
+
+=item sys_copy_file_range($fd_in, $off_in, $fd_out, $off_out, $len, $flags)
+
+Call copy_file_range(2), offsets work like in sys_splice(). Fails with ENOSYS
+if the system headers are too old to know the system call.
+
+=item sys_fallocate($fd, $mode, $offset, $len)
+
+Call fallocate(2).
+
+=item splice_batch($pipe_out, $pipe_in, $chunk, @transfers)
+
+Run a list of transfers through the pipe without returning to Perl in between.
+Each transfer is an array ref of the form:
+
+  [$fd_in, $off_in, $fd_out, $off_out, $len, $flags]
+
+The data is spliced from $fd_in into the pipe and from the pipe to $fd_out in
+chunks of $chunk bytes, until $len bytes are copied or $fd_in is at end of
+file. A $len of undef copies the whole file. Defined offsets are used like in
+sys_splice() and are advanced in the transfer array.
+
+Returns a list with an array ref of [$bytes, $errno] for each transfer, $errno
+is 0 if the transfer did not fail, and EIO if $fd_out stopped taking data
+without an error. If a transfer fails while writing, what was left in the pipe
+is thrown away and the input offset, or the file position if it is seekable,
+is moved back to the first byte that was not written. $bytes never counts
+dropped data.
+
+=back
+
+=head1 AUTHOR
+
+Troels Liebe Bentsen <tlb@rapanden.dk>
+
+=head1 COPYRIGHT
+
+Copyright(C) 2005-2007 Troels Liebe Bentsen
+
+This library is free software; you can redistribute it and/or modify
+it under the same terms as Perl itself.
+
+=cut
+
+1;
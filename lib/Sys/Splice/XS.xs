@@ -0,0 +1,513 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include "EXTERN.h"
+#include "perl.h"
+#include "XSUB.h"
+
+#include "ppport.h"
+
+// Get splice, tee and vmsplice from libc
+#include <fcntl.h>
+#include <sys/uio.h>
+
+// sendfile from libc, copy_file_range is too new for some libcs so it is
+// called through syscall()
+#include <sys/sendfile.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// FIONREAD to see what a failed transfer left in the pipe
+#include <sys/ioctl.h>
+
+#include "XS/iovec.h"
+#include "XS/uring.h"
+
+static ssize_t
+copy_range(int fd_in, loff_t *off_in, int fd_out, loff_t *off_out,
+    size_t len, unsigned int flags)
+{
+#ifdef __NR_copy_file_range
+    return syscall(__NR_copy_file_range, fd_in, off_in, fd_out, off_out, len,
+        flags);
+#else
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+// Accept both filehandles (globs, glob refs, IO::Handle objects) and plain
+// file descriptor numbers
+static int
+sv_to_fd(pTHX_ SV *sv)
+{
+    if(SvROK(sv) || SvTYPE(sv) == SVt_PVGV) {
+        IO *io = sv_2io(sv);
+        PerlIO *fp = IoIFP(io);
+
+        if(fp == NULL)
+            croak("Filehandle is not open");
+
+        return PerlIO_fileno(fp);
+    }
+
+    return (int)SvIV(sv);
+}
+
+// Offsets are undef to use the file position, otherwise a position that is
+// passed as a loff_t pointer
+static loff_t *
+sv_to_off(pTHX_ SV *sv, loff_t *off)
+{
+    if(!SvOK(sv))
+        return NULL;
+
+    *off = (loff_t)SvIV(sv);
+    return off;
+}
+
+// Write the advanced position back, constants are left alone
+static void
+off_to_sv(pTHX_ SV *sv, loff_t *off)
+{
+    if(off != NULL && !SvREADONLY(sv))
+        sv_setiv(sv, (IV)*off);
+}
+
+// Move len bytes, or everything until end of file if len is -1, from fd_in to
+// fd_out through a pipe. Returns the number of bytes written to fd_out and
+// sets err to errno if a splice failed, or to EIO if fd_out took nothing.
+static ssize_t
+splice_move(int fd_in, loff_t *off_in, int fd_out, loff_t *off_out,
+    int pipe_out, int pipe_in, ssize_t len, size_t chunk, unsigned int flags,
+    int *err)
+{
+    ssize_t total = 0;
+
+    *err = 0;
+    while(len < 0 || total < len) {
+        size_t this_len = chunk;
+        ssize_t ret;
+
+        if(len >= 0 && (size_t)(len - total) < chunk)
+            this_len = len - total;
+
+        ret = splice(fd_in, off_in, pipe_in, NULL, this_len, flags);
+        if(ret < 0) {
+            if(errno == EINTR)
+                continue;
+            *err = errno;
+            break;
+
+        } else if(!ret) {
+            break;
+        }
+
+        while(ret > 0) {
+            ssize_t written = splice(pipe_out, NULL, fd_out, off_out, ret,
+                flags);
+            if(written < 0) {
+                if(errno == EINTR)
+                    continue;
+                *err = errno;
+                return total;
+
+            } else if(!written) {
+                // fd_out takes no more, trying again would spin forever
+                *err = EIO;
+                return total;
+            }
+            ret -= written;
+            total += written;
+        }
+    }
+
+    return total;
+}
+
+// Throw away what a failed transfer left in the pipe, so it does not end up in
+// the output of the next transfer in the batch. Returns the number of bytes
+// dropped.
+static ssize_t
+pipe_drain(int pipe_out)
+{
+    char buf[4096];
+    ssize_t dropped = 0;
+    int left;
+
+    while(ioctl(pipe_out, FIONREAD, &left) == 0 && left > 0) {
+        ssize_t ret = read(pipe_out, buf,
+            (size_t)left < sizeof(buf) ? (size_t)left : sizeof(buf));
+        if(ret < 0) {
+            if(errno == EINTR)
+                continue;
+            break;
+        } else if(!ret) {
+            break;
+        }
+        dropped += ret;
+    }
+
+    return dropped;
+}
+
+// Run one [$fd_in, $off_in, $fd_out, $off_out, $len, $flags] transfer for
+// splice_batch, through the ring if there is one. A len of undef copies until
+// end of file. Returns a mortal [$bytes, $errno] array ref. After a failure
+// the input is moved back so it only counts the bytes that reached fd_out.
+static SV *
+batch_transfer(pTHX_ SV *sv, splice_uring *ring, int pipe_out, int pipe_in,
+    size_t chunk)
+{
+    AV *transfer, *result;
+    SV **args[6];
+    loff_t in, out;
+    loff_t *pin, *pout;
+    ssize_t bytes, len;
+    unsigned int flags;
+    int i, fd_in, fd_out, err;
+
+    if(!SvROK(sv) || SvTYPE(SvRV(sv)) != SVt_PVAV)
+        croak("Transfer must be an array ref");
+
+    transfer = (AV *)SvRV(sv);
+    for(i = 0; i < 6; i++) {
+        args[i] = av_fetch(transfer, i, 1);
+    }
+
+    fd_in = sv_to_fd(aTHX_ *args[0]);
+    fd_out = sv_to_fd(aTHX_ *args[2]);
+    pin = sv_to_off(aTHX_ *args[1], &in);
+    pout = sv_to_off(aTHX_ *args[3], &out);
+    len = SvOK(*args[4]) ? (ssize_t)SvIV(*args[4]) : -1;
+    flags = (unsigned int)SvUV(*args[5]);
+
+#ifdef HAVE_IO_URING
+    if(ring != NULL)
+        bytes = uring_move(ring, fd_in, pin, fd_out, pout, pipe_out, pipe_in,
+            len, chunk, flags, &err);
+    else
+#endif
+        bytes = splice_move(fd_in, pin, fd_out, pout, pipe_out, pipe_in, len,
+            chunk, flags, &err);
+
+    if(err) {
+        ssize_t dropped = pipe_drain(pipe_out);
+
+        // Without an offset the file position was moved instead, a socket or
+        // pipe can't be rewound so the bytes are lost there
+        if(dropped > 0) {
+            if(pin != NULL)
+                *pin -= dropped;
+            else
+                lseek(fd_in, -(off_t)dropped, SEEK_CUR);
+        }
+    }
+
+    off_to_sv(aTHX_ *args[1], pin);
+    off_to_sv(aTHX_ *args[3], pout);
+
+    result = newAV();
+    av_push(result, newSViv(bytes));
+    av_push(result, newSViv(err));
+    return sv_2mortal(newRV_noinc((SV *)result));
+}
+
+MODULE = Sys::Splice::XS  PACKAGE = Sys::Splice::XS
+
+PROTOTYPES: DISABLE
+
+IV
+sys_splice(SV *fd_in, SV *off_in, SV *fd_out, SV *off_out, size_t len, unsigned int flags)
+  PREINIT:
+    loff_t in, out;
+    loff_t *pin, *pout;
+
+  CODE:
+    pin = sv_to_off(aTHX_ off_in, &in);
+    pout = sv_to_off(aTHX_ off_out, &out);
+
+    RETVAL = splice(sv_to_fd(aTHX_ fd_in), pin, sv_to_fd(aTHX_ fd_out), pout,
+        len, flags);
+
+    if(RETVAL > 0) {
+        off_to_sv(aTHX_ off_in, pin);
+        off_to_sv(aTHX_ off_out, pout);
+    }
+
+  OUTPUT:
+    RETVAL
+
+
+IV
+sys_tee(SV *fd_in, SV *fd_out, size_t len, unsigned int flags)
+  CODE:
+    RETVAL = tee(sv_to_fd(aTHX_ fd_in), sv_to_fd(aTHX_ fd_out), len, flags);
+
+  OUTPUT:
+    RETVAL
+
+
+IV
+sys_vmsplice(SV *fd, SV *iov, unsigned long nr_segs, unsigned int flags)
+  PREINIT:
+    STRLEN size;
+    char *vecs;
+
+  CODE:
+    if(sv_isobject(iov)) {
+        // Use the C array of a Sys::Splice::iovec object directly
+        splice_iovec *v = sv_to_iovec(aTHX_ iov);
+        vecs = (char *)(v->vecs + v->index);
+        size = (v->count - v->index) * sizeof(struct iovec);
+
+    } else {
+        // iov is a packed array of struct iovec
+        vecs = SvPV(iov, size);
+    }
+
+    // Never read past the end of the array
+    if(nr_segs > size / sizeof(struct iovec))
+        croak("iovec buffer holds less than %lu segments", nr_segs);
+
+    RETVAL = vmsplice(sv_to_fd(aTHX_ fd), (const struct iovec *)vecs, nr_segs,
+        flags);
+
+  OUTPUT:
+    RETVAL
+
+
+IV
+sys_sendfile(SV *fd_out, SV *fd_in, SV *offset, size_t count)
+  PREINIT:
+    loff_t off;
+    loff_t *poff;
+    off_t pos;
+
+  CODE:
+    poff = sv_to_off(aTHX_ offset, &off);
+    pos = poff != NULL ? (off_t)off : 0;
+
+    RETVAL = sendfile(sv_to_fd(aTHX_ fd_out), sv_to_fd(aTHX_ fd_in),
+        poff != NULL ? &pos : NULL, count);
+
+    if(RETVAL > 0 && poff != NULL) {
+        off = pos;
+        off_to_sv(aTHX_ offset, poff);
+    }
+
+  OUTPUT:
+    RETVAL
+
+
+IV
+sys_copy_file_range(SV *fd_in, SV *off_in, SV *fd_out, SV *off_out, size_t len, unsigned int flags)
+  PREINIT:
+    loff_t in, out;
+    loff_t *pin, *pout;
+
+  CODE:
+    pin = sv_to_off(aTHX_ off_in, &in);
+    pout = sv_to_off(aTHX_ off_out, &out);
+    RETVAL = copy_range(sv_to_fd(aTHX_ fd_in), pin,
+        sv_to_fd(aTHX_ fd_out), pout, len, flags);
+
+    if(RETVAL > 0) {
+        off_to_sv(aTHX_ off_in, pin);
+        off_to_sv(aTHX_ off_out, pout);
+    }
+
+  OUTPUT:
+    RETVAL
+
+
+IV
+sys_fallocate(SV *fd, int mode, IV offset, IV len)
+  CODE:
+    RETVAL = fallocate(sv_to_fd(aTHX_ fd), mode, offset, len);
+
+  OUTPUT:
+    RETVAL
+
+
+void
+splice_batch(SV *pipe_out, SV *pipe_in, size_t chunk, ...)
+  PREINIT:
+    int i, fd_pipe_out, fd_pipe_in;
+
+  PPCODE:
+    fd_pipe_out = sv_to_fd(aTHX_ pipe_out);
+    fd_pipe_in = sv_to_fd(aTHX_ pipe_in);
+
+    if(chunk == 0)
+        croak("Chunk size must be larger than 0");
+
+    for(i = 3; i < items; i++) {
+        XPUSHs(batch_transfer(aTHX_ ST(i), NULL, fd_pipe_out, fd_pipe_in,
+            chunk));
+    }
+
+
+MODULE = Sys::Splice::XS  PACKAGE = Sys::Splice::XS::uring  PREFIX = ring_
+
+int
+ring_available(...)
+  CODE:
+#ifdef HAVE_IO_URING
+    RETVAL = 1;
+#else
+    RETVAL = 0;
+#endif
+
+  OUTPUT:
+    RETVAL
+
+#ifdef HAVE_IO_URING
+
+SV *
+ring_new(char *class, unsigned int entries = 64)
+  PREINIT:
+    splice_uring *ring;
+
+  CODE:
+    // splice_batch needs room for at least one linked in/out pair
+    if(entries < 2)
+        croak("Ring needs at least 2 entries");
+
+    Newxz(ring, 1, splice_uring);
+    if(uring_init(ring, entries) < 0) {
+        int err = errno;
+        Safefree(ring);
+        croak("io_uring_setup: %s", strerror(err));
+    }
+
+    RETVAL = newSV(0);
+    sv_setref_pv(RETVAL, class, (void *)ring);
+
+  OUTPUT:
+    RETVAL
+
+
+unsigned int
+ring_entries(SV *self)
+  PREINIT:
+    splice_uring *ring;
+
+  CODE:
+    ring = sv_to_uring(aTHX_ self);
+    RETVAL = ring->entries;
+
+  OUTPUT:
+    RETVAL
+
+
+int
+ring_queue_splice(SV *self, SV *fd_in, SV *off_in, SV *fd_out, SV *off_out, unsigned int len, unsigned int flags, UV user_data, int link = 0)
+  PREINIT:
+    splice_uring *ring;
+    struct io_uring_sqe *sqe;
+
+  CODE:
+    ring = sv_to_uring(aTHX_ self);
+    RETVAL = 0;
+    if((sqe = uring_get_sqe(ring)) != NULL) {
+        uring_prep_splice(sqe, sv_to_fd(aTHX_ fd_in),
+            SvOK(off_in) ? (__s64)SvIV(off_in) : -1, sv_to_fd(aTHX_ fd_out),
+            SvOK(off_out) ? (__s64)SvIV(off_out) : -1, len, flags, user_data);
+        if(link)
+            sqe->flags |= IOSQE_IO_LINK;
+        RETVAL = 1;
+    }
+
+  OUTPUT:
+    RETVAL
+
+
+int
+ring_queue_tee(SV *self, SV *fd_in, SV *fd_out, unsigned int len, unsigned int flags, UV user_data, int link = 0)
+  PREINIT:
+    splice_uring *ring;
+    struct io_uring_sqe *sqe;
+
+  CODE:
+    ring = sv_to_uring(aTHX_ self);
+    RETVAL = 0;
+    if((sqe = uring_get_sqe(ring)) != NULL) {
+        uring_prep_tee(sqe, sv_to_fd(aTHX_ fd_in), sv_to_fd(aTHX_ fd_out),
+            len, flags, user_data);
+        if(link)
+            sqe->flags |= IOSQE_IO_LINK;
+        RETVAL = 1;
+    }
+
+  OUTPUT:
+    RETVAL
+
+
+IV
+ring_submit(SV *self, unsigned int wait_nr = 0)
+  PREINIT:
+    splice_uring *ring;
+
+  CODE:
+    ring = sv_to_uring(aTHX_ self);
+    RETVAL = uring_submit(ring, wait_nr);
+
+  OUTPUT:
+    RETVAL
+
+
+void
+ring_reap(SV *self)
+  PREINIT:
+    splice_uring *ring;
+    __u64 user_data;
+    int res;
+
+  PPCODE:
+    ring = sv_to_uring(aTHX_ self);
+    // Everything that has completed, as [$user_data, $res] pairs
+    while(uring_reap(ring, &user_data, &res)) {
+        AV *result = newAV();
+        av_push(result, newSVuv((UV)user_data));
+        av_push(result, newSViv(res));
+        XPUSHs(sv_2mortal(newRV_noinc((SV *)result)));
+    }
+
+
+void
+ring_splice_batch(SV *self, SV *pipe_out, SV *pipe_in, size_t chunk, ...)
+  PREINIT:
+    splice_uring *ring;
+    int i, fd_pipe_out, fd_pipe_in;
+
+  PPCODE:
+    ring = sv_to_uring(aTHX_ self);
+    fd_pipe_out = sv_to_fd(aTHX_ pipe_out);
+    fd_pipe_in = sv_to_fd(aTHX_ pipe_in);
+
+    if(chunk == 0)
+        croak("Chunk size must be larger than 0");
+
+    // The transfers count completions, so they need the ring to themselves
+    if(ring->sq_pending || ring->inflight)
+        croak("Ring has requests that are not reaped");
+
+    for(i = 4; i < items; i++) {
+        XPUSHs(batch_transfer(aTHX_ ST(i), ring, fd_pipe_out, fd_pipe_in,
+            chunk));
+    }
+
+
+void
+ring_DESTROY(SV *self)
+  PREINIT:
+    splice_uring *ring;
+
+  CODE:
+    ring = sv_to_uring(aTHX_ self);
+    uring_free(ring);
+    Safefree(ring);
+
+#endif
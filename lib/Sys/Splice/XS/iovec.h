@@ -0,0 +1,29 @@
+#ifndef SYS_SPLICE_IOVEC_H
+#define SYS_SPLICE_IOVEC_H
+
+// Get iovec struck
+#include <sys/uio.h>
+
+#define IOVEC_CLASS "Sys::Splice::XS::iovec"
+
+// Vector of buffers, vecs[index..count) are in flight and the buffers they
+// point to are pinned. vecs[index] is advanced offset bytes into its buffer.
+typedef struct {
+    struct iovec *vecs;
+    SV **bufs;
+    size_t count;
+    size_t alloc;
+    size_t index;
+    size_t offset;
+} splice_iovec;
+
+static splice_iovec *
+sv_to_iovec(pTHX_ SV *sv)
+{
+    if(!sv_isobject(sv) || !sv_derived_from(sv, IOVEC_CLASS))
+        croak("Not a %s object", IOVEC_CLASS);
+
+    return INT2PTR(splice_iovec *, SvIV(SvRV(sv)));
+}
+
+#endif
@@ -2,27 +2,338 @@
 #include "perl.h"
 #include "XSUB.h"
 
-// Get iovec struck
-#include "sys/uio.h"
+#include "../ppport.h"
 
-MODULE = Sys::Splice::XS::iovec  PACKAGE = Sys::Splice::XS::iovec  PREFIX = iov
+#include "iovec.h"
 
+// Buffers are pinned by setting them read only while the kernel might still
+// be reading them. A buffer can be in several vectors at once, so the pin
+// count and the original read only flag are kept in magic on the buffer.
+static MGVTBL pin_vtbl;
+
+static MAGIC *
+pin_find(pTHX_ SV *sv)
+{
+    MAGIC *mg;
+
+    if(SvTYPE(sv) < SVt_PVMG)
+        return NULL;
+
+    for(mg = SvMAGIC(sv); mg != NULL; mg = mg->mg_moremagic) {
+        if(mg->mg_type == PERL_MAGIC_ext && mg->mg_virtual == &pin_vtbl)
+            return mg;
+    }
+
+    return NULL;
+}
+
+static void
+pin(pTHX_ SV *sv)
+{
+    MAGIC *mg = pin_find(aTHX_ sv);
+
+    if(mg == NULL) {
+        mg = sv_magicext(sv, NULL, PERL_MAGIC_ext, &pin_vtbl, NULL, 0);
+        mg->mg_len = 0;
+    }
+
+    if(mg->mg_len++ == 0) {
+        mg->mg_private = SvREADONLY(sv) ? 1 : 0;
+        SvREADONLY_on(sv);
+    }
+}
+
+static void
+unpin(pTHX_ SV *sv)
+{
+    MAGIC *mg = pin_find(aTHX_ sv);
+
+    if(mg != NULL && mg->mg_len > 0 && --mg->mg_len == 0 && !mg->mg_private)
+        SvREADONLY_off(sv);
+}
+
+// Point vecs[i] at its buffer, skipping the first offset bytes
+static void
+iov_load(pTHX_ splice_iovec *iov, size_t i, size_t offset)
+{
+    STRLEN len;
+    char *buf = SvPV(iov->bufs[i], len);
+
+    iov->vecs[i].iov_base = buf + offset;
+    iov->vecs[i].iov_len = len - offset;
+}
+
+static void
+iov_grow(splice_iovec *iov, size_t n)
+{
+    if(iov->count + n <= iov->alloc)
+        return;
+
+    iov->alloc = iov->alloc ? iov->alloc * 2 : 4;
+    if(iov->alloc < iov->count + n)
+        iov->alloc = iov->count + n;
+
+    Renew(iov->vecs, iov->alloc, struct iovec);
+    Renew(iov->bufs, iov->alloc, SV *);
+}
+
+// Buffers are given as scalar refs or as the scalar itself
+static SV *
+iov_buf(pTHX_ SV *arg)
+{
+    SV *sv = SvROK(arg) ? SvRV(arg) : arg;
+
+    if(SvTYPE(sv) >= SVt_PVAV)
+        croak("Buffer must be a scalar");
+
+    return sv;
+}
+
+// Croak on anything that is not a usable buffer, before any state changes
+static void
+iov_check(pTHX_ SV **args, size_t n)
+{
+    size_t j;
+
+    for(j = 0; j < n; j++) {
+        // Make sure the buffer is a string before it is made read only
+        (void)SvPV_nolen(iov_buf(aTHX_ args[j]));
+    }
+}
+
+// Insert n buffers from args at position i
+static void
+iov_insert(pTHX_ splice_iovec *iov, size_t i, SV **args, size_t n)
+{
+    size_t j;
+    int in_flight;
+
+    iov_check(aTHX_ args, n);
+    iov_grow(iov, n);
+
+    Move(iov->vecs + i, iov->vecs + i + n, iov->count - i, struct iovec);
+    Move(iov->bufs + i, iov->bufs + i + n, iov->count - i, SV *);
+    iov->count += n;
+
+    // Buffers inserted in front of the pointer count as already consumed,
+    // the pointer stays at the start if nothing has been consumed yet
+    in_flight = i > iov->index || (i == iov->index && iov->offset == 0);
+    if(!in_flight)
+        iov->index += n;
+
+    for(j = 0; j < n; j++) {
+        iov->bufs[i + j] = SvREFCNT_inc(iov_buf(aTHX_ args[j]));
+        if(in_flight)
+            pin(aTHX_ iov->bufs[i + j]);
+        iov_load(aTHX_ iov, i + j, 0);
+    }
+}
+
+// Remove the buffer at position i and return a reference to it
+static SV *
+iov_remove(pTHX_ splice_iovec *iov, size_t i)
+{
+    SV *sv = iov->bufs[i];
+
+    if(i >= iov->index)
+        unpin(aTHX_ sv);
+
+    if(i < iov->index) {
+        iov->index--;
+
+    } else if(i == iov->index) {
+        // Pointer moves to the start of the next buffer
+        iov->offset = 0;
+    }
+
+    iov->count--;
+    Move(iov->vecs + i + 1, iov->vecs + i, iov->count - i, struct iovec);
+    Move(iov->bufs + i + 1, iov->bufs + i, iov->count - i, SV *);
+
+    return newRV_noinc(sv);
+}
+
+MODULE = Sys::Splice::XS::iovec  PACKAGE = Sys::Splice::XS::iovec  PREFIX = iov_
+
+PROTOTYPES: DISABLE
 
 SV *
 iov_new(char *class, ...)
   PREINIT:
-    iovec[] iov;
+    splice_iovec *iov;
+
+  CODE:
+    // Nothing owns iov until it is blessed, so a bad buffer must croak
+    // before it is allocated
+    iov_check(aTHX_ &ST(1), items - 1);
+
+    Newxz(iov, 1, splice_iovec);
+    if(items > 1)
+        iov_insert(aTHX_ iov, 0, &ST(1), items - 1);
+
+    RETVAL = newSV(0);
+    sv_setref_pv(RETVAL, class, (void*) iov);
+
+  OUTPUT:
+    RETVAL
+
+
+SV *
+iov_struct(SV *self)
+  PREINIT:
+    splice_iovec *iov;
+
+  CODE:
+    // Return iov's still within index
+    iov = sv_to_iovec(aTHX_ self);
+    RETVAL = newSVpvn((char *)(iov->vecs + iov->index),
+        (iov->count - iov->index) * sizeof(struct iovec));
+
+  OUTPUT:
+    RETVAL
+
+
+IV
+iov_empty(SV *self)
+  PREINIT:
+    splice_iovec *iov;
+
+  CODE:
+    iov = sv_to_iovec(aTHX_ self);
+    RETVAL = iov->index == iov->count;
+
+  OUTPUT:
+    RETVAL
+
+
+UV
+iov_size(SV *self)
+  PREINIT:
+    splice_iovec *iov;
 
   CODE:
-    if(items == 0) croak "No buffers given";
-    
-    RETVAL = sv_newmortal(); // Set default to undef
-    
-    iovec = safemalloc(items * sizeof(iovec));
-    sv_setref_pv(RETVAL, class, (void*) h); 
-    
-    RETVAL = iovec;
+    iov = sv_to_iovec(aTHX_ self);
+    RETVAL = iov->count - iov->index;
 
   OUTPUT:
     RETVAL
 
+
+void
+iov_inc(SV *self, UV n)
+  PREINIT:
+    splice_iovec *iov;
+    struct iovec *vec;
+
+  CODE:
+    iov = sv_to_iovec(aTHX_ self);
+
+    // Release every buffer that has been consumed
+    while(iov->index < iov->count && n >= iov->vecs[iov->index].iov_len) {
+        n -= iov->vecs[iov->index].iov_len;
+        unpin(aTHX_ iov->bufs[iov->index]);
+        iov->index++;
+        iov->offset = 0;
+    }
+
+    if(n > 0) {
+        if(iov->index == iov->count)
+            croak("Cannot increment past end of buffer");
+
+        vec = iov->vecs + iov->index;
+        vec->iov_base = (char *)vec->iov_base + n;
+        vec->iov_len -= n;
+        iov->offset += n;
+    }
+
+
+void
+iov_dec(SV *self, UV n)
+  PREINIT:
+    splice_iovec *iov;
+
+  CODE:
+    iov = sv_to_iovec(aTHX_ self);
+
+    while(n > iov->offset) {
+        if(iov->index == 0)
+            croak("Cannot decrement past start of buffer");
+
+        n -= iov->offset;
+        if(iov->index < iov->count)
+            iov_load(aTHX_ iov, iov->index, 0);
+
+        // Move to the end of the previous buffer and pin it again
+        iov->index--;
+        pin(aTHX_ iov->bufs[iov->index]);
+        iov_load(aTHX_ iov, iov->index, 0);
+        iov->offset = iov->vecs[iov->index].iov_len;
+    }
+
+    if(iov->index < iov->count) {
+        iov->offset -= n;
+        iov_load(aTHX_ iov, iov->index, iov->offset);
+    }
+
+
+void
+iov_push(SV *self, ...)
+  CODE:
+    if(items > 1) {
+        splice_iovec *iov = sv_to_iovec(aTHX_ self);
+        iov_insert(aTHX_ iov, iov->count, &ST(1), items - 1);
+    }
+
+
+void
+iov_unshift(SV *self, ...)
+  CODE:
+    if(items > 1)
+        iov_insert(aTHX_ sv_to_iovec(aTHX_ self), 0, &ST(1), items - 1);
+
+
+SV *
+iov_pop(SV *self)
+  PREINIT:
+    splice_iovec *iov;
+
+  CODE:
+    iov = sv_to_iovec(aTHX_ self);
+    RETVAL = iov->count ? iov_remove(aTHX_ iov, iov->count - 1)
+        : &PL_sv_undef;
+
+  OUTPUT:
+    RETVAL
+
+
+SV *
+iov_shift(SV *self)
+  PREINIT:
+    splice_iovec *iov;
+
+  CODE:
+    iov = sv_to_iovec(aTHX_ self);
+    RETVAL = iov->count ? iov_remove(aTHX_ iov, 0) : &PL_sv_undef;
+
+  OUTPUT:
+    RETVAL
+
+
+void
+iov_DESTROY(SV *self)
+  PREINIT:
+    splice_iovec *iov;
+    size_t i;
+
+  CODE:
+    iov = sv_to_iovec(aTHX_ self);
+
+    for(i = 0; i < iov->count; i++) {
+        if(i >= iov->index)
+            unpin(aTHX_ iov->bufs[i]);
+        SvREFCNT_dec(iov->bufs[i]);
+    }
+
+    Safefree(iov->vecs);
+    Safefree(iov->bufs);
+    Safefree(iov);
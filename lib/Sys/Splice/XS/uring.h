@@ -0,0 +1,336 @@
+#ifndef SYS_SPLICE_URING_H
+#define SYS_SPLICE_URING_H
+
+#define URING_CLASS "Sys::Splice::XS::uring"
+
+typedef struct splice_uring splice_uring;
+
+#ifdef HAVE_IO_URING
+
+// No liburing, talk to the kernel with the raw system calls
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+
+// Submission and completion rings shared with the kernel. sq_pending counts
+// the entries filled in but not yet handed over in *sq_tail, inflight the
+// submitted entries that have not been reaped.
+struct splice_uring {
+    int fd;
+    unsigned entries;
+    unsigned sq_pending;
+    unsigned inflight;
+
+    void *sq_ptr, *cq_ptr;
+    size_t sq_size, cq_size;
+
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    struct io_uring_sqe *sqes;
+    size_t sqes_size;
+
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_cqe *cqes;
+};
+
+static splice_uring *
+sv_to_uring(pTHX_ SV *sv)
+{
+    if(!sv_isobject(sv) || !sv_derived_from(sv, URING_CLASS))
+        croak("Not a %s object", URING_CLASS);
+
+    return INT2PTR(splice_uring *, SvIV(SvRV(sv)));
+}
+
+static void
+uring_free(splice_uring *ring)
+{
+    if(ring->sqes != NULL && ring->sqes != MAP_FAILED)
+        munmap(ring->sqes, ring->sqes_size);
+    if(ring->cq_ptr != NULL && ring->cq_ptr != MAP_FAILED
+            && ring->cq_ptr != ring->sq_ptr)
+        munmap(ring->cq_ptr, ring->cq_size);
+    if(ring->sq_ptr != NULL && ring->sq_ptr != MAP_FAILED)
+        munmap(ring->sq_ptr, ring->sq_size);
+    if(ring->fd >= 0)
+        close(ring->fd);
+}
+
+// Set up a ring with room for at least entries submissions, returns -1 and
+// sets errno on failure
+static int
+uring_init(splice_uring *ring, unsigned entries)
+{
+    struct io_uring_params p;
+    char *sq, *cq;
+
+    memset(ring, 0, sizeof(*ring));
+    memset(&p, 0, sizeof(p));
+
+    ring->fd = syscall(__NR_io_uring_setup, entries, &p);
+    if(ring->fd < 0)
+        return -1;
+
+    ring->entries = p.sq_entries;
+    ring->sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    ring->cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+
+    // Newer kernels map both rings in one go
+    if(p.features & IORING_FEAT_SINGLE_MMAP) {
+        if(ring->cq_size > ring->sq_size)
+            ring->sq_size = ring->cq_size;
+        ring->cq_size = ring->sq_size;
+    }
+
+    ring->sq_ptr = mmap(NULL, ring->sq_size, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    if(ring->sq_ptr == MAP_FAILED)
+        goto fail;
+
+    if(p.features & IORING_FEAT_SINGLE_MMAP) {
+        ring->cq_ptr = ring->sq_ptr;
+    } else {
+        ring->cq_ptr = mmap(NULL, ring->cq_size, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+        if(ring->cq_ptr == MAP_FAILED)
+            goto fail;
+    }
+
+    ring->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if(ring->sqes == MAP_FAILED)
+        goto fail;
+
+    sq = ring->sq_ptr;
+    ring->sq_head = (unsigned *)(sq + p.sq_off.head);
+    ring->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+    ring->sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+    ring->sq_array = (unsigned *)(sq + p.sq_off.array);
+
+    cq = ring->cq_ptr;
+    ring->cq_head = (unsigned *)(cq + p.cq_off.head);
+    ring->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+    ring->cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+
+    return 0;
+
+fail:
+    {
+        int err = errno;
+        uring_free(ring);
+        errno = err;
+    }
+    return -1;
+}
+
+// Next free submission entry, NULL if the ring is full
+static struct io_uring_sqe *
+uring_get_sqe(splice_uring *ring)
+{
+    unsigned head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+    unsigned tail = *ring->sq_tail + ring->sq_pending;
+    unsigned index;
+    struct io_uring_sqe *sqe;
+
+    if(tail - head >= ring->entries)
+        return NULL;
+
+    index = tail & *ring->sq_mask;
+    sqe = &ring->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    ring->sq_array[index] = index;
+    ring->sq_pending++;
+
+    return sqe;
+}
+
+// Hand the queued entries to the kernel and wait for wait_nr completions,
+// returns the number of entries submitted or -1 with errno set
+static int
+uring_submit(splice_uring *ring, unsigned wait_nr)
+{
+    unsigned submit = ring->sq_pending;
+    int ret;
+
+    __atomic_store_n(ring->sq_tail, *ring->sq_tail + submit, __ATOMIC_RELEASE);
+    ring->sq_pending = 0;
+    ring->inflight += submit;
+
+    do {
+        ret = syscall(__NR_io_uring_enter, ring->fd, submit, wait_nr,
+            wait_nr ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+        // Everything was handed over on the first call, only wait again
+        if(ret >= 0 || errno != EINTR)
+            break;
+        submit = 0;
+    } while(1);
+
+    return ret;
+}
+
+// Pop one completion, returns 0 if there are none
+static int
+uring_reap(splice_uring *ring, __u64 *user_data, int *res)
+{
+    unsigned head = *ring->cq_head;
+    struct io_uring_cqe *cqe;
+
+    if(head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE))
+        return 0;
+
+    cqe = &ring->cqes[head & *ring->cq_mask];
+    *user_data = cqe->user_data;
+    *res = cqe->res;
+
+    __atomic_store_n(ring->cq_head, head + 1, __ATOMIC_RELEASE);
+    ring->inflight--;
+    return 1;
+}
+
+// An offset of -1 means use and advance the file position, like a NULL
+// pointer to splice()
+static void
+uring_prep_splice(struct io_uring_sqe *sqe, int fd_in, __s64 off_in,
+    int fd_out, __s64 off_out, unsigned len, unsigned flags, __u64 user_data)
+{
+    sqe->opcode = IORING_OP_SPLICE;
+    sqe->fd = fd_out;
+    sqe->off = off_out;
+    sqe->splice_fd_in = fd_in;
+    sqe->splice_off_in = off_in;
+    sqe->len = len;
+    sqe->splice_flags = flags;
+    sqe->user_data = user_data;
+}
+
+static void
+uring_prep_tee(struct io_uring_sqe *sqe, int fd_in, int fd_out, unsigned len,
+    unsigned flags, __u64 user_data)
+{
+    sqe->opcode = IORING_OP_TEE;
+    sqe->fd = fd_out;
+    sqe->splice_fd_in = fd_in;
+    sqe->len = len;
+    sqe->splice_flags = flags;
+    sqe->user_data = user_data;
+}
+
+// Completions of uring_move are tagged with the direction
+#define URING_MOVE_IN  0
+#define URING_MOVE_OUT 1
+
+// Same as splice_move, but every round queues a chain of fd_in -> pipe ->
+// fd_out splice pairs linked with IOSQE_IO_LINK and reaps all completions in
+// one go. A short splice breaks the chain and the rest is cancelled, what
+// was left in the pipe is drained at the start of the next round. If the
+// move fails the pipe can still hold data and off_in counts it, the caller
+// has to drain the pipe and move the input back.
+static ssize_t
+uring_move(splice_uring *ring, int fd_in, loff_t *off_in, int fd_out,
+    loff_t *off_out, int pipe_out, int pipe_in, ssize_t len, size_t chunk,
+    unsigned int flags, int *err)
+{
+    ssize_t total = 0, spliced = 0;
+    int eof = 0;
+
+    *err = 0;
+    while(!*err) {
+        struct io_uring_sqe *sqe, *last = NULL;
+        ssize_t queued = spliced;
+        unsigned n = 0;
+        __u64 user_data;
+        int res;
+
+        // Drain what a broken chain left in the pipe
+        if(spliced > total && (sqe = uring_get_sqe(ring)) != NULL) {
+            uring_prep_splice(sqe, pipe_out, -1, fd_out,
+                off_out ? *off_out + total : -1, spliced - total, flags,
+                URING_MOVE_OUT);
+            last = sqe;
+            n++;
+        }
+
+        while(!eof && (len < 0 || queued < len)
+                && ring->entries - n >= 2) {
+            size_t this_len = chunk;
+
+            if(len >= 0 && (size_t)(len - queued) < chunk)
+                this_len = len - queued;
+
+            if(last != NULL)
+                last->flags |= IOSQE_IO_LINK;
+
+            sqe = uring_get_sqe(ring);
+            uring_prep_splice(sqe, fd_in, off_in ? *off_in + queued : -1,
+                pipe_in, -1, this_len, flags, URING_MOVE_IN);
+            sqe->flags |= IOSQE_IO_LINK;
+
+            last = uring_get_sqe(ring);
+            uring_prep_splice(last, pipe_out, -1, fd_out,
+                off_out ? *off_out + queued : -1, this_len, flags,
+                URING_MOVE_OUT);
+
+            queued += this_len;
+            n += 2;
+        }
+
+        if(!n)
+            break;
+
+        if(uring_submit(ring, n) < 0) {
+            *err = errno;
+            break;
+        }
+
+        // Cancelled links complete too, so exactly n completions come back
+        while(n > 0) {
+            if(!uring_reap(ring, &user_data, &res)) {
+                if(uring_submit(ring, n) < 0) {
+                    *err = errno;
+                    break;
+                }
+                continue;
+            }
+            n--;
+
+            if(res == -ECANCELED) {
+                continue;
+
+            } else if(res < 0) {
+                if(res != -EINTR && res != -EAGAIN && !*err)
+                    *err = -res;
+
+            } else if(user_data == URING_MOVE_IN) {
+                if(res == 0)
+                    eof = 1;
+                spliced += res;
+
+            } else if(res == 0) {
+                // Same as splice_move, draining again would never end
+                if(!*err)
+                    *err = EIO;
+
+            } else {
+                total += res;
+            }
+        }
+
+        if(eof && spliced == total)
+            break;
+    }
+
+    if(off_in != NULL)
+        *off_in += spliced;
+    if(off_out != NULL)
+        *off_out += total;
+
+    return total;
+}
+
+#endif
+
+#endif
@@ -0,0 +1,109 @@
+package Sys::Splice::XS::uring;
+use strict;
+use warnings;
+
+# The ring lives in Sys::Splice::XS so it can share the transfer loop
+use Sys::Splice::XS;
+
+our $VERSION = '1.01';
+
+=head1 NAME
+
+Sys::Splice::XS::uring - io_uring backend for Sys::Splice
+
+=head1 DESCRIPTION
+
+A small io_uring(7) ring set up with the raw system calls, for queuing
+IORING_OP_SPLICE and IORING_OP_TEE requests. It is used by L<Sys::Splice>
+objects made with the io_uring option, where splice_batch() queues each chunk
+as a file to pipe and pipe to file pair linked with IOSQE_IO_LINK and reaps
+all completions of a round at once, instead of making two system calls per
+chunk.
+
+The ring is only built if Build.PL finds a linux/io_uring.h with splice
+support, check available() before calling new().
+
+=head1 SYNOPSIS
+
+  use strict;
+  use warnings;
+
+  use Sys::Splice::XS::uring;
+
+  die "No io_uring" if !Sys::Splice::XS::uring::available();
+  my $ring = new Sys::Splice::XS::uring(64);
+
+  pipe my $pipe_out, my $pipe_in or die ("Could not make pipe: $!");
+
+  # Copy 4096 bytes from offset 0 through the pipe
+  $ring->queue_splice($fh_in, 0, $pipe_in, undef, 4096, 0, 1, 1);
+  $ring->queue_splice($pipe_out, undef, $fh_out, 0, 4096, 0, 2);
+  $ring->submit(2);
+
+  foreach my $cqe ($ring->reap()) {
+      my ($user_data, $res) = @{$cqe};
+  }
+
+=head1 METHODS
+
+=over
+
+=item available()
+
+Returns true if io_uring support was compiled in. The kernel can still say
+no, in which case new() dies.
+
+=item new($entries)
+
+Sets up a ring with room for at least $entries submissions, default 64.
+Dies if io_uring_setup(2) fails or $entries is less than 2, splice_batch()
+needs room for a linked pair.
+
+=item entries()
+
+Returns the number of submission entries the kernel gave the ring.
+
+=item queue_splice($fd_in, $off_in, $fd_out, $off_out, $len, $flags, $user_data, $link)
+
+Queues a splice, offsets are undef to use the file position. Nothing is
+written back to the offsets. If $link is true the next request queued only
+starts when this one has completed in full, otherwise it is cancelled.
+Returns false if the submission ring is full.
+
+=item queue_tee($fd_in, $fd_out, $len, $flags, $user_data, $link)
+
+Queues a tee, like queue_splice().
+
+=item submit($wait_nr)
+
+Hands the queued requests to the kernel and waits for $wait_nr completions,
+default 0. Returns the number of requests submitted, or -1 with $! set.
+
+=item reap()
+
+Returns a list with an array ref of [$user_data, $res] for each completed
+request. $res is the system call return value or minus errno, cancelled links
+give -ECANCELED.
+
+=item splice_batch($pipe_out, $pipe_in, $chunk, @transfers)
+
+Same as splice_batch() in L<Sys::Splice::XS>, but each round fills the ring
+with linked chunk pairs. The ring has to be idle, dies if there are requests
+that are not reaped.
+
+=back
+
+=head1 AUTHOR
+
+Troels Liebe Bentsen <tlb@rapanden.dk>
+
+=head1 COPYRIGHT
+
+Copyright(C) 2005-2007 Troels Liebe Bentsen
+
+This library is free software; you can redistribute it and/or modify
+it under the same terms as Perl itself.
+
+=cut
+
+1;
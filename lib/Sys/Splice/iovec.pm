@@ -1,9 +1,10 @@
 package Sys::Splice::iovec;
 use strict;
 use warnings;
-use Carp;
 
-use base "Exporter";
+use Sys::Splice::XS::iovec;
+
+use base qw(Exporter Sys::Splice::XS::iovec);
 
 our @EXPORT_OK = qw(dumphex);
 our %EXPORT_TAGS = ();
@@ -18,6 +19,10 @@ Sys::Splice::iovec - Simple interface to working with C iovec structs as used by
 
 This is simple module that wraps the a C iovec struct
 
+The iovec array is kept in C memory, so moving the pointer does not copy
+anything. Buffers are kept read only while they are between the pointer and
+the end of the vector, as the kernel might still be reading them.
+
 =head1 SYNOPSIS
   
   use strict;
@@ -29,7 +34,7 @@ This is simple module that wraps the a C iovec struct
   my $buf2 = "Hello2";
 
   # points to start of buf1
-  $iov = new Sys::Splice::iovec($buf1, $buf2);
+  my $iov = new Sys::Splice::iovec(\$buf1, \$buf2);
   
   # points to start of buf2
   $iov->inc(6);
@@ -37,6 +42,9 @@ This is simple module that wraps the a C iovec struct
   # points to e in buf1
   $iov->dec(5);
 
+  # Write everything from the pointer to a pipe
+  sys_vmsplice($pipe_in, $iov, $iov->size(), 0);
+
 
 =head1 METHODS
 
@@ -44,172 +52,59 @@ This is simple module that wraps the a C iovec struct
 
 =cut
 
-=item new()
-
-Creates a new Sys::Splice::iovec object.
-
-=cut
-
-sub new {
-    my ($class, @buffers) = @_;
-
-    my %self = (
-        buffers => [@buffers],
-        index  => 0,
-        offset => 0,
-        struct => '',
-        empty  => 0,
-    );
+=item new(@buffers)
 
-    my $vecs;
-    foreach my $buf (@buffers) {
-        $vecs .= pack('P L', $$buf, length($$buf));
-    }
-
-    $self{struct} = $vecs;
-
-    return bless \%self, (ref $class || $class);
-}
+Creates a new Sys::Splice::iovec object. Buffers are given as scalar refs.
 
-=item struct($int);
+=item struct()
 
-Return C data structure
-
-=cut
-
-sub struct {
-    my ($self) = @_;
-    # Return iov's still within index
-    substr($self->{struct}, $self->{index} * 8);
-}
+Return C data structure for the buffers from the current position
 
-
-=item empty
+=item empty()
 
 Returns true if no more is left in the buffer
 
-=cut
-
-sub empty {
-    my ($self) = @_;
-    return $self->{empty};
-}
-
-
-=item size
+=item size()
 
 Returns the number of vecs in object
 
-=cut
+=item inc($int)
 
-sub size {
-    my ($self) = @_;
-    return @{$self->{buffers}} - $self->{index};
-}
+Increment pointer with $int bytes, moving to another buffer if necessary.
+Buffers that are passed are no longer read only.
 
-=item inc($int);
+=item dec($int)
 
-Increment pointer with $int bytes, moving to another buffer if necessary
+Decrement pointer with $int bytes, moving to another buffer if necessary.
+Buffers that are moved back into are made read only again.
 
-=cut
+=item unshift(@buffers)
 
-sub inc {
-    my ($self, $n) = @_;
+Add new buffers to start of vector. If nothing has been consumed the pointer
+stays at the start, otherwise the new buffers count as consumed.
 
-    my $offset = $self->{offset} + $n;
-    my $index = $self->{index};
-    my $buf = $self->{buffers}[$self->{index}]; 
-    my $length = length $$buf;
+=item shift()
 
-    croak "Cannot increment past end of buffer" if !defined $buf;
+Remove buffer from start of vector and correct pointer if necessary, returns
+a ref to the buffer
 
-    while($length <= $offset and $index < @{$self->{buffers}}) {
-        $offset = $offset-$length;
-        $index += 1; 
-        $buf = $self->{buffers}[$index];
-        
-        if(!defined $buf) {
-            $self->{empty} = 1;
-            $self->{index} += 1;
-            return;
-        }
+=item push(@buffers)
 
-        $length = length $$buf;
-    }
+Add new buffers to end of vector 
 
-    print "lenght,offset: $length, $offset\n";
-    
-    # Increment pointer and set new length
-    substr($self->{struct}, $index * 8, 8, pack("L!L", 
-        unpack("L!", pack('P', $$buf)) # Get memory address of $$buf
-        + $offset, $length-$offset));
+=item pop()
 
-    $self->{offset} = $offset;
-    $self->{index} = $index;
-}
+Remove buffer from end of vector and correct pointer if necessary, returns a
+ref to the buffer
 
-=item dec($int);
+=item dumphex($str)
 
-FIXME: Not implemented
+Print a hex dump of $str
 
-Decrement pointer with $int bytes, moving to another buffer if necessary
+=back
 
 =cut
 
-sub dec {
-    my ($self, $int) = @_;
-}
-
-
-=item unshift($buf);
-
-FIXME: Not implemented
-
-Add new buffer to start of vector 
-
-=cut
-
-sub unshift {
-    my ($self, $int) = @_;
-}
-
-=item shift($buf);
-
-FIXME: Not implemented
-
-Remove buffer from start of vector and correct pointer if necessary 
-
-=cut
-
-sub shift {
-    my ($self, $int) = @_;
-}
-
-
-=item push($buf);
-
-FIXME: Not implemented
-
-Add new buffer to end of vector 
-
-=cut
-
-sub push {
-    my ($self, $int) = @_;
-}
-
-=item pop($buf);
-
-FIXME: Not implemented
-
-Remove buffer from end of vector and correct pointer if necessary 
-
-=cut
-
-sub pop {
-    my ($self, $int) = @_;
-}
-
 sub dumphex {
     my ($str) = @_;
     for(my $i=0; $i < length($str); $i++) {
@@ -219,11 +114,6 @@ sub dumphex {
     }
 }
 
-=head1 NOTES
-
-Currently only 32bit Linux has been tested. So test reports and patches are 
-wellcome. 
-
 =head1 AUTHOR
 
 Troels Liebe Bentsen <tlb@rapanden.dk> 
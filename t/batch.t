@@ -0,0 +1,77 @@
+use strict;
+use warnings;
+
+use Test::More;
+
+use POSIX qw(EBADF);
+use Sys::Splice qw(splice_batch);
+
+plan skip_all => "splice_batch needs Sys::Splice::XS" if !$Sys::Splice::XS;
+plan tests => 14;
+
+my $file = "/tmp/batch.file.$$";
+
+open my $fh, ">", $file or die "Could not open file: $!";
+print {$fh} "0123456789" x 10000;
+close $fh;
+
+open my $fh_in, "<", $file or die "Could not open file: $!";
+open my $fh_a, "+>", "$file.a" or die "Could not open file: $!";
+open my $fh_b, "+>", "$file.b" or die "Could not open file: $!";
+
+my $splice = new Sys::Splice(pipes => 1, pipe_size => 4096);
+
+# 20 bytes from offset 5, to offset 0
+my $range = [fileno($fh_in), 5, fileno($fh_b), 0, 20, 0];
+my @results = $splice->splice_batch(
+    # Whole file
+    [fileno($fh_in), undef, fileno($fh_a), undef, undef, 0],
+    $range,
+);
+
+is_deeply($results[0], [100000, 0], "Whole file copied");
+is_deeply($results[1], [20, 0], "Range copied");
+is($range->[1], 25, "Input offset is advanced");
+is($range->[3], 20, "Output offset is advanced");
+is(-s "$file.a", 100000, "Copy has the same size");
+
+sysseek $fh_b, 0, 0;
+sysread $fh_b, my $data, 1024;
+is($data, "56789012345678901234", "Range has the right content");
+
+is(int @{$splice->{pool}}, 1, "Pipe is given back after a good batch");
+
+@results = $splice->splice_batch([-1, undef, fileno($fh_a), undef, 10, 0]);
+is_deeply($results[0], [0, EBADF], "Failed transfer reports errno");
+
+# A transfer that fails while writing must not leak into the next one
+open my $fh_ro, "<", "$file.b" or die "Could not open file: $!";
+open my $fh_src, "+>", "$file.src" or die "Could not open file: $!";
+print {$fh_src} "A" x 1000, "B" x 1000;
+close $fh_src;
+open $fh_src, "<", "$file.src" or die "Could not open file: $!";
+truncate $fh_b, 0;
+
+my $bad = [fileno($fh_src), 0, fileno($fh_ro), undef, 1000, 0];
+@results = $splice->splice_batch(
+    $bad,
+    [fileno($fh_src), 1000, fileno($fh_b), 0, 1000, 0],
+);
+is_deeply($results[0], [0, EBADF], "Write to a read only fd fails");
+is($bad->[1], 0, "Input offset is not advanced past unwritten data");
+is_deeply($results[1], [1000, 0], "Next transfer is copied");
+sysseek $fh_b, 0, 0;
+sysread $fh_b, $data, 2000;
+is($data, "B" x 1000, "Next transfer has its own content");
+is(int @{$splice->{pool}}, 1, "Pipe is given back after a failed batch");
+close $_ for ($fh_ro, $fh_src);
+
+# splice_cp runs through splice_batch too when it splices
+seek $fh_in, 0, 0;
+truncate $fh_a, 0;
+seek $fh_a, 0, 0;
+$splice = new Sys::Splice(cp_methods => ['splice']);
+is($splice->splice_cp($fh_in, $fh_a), 100000, "splice_cp through batch");
+
+close $_ for ($fh_in, $fh_a, $fh_b);
+unlink $file, "$file.a", "$file.b", "$file.src";
@@ -0,0 +1,91 @@
+use strict;
+use warnings;
+
+use Test::More;
+
+use Socket;
+use Sys::Splice;
+
+plan skip_all => "Fast paths need Sys::Splice::XS" if !$Sys::Splice::XS;
+plan tests => 10;
+
+my $file = "/tmp/cp.file.$$";
+
+open my $fh, ">", $file or die "Could not open file: $!";
+print {$fh} "0123456789" x 100000;
+close $fh;
+
+sub copy {
+    my ($splice, $fh_out) = @_;
+    open my $fh_in, "<", $file or die "Could not open file: $!";
+    my $bytes = $splice->splice_cp($fh_in, $fh_out);
+    close $fh_in;
+    return $bytes;
+}
+
+sub content {
+    open my $fh, "<", "$file.copy" or die "Could not open file: $!";
+    local $/;
+    return <$fh>;
+}
+
+my $splice = new Sys::Splice();
+
+# File to file
+open my $fh_out, ">", "$file.copy" or die "Could not open file: $!";
+is(copy($splice, $fh_out), 1000000, "File copied");
+close $fh_out;
+is($splice->cp_method(), 'copy_file_range', "File to file is copy_file_range");
+is(content(), "0123456789" x 100000, "Copy has the same content");
+
+# File to socket
+socketpair(my $sink, my $peer, AF_UNIX, SOCK_STREAM, PF_UNSPEC)
+    or die "Could not make socketpair: $!";
+
+my $pid = fork;
+die "Could not fork: $!" if !defined $pid;
+if(!$pid) {
+    close $peer;
+    copy($splice, $sink);
+    exit($splice->cp_method() eq 'sendfile' ? 0 : 1);
+}
+close $sink;
+
+my $data = '';
+while(sysread $peer, my $buf, 65536) {
+    $data .= $buf;
+}
+waitpid $pid, 0;
+is($?, 0, "File to socket is sendfile");
+is(length $data, 1000000, "Peer got everything");
+
+# copy_file_range does not do pipes, falls back to splice
+pipe my $pipe_out, my $pipe_in or die ("Could not make pipe: $!");
+$splice = new Sys::Splice(cp_methods => ['copy_file_range']);
+
+$pid = fork;
+die "Could not fork: $!" if !defined $pid;
+if(!$pid) {
+    close $pipe_out;
+    copy($splice, $pipe_in);
+    exit($splice->cp_method() eq 'splice' ? 0 : 1);
+}
+close $pipe_in;
+
+$data = '';
+while(sysread $pipe_out, my $buf, 65536) {
+    $data .= $buf;
+}
+waitpid $pid, 0;
+is($?, 0, "Fell back to splice");
+is($data, "0123456789" x 100000, "Pipe got the same content");
+
+# Forced method
+$splice = new Sys::Splice(cp_methods => ['sendfile']);
+open $fh_out, ">", "$file.copy" or die "Could not open file: $!";
+is(copy($splice, $fh_out), 1000000, "File copied with sendfile");
+close $fh_out;
+is($splice->cp_method(), 'sendfile', "Method is used");
+is(content(), "0123456789" x 100000, "Copy has the same content");
+
+unlink $file, "$file.copy";
@@ -1,10 +1,16 @@
 use strict;
 use warnings;
 
-use Test::More tests => 8;
+use Test::More tests => 39;
+use Config;
 
+use Sys::Splice qw(sys_vmsplice pack_iovec);
 use Sys::Splice::iovec qw(dumphex);
 
+# Same layout as the probed struct iovec, but with a numeric address
+my $ADDR = $Sys::Splice::SYS_POINTER_TEMPLATE;
+(my $VEC = $Sys::Splice::SYS_IOVEC_TEMPLATE) =~ s/P/$ADDR/;
+
 my $buf1 = "hello11";
 my $buf2 = "hello22";
 my $buf3 = "hello33";
@@ -15,6 +21,15 @@ is($iov->struct(), generate_vecs(\$buf1, \$buf2, \$buf3), "Initial structure");
 
 is($iov->size(), 3, "Number of vecs is 3 in object");
 
+is(length $iov->struct(), 3 * $Sys::Splice::SYS_IOVEC_SIZE, 
+    "Vecs are the probed size");
+
+is(pack_iovec($buf1, $buf2, $buf3), $iov->struct(), 
+    "pack_iovec has the same layout");
+
+eval { $buf1 .= "x" };
+like($@, qr/read-only/, "Buffer in flight is read only");
+
 # points to start of buf2
 $iov->inc(7);
 
@@ -22,9 +37,12 @@ is($iov->size(), 2, "Number of vecs is 2 in object");
 
 is($iov->struct(), generate_vecs(\$buf2, \$buf3), "Incremented to next secment");
 
+eval { $buf1 = "hello11" };
+is($@, '', "Consumed buffer is writable again");
+
 # points to middle of $buf3
 $iov->inc(7+3);
-my $vecs = pack("L!L", memory_address(\$buf3)+3, length($buf3)-3);
+my $vecs = pack($VEC, memory_address(\$buf3)+3, length($buf3)-3);
 is($iov->struct(), $vecs, "Incremented to middle of next secment");
 
 # points to end
@@ -33,42 +51,125 @@ is($iov->struct(), '', "Incremented to end");
 is($iov->empty(), 1, "Incremented to end");
 is($iov->size(), 0, "Number of vecs is 0 in object");
 
-#dumphex($vecs);
-#print "---------------------------\n";
-#dumphex($iov->struct());
-  
-# points to middle in buf1
-#$iov->dec(5);
+eval { $iov->inc(1) };
+like($@, qr/past end/, "Cannot increment past end");
+
+# points to middle in buf2
+$iov->dec(7+5);
+is($iov->size(), 2, "Number of vecs is 2 after dec");
+$vecs = pack($VEC, memory_address(\$buf2)+2, length($buf2)-2);
+is(substr($iov->struct(), 0, length $vecs), $vecs, "Decremented to middle of buf2");
+
+eval { $buf2 .= "x" };
+like($@, qr/read-only/, "Buffer moved back into is read only again");
+
+$iov->dec(2+7);
+is($iov->struct(), generate_vecs(\$buf1, \$buf2, \$buf3), "Decremented to start");
+
+eval { $iov->dec(1) };
+like($@, qr/past start/, "Cannot decrement past start");
+
+# push, pop, shift and unshift
+my $buf4 = "hello44";
+my $buf5 = "hello55";
+$iov->push(\$buf4);
+is($iov->size(), 4, "Pushed buffer");
+
+is(${$iov->pop()}, "hello44", "Popped buffer");
+eval { $buf4 .= "x" };
+is($@, '', "Popped buffer is writable");
+
+$iov->unshift(\$buf5);
+is($iov->struct(), generate_vecs(\$buf5, \$buf1, \$buf2, \$buf3),
+    "Unshift at start keeps pointer at start");
+
+is(${$iov->shift()}, "hello55", "Shifted buffer");
+$iov->inc(3);
+$iov->unshift(\$buf5);
+is($iov->size(), 3, "Unshift after inc counts as consumed");
+$iov->dec(3+7);
+is($iov->struct(), generate_vecs(\$buf5, \$buf1, \$buf2, \$buf3),
+    "Decremented into unshifted buffer");
+
+# Buffers are kept alive by the object
+{
+    my $tmp = "temporary";
+    $iov->push(\$tmp);
+}
+$iov->inc(7*4);
+my ($address, $length) = unpack($VEC, $iov->struct());
+is(unpack("P$length", pack($ADDR, $address)), "temporary",
+    "Buffer outlives its scope");
+
+undef $iov;
+eval { $buf3 .= "x" };
+is($@, '', "Buffers are released when object is destroyed");
+
+# Buffers that already are read only stay that way
+$iov = new Sys::Splice::iovec(\"constant");
+$iov->inc(8);
+eval { ${$iov->pop()} .= "x" };
+like($@, qr/read-only/, "Read only buffer stays read only");
+
+# A buffer can be in several vectors
+my $iov1 = new Sys::Splice::iovec(\$buf1);
+my $iov2 = new Sys::Splice::iovec(\$buf1);
+undef $iov1;
+eval { $buf1 .= "x" };
+like($@, qr/read-only/, "Buffer stays read only while in another vector");
+undef $iov2;
+
+# A bad buffer fails the whole call before anything is taken
+my $good = "good";
+ok(!eval { new Sys::Splice::iovec(\$good, []) }, "Array ref is not a buffer");
+eval { $good .= "x" };
+is($@, '', "Buffers before the bad one are not kept");
+
+# vmsplice directly from the object
+pipe my $pipe_out, my $pipe_in or die ("Could not make pipe: $!");
+$iov = new Sys::Splice::iovec(\$buf4, \$buf5);
+$iov->inc(2);
+is(sys_vmsplice(fileno($pipe_in), $iov, $iov->size(), 0), 13,
+    "vmsplice from object");
+sysread $pipe_out, my $data, 1024;
+is($data, "llo44xhello55", "vmsplice from current position");
+
+# More than 4 GiB in total, the same buffer is used for every vec
+SKIP: {
+    skip "size_t is 32 bit", 6 if $Config{sizesize} < 8;
+
+    my $big = "x" x (64*1024*1024);
+    my $total = 65 * length $big;
+    $iov = new Sys::Splice::iovec((\$big) x 65);
+
+    is(length $iov->struct(), 65 * $Sys::Splice::SYS_IOVEC_SIZE,
+        "65 vecs of 64 MiB");
+
+    $iov->inc(2**32 + 3);
+    is($iov->size(), 1, "Incremented past 4 GiB");
+    is($iov->struct(), pack($VEC, memory_address(\$big)+3, length($big)-3),
+        "Incremented to middle of last vec");
+
+    eval { $big .= "x" };
+    like($@, qr/read-only/, "Buffer still in flight is read only");
+
+    $iov->dec(2**32 + 3);
+    is($iov->size(), 65, "Decremented past 4 GiB");
+
+    $iov->inc($total);
+    eval { $big .= "x" };
+    is($@, '', "Buffer is released after last vec");
+}
 
 sub generate_vecs {
-    my $str;
+    my $str = '';
     foreach my $buf (@_) {
-        $str .= pack('P L', $$buf, length($$buf));
+        $str .= pack($VEC, memory_address($buf), length($$buf));
     }
     return $str;
 }
 
 sub memory_address {
     my($buf) = @_;
-    #print "mem1: ${$buf}\n";
-    unpack("L!", pack('P', ${$buf}));
+    unpack($ADDR, pack('P', ${$buf}));
 }
-
-sub memory_address2 {
-    #print "mem2: $_[0]\n";
-    unpack("L!", pack('P', $_[0]));
-}
-
-#my $a1 = unpack("L!", pack('P', $buf1));
-#print "mem0: $buf1\n";
-#my $a2 = memory_address(\$buf1);
-#my $a3 = memory_address2($buf1);
-#my $a4;
-#foreach my $var ($buf1) {
-#    $a4 = unpack("L!", pack('P', $var));
-#}
-#my $var = $buf1;
-#my $a5 = unpack("L!", pack('P', $var));
-#
-#print "$a1, $a2, $a3, $a4, $a5\n";
-#exit;
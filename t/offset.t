@@ -0,0 +1,33 @@
+use strict;
+use warnings;
+
+use Test::More tests => 12;
+
+use Sys::Splice;
+
+my $file = "/tmp/offset.file.$$";
+open my $fh, "+>", $file or die "Could not open file: $!";
+syswrite $fh, "0123456789abcdef";
+sysseek $fh, 4, 0;
+
+foreach my $impl (\&Sys::Splice::sys_splice, \&Sys::Splice::_syscall_splice) {
+    pipe my $pipe_out, my $pipe_in or die ("Could not make pipe: $!");
+
+    my $offset = 10;
+    is($impl->(fileno($fh), $offset, fileno($pipe_in), undef, 3, 0), 3,
+        "Positional splice from file");
+    is($offset, 13, "Offset is advanced");
+    is(sysseek($fh, 0, 1), 4, "File position is untouched");
+
+    sysread $pipe_out, my $data, 1024;
+    is($data, "abc", "Read from offset");
+
+    # Constant offsets are used but can not be written back
+    is($impl->(fileno($fh), 0, fileno($pipe_in), undef, 2, 0), 2,
+        "Positional splice with constant offset");
+    sysread $pipe_out, $data, 1024;
+    is($data, "01", "Read from constant offset");
+}
+
+close $fh;
+unlink $file;
@@ -0,0 +1,46 @@
+use strict;
+use warnings;
+
+use Test::More tests => 8;
+
+use Sys::Splice;
+
+my $file = "/tmp/parallel.file.$$";
+my $size = 3 * $Sys::Splice::SYS_CP_ALIGN + 12345;
+
+open my $fh, ">", $file or die "Could not open file: $!";
+print {$fh} pack("N*", 0 .. $size / 4);
+truncate $fh, $size;
+close $fh;
+
+sub content {
+    my ($name) = @_;
+    open my $fh, "<", $name or die "Could not open file: $!";
+    local $/;
+    return <$fh>;
+}
+
+my $splice = new Sys::Splice(workers => 4);
+
+open my $fh_in, "<", $file or die "Could not open file: $!";
+open my $fh_out, ">", "$file.copy" or die "Could not open file: $!";
+is($splice->splice_cp($fh_in, $fh_out), $size, "Copied with workers");
+is($splice->cp_method(), 'parallel', "Method is parallel");
+is(sysseek($fh_in, 0, 1), "0 but true", "Input position is left alone");
+close $fh_in;
+close $fh_out;
+
+is(-s "$file.copy", $size, "Copy has the same size");
+ok(content($file) eq content("$file.copy"), "Copy has the same content");
+is(int @{$splice->{pool}}, 0, "Workers use their own pipes");
+
+# More workers than aligned ranges
+$splice = new Sys::Splice(workers => 16);
+open $fh_in, "<", $file or die "Could not open file: $!";
+open $fh_out, ">", "$file.copy" or die "Could not open file: $!";
+is($splice->splice_cp($fh_in, $fh_out), $size, "Copied with idle workers");
+close $fh_in;
+close $fh_out;
+ok(content($file) eq content("$file.copy"), "Copy has the same content");
+
+unlink $file, "$file.copy";
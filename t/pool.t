@@ -0,0 +1,81 @@
+use strict;
+use warnings;
+
+use Test::More tests => 14;
+
+use Sys::Splice qw(splice_cp vmsplice_tofh);
+
+my $file = "/tmp/pool.file.$$";
+
+# Only splice uses the pool, keep splice_cp off the fast paths
+my $splice = new Sys::Splice(pipes => 1, pipe_size => 128*1024,
+    cp_methods => ['splice']);
+
+open my $fh, ">", $file or die "Could not open file: $!";
+is($splice->vmsplice_tofh($fh, "Hello\n", "World\n"), 12,
+    "vmsplice_tofh method");
+close $fh;
+
+is(int @{$splice->{pool}}, 1, "Pipe is returned to the pool");
+my ($pipe_out, $pipe_in) = @{$splice->{pool}[0]};
+
+is(fcntl($pipe_in, $Sys::Splice::SYS_F_GETPIPE_SZ, 0), 128*1024,
+    "Pipe is resized");
+
+open my $fh_in, "<", $file or die "Could not open file: $!";
+open my $fh_out, ">", "$file.copy" or die "Could not open file: $!";
+is($splice->splice_cp($fh_in, $fh_out), 12, "splice_cp method");
+close $fh_in;
+close $fh_out;
+
+is(int @{$splice->{pool}}, 1, "Pool still has one pipe");
+is($splice->{pool}[0][0], $pipe_out, "Same pipe is reused");
+
+open $fh, "<", "$file.copy" or die "Could not open file: $!";
+is(join('', <$fh>), "Hello\nWorld\n", "Copy has the same content");
+close $fh;
+
+# Function form uses a default object
+$Sys::Splice::DEFAULT = new Sys::Splice(cp_methods => ['splice']);
+open $fh_in, "<", $file or die "Could not open file: $!";
+open $fh_out, ">", "$file.copy" or die "Could not open file: $!";
+is(splice_cp($fh_in, $fh_out), 12, "splice_cp function");
+close $fh_in;
+close $fh_out;
+
+is(int @{$Sys::Splice::DEFAULT->{pool}}, 1, "Default object pools the pipe");
+
+# No pooling at all
+$splice = new Sys::Splice(pipes => 0, cp_methods => ['splice']);
+$splice->_put_pipe($splice->_get_pipe());
+is(int @{$splice->{pool}}, 0, "Pool can be turned off");
+
+# Largest pipe allowed, splice_cp follows the pipe size
+open my $max_fh, "<", "/proc/sys/fs/pipe-max-size" or die "$!";
+my $max_size = int <$max_fh>;
+close $max_fh;
+
+$splice = new Sys::Splice(pipe_size => 'max', cp_methods => ['splice']);
+my ($out, $in, $size) = $splice->_get_pipe();
+is(fcntl($in, $Sys::Splice::SYS_F_GETPIPE_SZ, 0), $max_size, 
+    "Pipe is grown to pipe-max-size");
+is($size, $max_size, "Chunk size follows the pipe size");
+$splice->_put_pipe($out, $in, $size);
+
+$splice = new Sys::Splice(pipe_size => $max_size * 2);
+($out, $in, $size) = $splice->_get_pipe();
+is($size, $max_size, "Pipe size is capped at pipe-max-size");
+$splice->_put_pipe($out, $in, $size);
+
+open $fh, ">", $file or die "Could not open file: $!";
+print {$fh} "x" x (3 * $max_size + 5);
+close $fh;
+
+open $fh_in, "<", $file or die "Could not open file: $!";
+open $fh_out, ">", "$file.copy" or die "Could not open file: $!";
+is($splice->splice_cp($fh_in, $fh_out), 3 * $max_size + 5, 
+    "splice_cp larger than the pipe");
+close $fh_in;
+close $fh_out;
+
+unlink $file, "$file.copy";
@@ -0,0 +1,58 @@
+use strict;
+use warnings;
+
+use Test::More tests => 14;
+
+use Socket;
+use IO::Handle;
+use Sys::Splice;
+use Sys::Splice::Pump;
+
+pipe my $src_out, my $src_in or die ("Could not make pipe: $!");
+socketpair(my $sink, my $peer, AF_UNIX, SOCK_STREAM, PF_UNSPEC)
+    or die "Could not make socketpair: $!";
+$_->blocking(0) for ($src_out, $sink, $peer);
+
+my $splice = new Sys::Splice(pipes => 1);
+my $pump = new Sys::Splice::Pump(in => $src_out, out => $sink,
+    splice => $splice);
+
+is($pump->step(), 0, "Nothing to move yet");
+ok($pump->want_read(), "Waiting for the source");
+ok(!$pump->want_write(), "Not waiting for the sink");
+
+syswrite $src_in, "hello world\n";
+is($pump->step(), 12, "Moved data to sink");
+sysread $peer, my $data, 1024;
+is($data, "hello world\n", "Peer got the data");
+
+# Fill the sink until it would block
+my $filled = 0;
+my $chunk = "x" x 65536;
+while(1) {
+    syswrite $src_in, $chunk or last;
+    my $moved = $pump->step();
+    $filled += $moved;
+    last if $pump->want_write();
+}
+ok($pump->want_write(), "Waiting for the sink when it is full");
+$pump->step();
+ok(!$pump->want_read(), "Not polling the source while the pipe is stuck");
+
+# Drain the peer and let the pump catch up
+my $read = 0;
+while($read < $filled or $pump->want_write()) {
+    my $ret = sysread $peer, $data, 1024*1024;
+    $read += $ret if $ret;
+    $filled += $pump->step();
+}
+ok(!$pump->want_write(), "Sink caught up");
+ok($pump->want_read(), "Waiting for the source again");
+is($read, $filled, "Peer got everything that was moved");
+
+close $src_in;
+$pump->step();
+ok($pump->done(), "Pump is done at end of file");
+ok(!$pump->want_read(), "Not waiting for the source after end of file");
+is($pump->written(), $filled + 12, "Written counts all bytes");
+is(int @{$splice->{pool}}, 1, "Pipe is given back to the pool");
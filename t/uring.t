@@ -0,0 +1,83 @@
+use strict;
+use warnings;
+
+use Test::More;
+
+use POSIX qw(EBADF);
+use Sys::Splice;
+
+my $ring = eval {
+    require Sys::Splice::XS::uring;
+    Sys::Splice::XS::uring::available()
+        and Sys::Splice::XS::uring->new(8);
+};
+plan skip_all => "No io_uring support" if !$ring;
+plan tests => 19;
+
+my $file = "/tmp/uring.file.$$";
+
+open my $fh, ">", $file or die "Could not open file: $!";
+print {$fh} "0123456789" x 100000;
+close $fh;
+
+open my $fh_in, "<", $file or die "Could not open file: $!";
+open my $fh_out, "+>", "$file.copy" or die "Could not open file: $!";
+pipe my $pipe_out, my $pipe_in or die ("Could not make pipe: $!");
+pipe my $tee_out, my $tee_in or die ("Could not make pipe: $!");
+
+ok($ring->entries() >= 8, "Ring has the entries asked for");
+ok(!eval { Sys::Splice::XS::uring->new(1) }, "Ring needs room for a pair");
+
+# Linked file -> pipe -> pipe -> file chain
+ok($ring->queue_splice($fh_in, 5, $pipe_in, undef, 10, 0, 1, 1),
+    "Queue splice");
+ok($ring->queue_tee($pipe_out, $tee_in, 10, 0, 2, 1), "Queue tee");
+ok($ring->queue_splice($pipe_out, undef, $fh_out, 0, 10, 0, 3),
+    "Queue linked splice");
+is($ring->submit(3), 3, "Submitted all three");
+
+my @cqes = sort { $a->[0] <=> $b->[0] } $ring->reap();
+is_deeply(\@cqes, [[1, 10], [2, 10], [3, 10]], "All completed in full");
+
+sysread $tee_out, my $data, 1024;
+is($data, "5678901234", "Tee got the data");
+sysseek $fh_out, 0, 0;
+sysread $fh_out, $data, 1024;
+is($data, "5678901234", "File got the data");
+
+# splice_batch through the ring, more chunks than fit in one round
+my $splice = new Sys::Splice(pipes => 1, pipe_size => 4096, io_uring => 8);
+ok($splice->io_uring(), "Object uses io_uring");
+
+truncate $fh_out, 0;
+my $range = [fileno($fh_in), 3, fileno($fh_out), 0, 50000, 0];
+my @results = $splice->splice_batch($range);
+is_deeply($results[0], [50000, 0], "Range copied through the ring");
+is($range->[1], 50003, "Input offset is advanced");
+
+sysseek $fh_out, 49990, 0;
+sysread $fh_out, $data, 1024;
+is($data, "3456789012", "Copy has the right content");
+
+@results = $splice->splice_batch([-1, undef, fileno($fh_out), undef, 10, 0]);
+is_deeply($results[0], [0, EBADF], "Failed transfer reports errno");
+
+# A transfer that fails while writing must not leak into the next one
+open my $fh_ro, "<", "$file.copy" or die "Could not open file: $!";
+truncate $fh_out, 0;
+my $bad = [fileno($fh_in), 0, fileno($fh_ro), undef, 1000, 0];
+@results = $splice->splice_batch(
+    $bad,
+    [fileno($fh_in), 1000, fileno($fh_out), 0, 1000, 0],
+);
+is($results[0][1], EBADF, "Write to a read only fd fails");
+is($bad->[1], $results[0][0], "Input offset only counts written bytes");
+is_deeply($results[1], [1000, 0], "Next transfer is copied");
+sysseek $fh_out, 0, 0;
+sysread $fh_out, $data, 2000;
+is($data, "0123456789" x 100, "Next transfer has its own content");
+is(int @{$splice->{pool}}, 1, "Pipe is given back after a failed batch");
+close $fh_ro;
+
+close $_ for ($fh_in, $fh_out);
+unlink $file, "$file.copy";
@@ -25,8 +25,8 @@ while(!$iov->empty()) {
 
     while($vmbytes) {
         # splice the pipe to our file handle 
-        my $fhbytes = sys_splice(fileno($pipe_out), 0, fileno($fh), 
-            0, $vmbytes, 0);
+        my $fhbytes = sys_splice(fileno($pipe_out), undef, fileno($fh), 
+            undef, $vmbytes, 0);
 
         if($fhbytes <= 0) {
             die "splice: $!";
@@ -36,7 +36,10 @@ while(!$iov->empty()) {
     }
 }
 
-system "cat /tmp/file.file.$$";
+close $fh;
+
+open $fh, "<", "/tmp/file.file.$$" or die "Could not open file: $!";
+is(join('', <$fh>), "hello1hello2\n", "File contains both buffers");
 close $fh;
 
 unlink "/tmp/file.file.$$";
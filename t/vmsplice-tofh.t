@@ -19,7 +19,10 @@ my $buf2 = "World\n";
 # Write both buffers to file handle
 vmsplice_tofh($fh, $buf1, $buf2);
 
-system "cat /tmp/test.file.$$";
+close $fh;
 
+open $fh, "<", "/tmp/test.file.$$" or die "Could not open file: $!";
+is(join('', <$fh>), "Hello\nWorld\n", "File contains both buffers");
 close $fh;
+
 unlink "/tmp/test.file.$$";
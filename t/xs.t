@@ -0,0 +1,40 @@
+use strict;
+use warnings;
+
+use Test::More tests => 7;
+
+use Sys::Splice qw(pack_iovec);
+use Sys::Splice::XS qw(sys_splice sys_tee sys_vmsplice);
+
+my $buf = "hello world\n";
+my $vecs = pack_iovec($buf);
+
+pipe my $pipe_out, my $pipe_in or die ("Could not make pipe: $!");
+pipe my $tee_out, my $tee_in or die ("Could not make pipe: $!");
+
+# Filehandle arguments
+is(sys_vmsplice($pipe_in, $vecs, 1, 0), length $buf, "vmsplice to pipe");
+
+# File descriptor arguments
+is(sys_tee(fileno($pipe_out), fileno($tee_in), length $buf, 0), length $buf,
+    "tee to second pipe");
+
+open my $fh, "+>", "/tmp/xs.file.$$" or die "Could not open file: $!";
+is(sys_splice($pipe_out, undef, $fh, undef, length $buf, 0), length $buf,
+    "splice pipe to file");
+
+sysseek $fh, 0, 0;
+sysread $fh, my $data, 1024;
+is($data, $buf, "File contains buffer");
+
+sysread $tee_out, $data, 1024;
+is($data, $buf, "Second pipe contains buffer");
+
+is(sys_splice($pipe_out, undef, -1, undef, 1, 0), -1,
+    "splice to invalid fd fails");
+
+eval { sys_vmsplice($pipe_in, $vecs, 2, 0) };
+like($@, qr/less than 2 segments/, "vmsplice checks iovec buffer size");
+
+close $fh;
+unlink "/tmp/xs.file.$$";